@@ -77,6 +77,43 @@ public class UsbSerialHelper implements SerialInputOutputManager.Listener {
         return "";
     }
 
+    // the same ports as getSerialPortPaths(), one per line, each with its device's details separated by tabs:
+    // path, vendor id, product id, serial number, manufacturer, product, driver
+    String getSerialPortInfo(Context contextIn) {
+        try {
+            UsbManager usbManager = (UsbManager) context.getSystemService (USB_SERVICE);
+
+            for (UsbDevice device : usbManager.getDeviceList().values()) {
+                CdcAcmSerialDriver driver = new CdcAcmSerialDriver(device);
+
+                String serialNumber = "";
+                try {
+                    // needs permission for the device from Android 10 on
+                    serialNumber = device.getSerialNumber();
+                } catch (SecurityException e) {
+                }
+
+                String details = device.getVendorId() + "\t" + device.getProductId() + "\t" + infoField(serialNumber)
+                               + "\t" + infoField(device.getManufacturerName()) + "\t" + infoField(device.getProductName())
+                               + "\t" + driver.getClass().getSimpleName();
+
+                String allPorts = "";
+                for (UsbSerialPort s : driver.getPorts())
+                    allPorts += "serialport " + s.getPortNumber() + "\t" + details + "\n";
+
+                return allPorts;
+            }
+        } catch (Exception e) {
+            e.printStackTrace();
+        }
+
+        return "";
+    }
+
+    private static String infoField(String value) {
+        return value == null ? "" : value.replace('\t', ' ').replace('\n', ' ');
+    }
+
     public UsbSerialHelper(Context contextIn, Activity mainActivityIn) {
         context = contextIn;
         mainActivity = mainActivityIn;
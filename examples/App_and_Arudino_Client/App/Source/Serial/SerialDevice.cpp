@@ -4,17 +4,9 @@
 const auto kNumberOfDecimalPlaces { 4 };
 
 // NOTE: This is a very basic protocol without any error checking. To add error checking, you would want to calculate an error check (checksum, crc, etc)
-//       and add that to the end of the packet. On the receiving end you would calculate the error check and compare it to the one sent
+//       and add that to the end of the packet. On the receiving end you would calculate the error check and compare it to the one sent.
+//       SerialPortCheckedFramer does both, eg. SerialPortCheckedFramer<PacketFramer, SerialPortCrc16Modbus>, once the Arduino sketch sends one
 
-enum ParseState
-{
-    waitingForStartByte1,
-    waitingForStartByte2,
-    waitingForCommand,
-    waitingForCommandDataSize,
-    waitingForCommandData
-};
-ParseState parseState = waitingForStartByte1;
 // NOTE: the start bytes are used to indicate the start of a packet.
 //       they are arbitrary values, and when you choose them it is better the less likely they will appear in your data together
 const int kStartByte1 = '*';
@@ -32,6 +24,20 @@ enum Command
 const int kMaxPayloadSize = 20;
 Command gTestCommandToExecute {Command::lightColor};
 
+// NOTE: the module's framer for this packet layout: start bytes, command, one byte data length, data.
+//       it takes care of finding the start of each packet and collecting the data, even when a packet arrives in pieces
+const int kMaxCommandDataBytes = 4;
+using PacketFramer = SerialPortStartBytesFramer<kStartByte1, kStartByte2, kMaxCommandDataBytes, Command::endOfList>;
+
+// NOTE: the layout of each command's packet. the header is the start bytes, the command and the size of the command data,
+//       followed by the command data fields. the sizes are all worked out at compile time, and the same layout is used to
+//       build outgoing packets and to read incoming ones
+template <Command command, typename... Fields>
+using CommandPacket = SerialPortPacket<SerialPortPacketBytes<kStartByte1, kStartByte2, command, SerialPortPacket<Fields...>::size>, Fields...>;
+using LightColorPacket = CommandPacket<Command::lightColor, SerialPortLittleEndian<uint16_t>>;
+using TempoPacket = CommandPacket<Command::tempo, SerialPortLittleEndian<uint32_t>>;
+using ChargingAlarmLevelPacket = CommandPacket<Command::chargingAlarmLevel, SerialPortLittleEndian<uint8_t>, SerialPortLittleEndian<uint8_t>>;
+
 SerialDevice::SerialDevice ()
     : Thread (juce::String ("SerialDevice"))
 {
@@ -58,12 +64,8 @@ void SerialDevice::setLightColor (uint16_t color)
     if (serialPortOutput.get () == nullptr)
         return;
 
-    // TODO: make helper function to assemble packets
-    // TODO: use helper functions to break larger data into bytes
-
-    const std::vector<uint8_t> data { kStartByte1, kStartByte2, Command::lightColor, 2,
-                                      static_cast<uint8_t>(color & 0xff), static_cast<uint8_t>((color >> 8) & 0xff) };
-    serialPortOutput->write (data.data (), data.size ());
+    // NOTE: the packet is built directly in the output stream's transmit queue, so nothing is allocated or copied
+    serialPortOutput->writePacket<LightColorPacket> (color);
 }
 
 void SerialDevice::setTempo (float tempoToSend)
@@ -73,10 +75,7 @@ void SerialDevice::setTempo (float tempoToSend)
 
     // NOTE: by sending an int instead of a float we don't have to worry about the receiving end storing floats in the same format as the send
     const auto tempo_as_int { static_cast<uint32_t>(tempoToSend * std::pow (10, kNumberOfDecimalPlaces)) };
-    const std::vector<uint8_t> data { kStartByte1, kStartByte2, Command::tempo, 4,
-                                      static_cast<uint8_t>(tempo_as_int & 0xff), static_cast<uint8_t>((tempo_as_int >> 8) & 0xff),
-                                      static_cast<uint8_t>((tempo_as_int >> 16) & 0xff), static_cast<uint8_t>((tempo_as_int >> 24) & 0xff) };
-    serialPortOutput->write (data.data (), data.size ());
+    serialPortOutput->writePacket<TempoPacket> (tempo_as_int);
 }
 
 void SerialDevice::setChargingAlarmLevel (uint8_t alarmType, uint8_t chargeLevel)
@@ -84,9 +83,7 @@ void SerialDevice::setChargingAlarmLevel (uint8_t alarmType, uint8_t chargeLevel
     if (serialPortOutput.get () == nullptr)
         return;
 
-    const std::vector<uint8_t> data { kStartByte1, kStartByte2, Command::chargingAlarmLevel, 2,
-                                      alarmType, chargeLevel };
-    serialPortOutput->write (data.data (), data.size ());
+    serialPortOutput->writePacket<ChargingAlarmLevelPacket> (alarmType, chargeLevel);
 }
 
 void SerialDevice::open (void)
@@ -141,34 +138,34 @@ void SerialDevice::closeSerialPort (void)
 
 // NOTE: these handleXXXXCommand functions store the received data into the data model, and should also alert listeners of the change
 //       I usually use ValueTrees for the data model, and use the property change callbacks to notify listeners
-void SerialDevice::handleTempoCommand (uint8_t* data, int dataSize)
+// NOTE: readFields checks the command data is the right size for the command, and reads the fields out of it
+void SerialDevice::handleTempoCommand (const uint8_t* data, int dataSize)
 {
-    if (dataSize != 4)
+    uint32_t tempoAsInt;
+    if (! TempoPacket::readFields (data, static_cast<size_t> (dataSize), tempoAsInt))
         return;
-    const auto tempoAsInt { static_cast<uint32_t>(data [0] + (data [1] << 8) + (data [2] << 16) + (data [3] << 24)) };
     tempo = static_cast<float>(tempoAsInt / std::pow (10, kNumberOfDecimalPlaces));
 }
 
-void SerialDevice::handleLightColorCommand (uint8_t* data, int dataSize)
+void SerialDevice::handleLightColorCommand (const uint8_t* data, int dataSize)
 {
-    if (dataSize != 2)
-        return;
-    lightColor = static_cast<uint16_t>(data [0] + (data [1] << 8));
+    LightColorPacket::readFields (data, static_cast<size_t> (dataSize), lightColor);
 }
 
-void SerialDevice::handleChargingAlarmLevelCommand (uint8_t* data, int dataSize)
+void SerialDevice::handleChargingAlarmLevelCommand (const uint8_t* data, int dataSize)
 {
-    if (dataSize != 2)
+    uint8_t alarmIndex;
+    uint8_t alarmLevel;
+    if (! ChargingAlarmLevelPacket::readFields (data, static_cast<size_t> (dataSize), alarmIndex, alarmLevel))
         return;
 
-    const auto alarmIndex { data [0] };
     if (alarmIndex >= 2)
         return;
 
-    alarmLevels [alarmIndex] = data [1];
+    alarmLevels [alarmIndex] = alarmLevel;
 }
 
-void SerialDevice::handleCommand (uint8_t command, uint8_t* data, int dataSize)
+void SerialDevice::handleCommand (uint8_t command, const uint8_t* data, int dataSize)
 {
     switch (command)
     {
@@ -178,14 +175,9 @@ void SerialDevice::handleCommand (uint8_t command, uint8_t* data, int dataSize)
     }
 }
 
-#define kSerialPortBufferLen 256
 void SerialDevice::run ()
 {
-    const int kMaxCommandDataBytes = 4;
-    uint8_t commandData [kMaxCommandDataBytes];
-    uint8_t command = Command::none;
-    uint8_t commandDataSize = 0;
-    uint8_t commandDataCount = 0;
+    PacketFramer packetFramer;
     while (!threadShouldExit ())
     {
         switch (threadTask)
@@ -201,6 +193,7 @@ void SerialDevice::run ()
             {
                 if (openSerialPort ())
                 {
+                    packetFramer.reset ();
                     threadTask = ThreadTask::processSerialPort;
                 }
                 else
@@ -231,104 +224,22 @@ void SerialDevice::run ()
                 // handle reading from the serial port
                 if ((serialPortInput != nullptr) && (!serialPortInput->isExhausted ()))
                 {
-                    auto  bytesRead = 0;
-                    auto  dataIndex = 0;
-                    uint8_t incomingData [kSerialPortBufferLen];
-
-                    bytesRead = serialPortInput->read (incomingData, kSerialPortBufferLen);
-                    if (bytesRead < 1)
+                    // NOTE: the data is parsed where it sits in the input stream's buffer, without copying it out first.
+                    //       each complete packet arrives as the command byte followed by the command data. the handlers only
+                    //       store the fields, as the buffer is held open while they run
+                    serialPortInput->readFrames (packetFramer, [this] (const uint8_t* packet, size_t packetSize)
                     {
-                        wait (1);
-                        continue;
-                    }
-                    else
-                    {
-                        // TODO: extract into function or class
-                        // parseIncomingData (incomingData, bytesRead);
-                        auto resetParser = [this, &command, &commandDataSize, &commandDataCount] ()
-                        {
-                            command = Command::none;
-                            commandDataSize = 0;
-                            commandDataCount = 0;
-                            parseState = ParseState::waitingForStartByte1;
-                        };
-                        // parse incoming data
-                        while (dataIndex < bytesRead)
-                        {
-                            const uint8_t dataByte = incomingData [dataIndex];
-                            // NOTE: the following line prints each byte received in the debug output window
-                            juce::Logger::outputDebugString (juce::String (dataByte));
-                            switch (parseState)
-                            {
-                                case ParseState::waitingForStartByte1:
-                                {
-                                    if (dataByte == kStartByte1)
-                                        parseState = ParseState::waitingForStartByte2;
-                                }
-                                break;
-                                case ParseState::waitingForStartByte2:
-                                {
-                                    if (dataByte == kStartByte2)
-                                        parseState = ParseState::waitingForCommand;
-                                    else
-                                        resetParser ();
-                                }
-                                break;
-                                case ParseState::waitingForCommand:
-                                {
-                                    if (dataByte >= Command::none && dataByte < Command::endOfList)
-                                    {
-                                        command = dataByte;
-                                        parseState = ParseState::waitingForCommandDataSize;
-                                    }
-                                    else
-                                    {
-                                        resetParser ();
-                                    }
-                                }
-                                break;
-                                case ParseState::waitingForCommandDataSize:
-                                {
-                                    // NOTE: this is only a one byte data length, it you want two bytes, you will need to add two states
-                                    //       to read in the length, one for LSB, and one for MSB
-                                    if (dataByte >= 0 && dataByte <= kMaxCommandDataBytes)
-                                    {
-                                        commandDataSize = dataByte;
-                                        parseState = ParseState::waitingForCommandData;
-                                    }
-                                    else
-                                    {
-                                        resetParser ();
-                                    }
-                                }
-                                break;
-                                case ParseState::waitingForCommandData:
-                                {
-                                    if (commandDataSize != 0)
-                                    {
-                                        commandData [commandDataCount] = dataByte;
-                                        ++commandDataCount;
-                                    }
-                                    if (commandDataCount == commandDataSize)
-                                    {
-                                        // execute command
-                                        handleCommand (command, commandData, commandDataSize);
-
-                                        // reset and wait for next command packet
-                                        resetParser ();
-                                    }
-                                }
-                                break;
-
-                                default:
-                                {
-                                    // unknown parse state, broken
-                                    jassertfalse;
-                                }
-                            }
-                            ++dataIndex;
-                        }
-                    }
+                        handleCommand (packet [0], packet + 1, static_cast<int> (packetSize - 1));
+                    });
+                }
+                else if (serialPortInput != nullptr && serialPort->exists ())
+                {
+                    // NOTE: sleeps until data arrives, rather than polling, waking at least every 100ms to check whether the thread should stop
+                    serialPortInput->waitForData (1, 100);
+                }
+                else
+                {
+                    wait (1);
                 }
             }
             break;
@@ -44,10 +44,10 @@ private:
     bool openSerialPort (void);
     void closeSerialPort (void);
 
-    void handleTempoCommand (uint8_t* data, int dataSize);
-    void handleLightColorCommand (uint8_t* data, int dataSize);
-    void handleChargingAlarmLevelCommand (uint8_t* data, int dataSize);
-    void handleCommand (uint8_t command, uint8_t* data, int dataSize);
+    void handleTempoCommand (const uint8_t* data, int dataSize);
+    void handleLightColorCommand (const uint8_t* data, int dataSize);
+    void handleChargingAlarmLevelCommand (const uint8_t* data, int dataSize);
+    void handleCommand (uint8_t command, const uint8_t* data, int dataSize);
 
     void run () override;
     void timerCallback () override;
@@ -1,26 +1,24 @@
 #include "SerialPortListMonitor.h"
 
 SerialPortListMonitor::SerialPortListMonitor(void)
-    : Thread("Serial Port Monitor")
 {
-    startThread();
+    serialPortWatcher.addListener (this);
 }
 
 SerialPortListMonitor::~SerialPortListMonitor(void)
 {
-    stopThread(5000);
+    serialPortWatcher.removeListener (this);
 }
 
 juce::StringPairArray SerialPortListMonitor::getSerialPortList(void)
 {
-    juce::ScopedLock sl (dataLock);
     listChanged = false;
-    return serialPortNames;
+    return serialPortWatcher.getSerialPortPaths ();
 }
 
 void SerialPortListMonitor::setSleepTime (int newSleepTime)
 {
-    sleepTime = newSleepTime;
+    serialPortWatcher.setFallbackPollInterval (newSleepTime);
 }
 
 bool SerialPortListMonitor::hasListChanged (void)
@@ -28,23 +26,12 @@ bool SerialPortListMonitor::hasListChanged (void)
     return listChanged;
 }
 
-// thread for keeping an up to date list of serial port names
-void SerialPortListMonitor::run()
+// called on the watcher's thread as soon as ports come or go
+void SerialPortListMonitor::serialPortsChanged (const juce::StringPairArray& added, const juce::StringPairArray& removed)
 {
-    while (!threadShouldExit())
-    {
-        // wake up every mSleepTime to check the serial port list
-        sleep (sleepTime);
-
-        const auto serialPortList { SerialPort::getSerialPortPaths () };
-        juce::ScopedLock sl (dataLock);
-        if ((serialPortList.size() != serialPortNames.size()) || serialPortList != serialPortNames)
-        {
-            juce::Logger::outputDebugString ("Serial Port List");
-            for (auto serialPortNameIndex { 0 }; serialPortNameIndex < serialPortList.size (); ++serialPortNameIndex)
-                juce::Logger::outputDebugString (serialPortList.getAllValues () [serialPortNameIndex]);
-            serialPortNames = serialPortList;
-            listChanged = true;
-        }
-    }
+    for (auto serialPortNameIndex { 0 }; serialPortNameIndex < removed.size (); ++serialPortNameIndex)
+        juce::Logger::outputDebugString ("Serial Port removed: " + removed.getAllValues () [serialPortNameIndex]);
+    for (auto serialPortNameIndex { 0 }; serialPortNameIndex < added.size (); ++serialPortNameIndex)
+        juce::Logger::outputDebugString ("Serial Port added: " + added.getAllValues () [serialPortNameIndex]);
+    listChanged = true;
 }
@@ -2,9 +2,10 @@
 
 #include <JuceHeader.h>
 
+// NOTE: only used where the OS has no device events (see SerialPortWatcher::isEventDriven)
 const auto kSerialPortListMonitorSleepTime { 1000 };
 
-class SerialPortListMonitor : public juce::Thread
+class SerialPortListMonitor : private SerialPortWatcher::Listener
 {
 public:
     SerialPortListMonitor (void);
@@ -12,11 +13,10 @@ public:
     bool hasListChanged (void);
     juce::StringPairArray getSerialPortList (void);
     void setSleepTime (int sleepTime);
-    void run () override;
 
 private:
-    juce::CriticalSection dataLock;
-    juce::StringPairArray serialPortNames;
-    int sleepTime { kSerialPortListMonitorSleepTime };
-    bool listChanged { false };
+    void serialPortsChanged (const juce::StringPairArray& added, const juce::StringPairArray& removed) override;
+
+    SerialPortWatcher serialPortWatcher { kSerialPortListMonitorSleepTime };
+    std::atomic<bool> listChanged { false };
 };
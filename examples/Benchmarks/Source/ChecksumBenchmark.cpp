@@ -0,0 +1,78 @@
+#include "ChecksumBenchmark.h"
+
+const size_t kLargeBufferSize { 1 << 20 };
+const int kLargeBufferRepeats { 64 };
+const int kPacketIterations { 200000 };
+
+// NOTE: the textbook CRC-32, one bit at a time, for comparison
+struct BitwiseCrc32
+{
+    static uint32_t calculate (const void* data, size_t numBytes)
+    {
+        auto source { static_cast<const uint8_t*> (data) };
+        uint32_t crc { 0xffffffff };
+        for (size_t byteIndex { 0 }; byteIndex < numBytes; ++byteIndex)
+        {
+            crc ^= source [byteIndex];
+            for (auto bit { 0 }; bit < 8; ++bit)
+                crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+        return crc ^ 0xffffffff;
+    }
+};
+
+using TableOnlyCrc32c = SerialPortCrc<uint32_t, 0x1edc6f41, 0xffffffff, true, 0xffffffff>;
+
+// NOTE: the result is accumulated and printed so the compiler can't throw the work away
+static uint64_t gChecksumSink { 0 };
+
+template <typename Checksum>
+double measureThroughput (const std::vector<uint8_t>& data)
+{
+    const auto startTicks { juce::Time::getHighResolutionTicks () };
+    for (auto repeat { 0 }; repeat < kLargeBufferRepeats; ++repeat)
+        gChecksumSink += Checksum::calculate (data.data (), data.size ());
+    const auto seconds { juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks () - startTicks) };
+    return static_cast<double> (data.size ()) * kLargeBufferRepeats / seconds / (1024.0 * 1024.0);
+}
+
+template <typename Checksum>
+double measurePacketCost (const std::vector<uint8_t>& data, size_t packetSize)
+{
+    const auto numPackets { data.size () / packetSize };
+    const auto startTicks { juce::Time::getHighResolutionTicks () };
+    for (auto iteration { 0 }; iteration < kPacketIterations; ++iteration)
+        gChecksumSink += Checksum::calculate (data.data () + (static_cast<size_t> (iteration) % numPackets) * packetSize, packetSize);
+    const auto seconds { juce::Time::highResolutionTicksToSeconds (juce::Time::getHighResolutionTicks () - startTicks) };
+    return seconds * 1.0e9 / kPacketIterations;
+}
+
+template <typename Checksum>
+void reportChecksum (const char* name, const std::vector<uint8_t>& data)
+{
+    std::cout << name << ", " << measureThroughput<Checksum> (data);
+    for (const size_t packetSize : { size_t (8), size_t (64), size_t (256) })
+        std::cout << ", " << measurePacketCost<Checksum> (data, packetSize);
+    std::cout << "\n";
+}
+
+void runChecksumBenchmark ()
+{
+    std::vector<uint8_t> data (kLargeBufferSize);
+    juce::Random random (1);
+    for (auto& dataByte : data)
+        dataByte = static_cast<uint8_t> (random.nextInt (256));
+
+    std::cout << "checksums: MB/s over a " << (kLargeBufferSize >> 20) << " MB buffer, and ns per packet of 8, 64 and 256 bytes\n";
+    std::cout << "algorithm, MB/s, ns/8, ns/64, ns/256\n";
+    reportChecksum<SerialPortXorChecksum> ("xor", data);
+    reportChecksum<SerialPortFletcher16> ("fletcher-16", data);
+    reportChecksum<SerialPortCrc8> ("crc-8", data);
+    reportChecksum<SerialPortCrc16Ccitt> ("crc-16/ccitt", data);
+    reportChecksum<SerialPortCrc16Modbus> ("crc-16/modbus", data);
+    reportChecksum<BitwiseCrc32> ("crc-32 bitwise", data);
+    reportChecksum<SerialPortCrc32> ("crc-32", data);
+    reportChecksum<TableOnlyCrc32c> ("crc-32c tables", data);
+    reportChecksum<SerialPortCrc32c> (SerialPortCrc32c::hasHardwareSupport () ? "crc-32c hardware" : "crc-32c (no hardware support)", data);
+    std::cout << "(" << gChecksumSink << ")\n";
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// NOTE: measures the throughput of each checksum, both over a large buffer and per packet at typical serial packet sizes.
+//       a bit at a time CRC-32 is measured alongside, as the baseline the table driven versions are replacing
+void runChecksumBenchmark ();
@@ -0,0 +1,162 @@
+#include "CloseLatencyBenchmark.h"
+
+#if JUCE_LINUX || JUCE_MAC
+
+#include <termios.h>
+#include <unistd.h>
+#if JUCE_LINUX
+ #include <pty.h>
+#else
+ #include <util.h>
+#endif
+
+const int kNumPorts { 32 };
+const size_t kBytesToQueue { 1 << 20 };
+const int kSettleMs { 200 };
+const double kMaxDestroyMs { 10.0 };
+const double kMaxCloseMs { 10.0 };
+
+// NOTE: the far ends are held open, but nothing reads from them
+class PtyPairs
+{
+public:
+    explicit PtyPairs (int numPorts)
+    {
+        for (auto portIndex { 0 }; portIndex < numPorts; ++portIndex)
+        {
+            termios settings;
+            cfmakeraw (&settings);
+            int masterDescriptor { -1 }, slaveDescriptor { -1 };
+            char slaveName [256];
+            if (openpty (&masterDescriptor, &slaveDescriptor, slaveName, &settings, nullptr) != 0)
+                break;
+            descriptors.push_back (masterDescriptor);
+            descriptors.push_back (slaveDescriptor);
+            portPaths.add (slaveName);
+        }
+    }
+
+    ~PtyPairs ()
+    {
+        for (const auto descriptor : descriptors)
+            ::close (descriptor);
+    }
+
+    const juce::StringArray& getPortPaths () const { return portPaths; }
+
+private:
+    std::vector<int> descriptors;
+    juce::StringArray portPaths;
+};
+
+static SerialPortConfig getConfig ()
+{
+    return SerialPortConfig (115200, 8, SerialPortConfig::SERIALPORT_PARITY_NONE, SerialPortConfig::STOPBITS_1, SerialPortConfig::FLOWCONTROL_NONE);
+}
+
+// NOTE: queues more than the driver can hold on every port, and waits for the writers to be stuck with the rest
+static bool blockWriters (juce::OwnedArray<SerialPortOutputStream>& outputStreams)
+{
+    const std::vector<uint8_t> data (kBytesToQueue);
+    for (auto* outputStream : outputStreams)
+        outputStream->write (data.data (), data.size ());
+    juce::Thread::sleep (kSettleMs);
+
+    for (auto* outputStream : outputStreams)
+    {
+        if (outputStream->getPendingTxBytes () == 0)
+        {
+            std::cout << "close: a writer sent everything, so it wasn't blocked on the driver\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool timeDestroyingStreams ()
+{
+    PtyPairs pairs (kNumPorts);
+    if (pairs.getPortPaths ().size () < kNumPorts)
+    {
+        std::cout << "close: only " << pairs.getPortPaths ().size () << " pseudo-terminals could be opened\n";
+        return false;
+    }
+
+    juce::OwnedArray<SerialPort> serialPorts;
+    juce::OwnedArray<SerialPortInputStream> inputStreams;
+    juce::OwnedArray<SerialPortOutputStream> outputStreams;
+    for (const auto& portPath : pairs.getPortPaths ())
+    {
+        auto* serialPort { serialPorts.add (new SerialPort (portPath, getConfig (), nullptr)) };
+        inputStreams.add (new SerialPortInputStream (serialPort));
+        outputStreams.add (new SerialPortOutputStream (serialPort));
+    }
+    if (! blockWriters (outputStreams))
+        return false;
+
+    const auto startTime { juce::Time::getMillisecondCounterHiRes () };
+    inputStreams.clear ();
+    outputStreams.clear ();
+    const auto destroyMs { juce::Time::getMillisecondCounterHiRes () - startTime };
+
+    std::cout << "destroy," << kNumPorts << "," << destroyMs << "," << kMaxDestroyMs << "\n";
+    if (destroyMs > kMaxDestroyMs)
+    {
+        std::cout << "close: deleting the streams took " << destroyMs << "ms\n";
+        return false;
+    }
+    return true;
+}
+
+static bool timeClosingPort ()
+{
+    PtyPairs pairs (1);
+    if (pairs.getPortPaths ().size () == 0)
+    {
+        std::cout << "close: no pseudo-terminal could be opened\n";
+        return false;
+    }
+
+    SerialPort serialPort (pairs.getPortPaths () [0], getConfig (), nullptr);
+    juce::OwnedArray<SerialPortInputStream> inputStreams;
+    juce::OwnedArray<SerialPortOutputStream> outputStreams;
+    inputStreams.add (new SerialPortInputStream (&serialPort));
+    outputStreams.add (new SerialPortOutputStream (&serialPort));
+    if (! blockWriters (outputStreams))
+        return false;
+
+    // NOTE: the threads have stopped once the streams can be deleted without waiting
+    const auto startTime { juce::Time::getMillisecondCounterHiRes () };
+    serialPort.close ();
+    inputStreams.clear ();
+    outputStreams.clear ();
+    const auto closeMs { juce::Time::getMillisecondCounterHiRes () - startTime };
+
+    std::cout << "close,1," << closeMs << "," << kMaxCloseMs << "\n";
+    if (closeMs > kMaxCloseMs)
+    {
+        std::cout << "close: closing the port and deleting its streams took " << closeMs << "ms\n";
+        return false;
+    }
+    return true;
+}
+
+bool runCloseLatencyBenchmark ()
+{
+    std::cout << "close latency over pseudo-terminals, with the writers blocked on a full driver\n";
+    std::cout << "case,ports,ms,max_ms\n";
+
+    const auto destroyPassed { timeDestroyingStreams () };
+    const auto closePassed { timeClosingPort () };
+    return destroyPassed && closePassed;
+}
+
+#else
+
+bool runCloseLatencyBenchmark ()
+{
+    std::cout << "close: needs openpty (), so only runs on Linux and macOS\n";
+    return true;
+}
+
+#endif
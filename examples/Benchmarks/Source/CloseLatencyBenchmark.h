@@ -0,0 +1,10 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// NOTE: opens a number of pseudo-terminal ports whose far ends are never read, so each output stream's writer thread is
+//       blocked on a full driver and each reader is waiting for data, then times how long it takes to delete all of the
+//       streams, and to close a port with its streams still running. the threads are woken straight away, so both should
+//       take a few milliseconds rather than a poll timeout per thread. returns false, having said why, if either takes
+//       longer than that. only available where there is openpty ()
+bool runCloseLatencyBenchmark ();
@@ -0,0 +1,440 @@
+#include "EndToEndBenchmark.h"
+
+#if JUCE_LINUX || JUCE_MAC
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#if JUCE_LINUX
+ #include <pty.h>
+#else
+ #include <util.h>
+#endif
+
+const double kRunSeconds { 0.3 };
+const double kMaxRoundTripSeconds { 1.0 };
+const int kMaxRoundTrips { 2000 };
+const size_t kMaxTransmitBacklog { 1 << 20 };
+const size_t kSlowConsumerBytesPerRead { 4096 };
+
+enum class NotifyMode { poll, listener, coalesced, blocking };
+enum class ConsumerSpeed { fast, slow };
+
+static const char* getName (NotifyMode notifyMode)
+{
+    switch (notifyMode)
+    {
+        case NotifyMode::poll: return "poll";
+        case NotifyMode::listener: return "listener";
+        case NotifyMode::coalesced: return "coalesced";
+        case NotifyMode::blocking: return "blocking";
+    }
+    return "";
+}
+
+static double getThreadCpuSeconds ()
+{
+    timespec cpuTime;
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &cpuTime);
+    return static_cast<double> (cpuTime.tv_sec) + cpuTime.tv_nsec * 1.0e-9;
+}
+
+// NOTE: totals for the whole process. the helper thread keeps its own counts, which are taken off
+struct ProcessCounters
+{
+    static ProcessCounters now ()
+    {
+        ProcessCounters counters;
+        rusage usage;
+        getrusage (RUSAGE_SELF, &usage);
+        counters.cpuSeconds = static_cast<double> (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+                            + static_cast<double> (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1.0e-6;
+       #if JUCE_LINUX
+        // NOTE: syscr and syscw count the read and write family syscalls (read, readv, write, writev etc). macOS has no equivalent
+        std::ifstream processIo ("/proc/self/io");
+        std::string counterName;
+        juce::int64 counterValue;
+        while (processIo >> counterName >> counterValue)
+        {
+            if (counterName == "syscr:")
+                counters.numSyscalls += counterValue;
+            else if (counterName == "syscw:")
+                counters.numSyscalls += counterValue;
+        }
+       #else
+        counters.numSyscalls = -1;
+       #endif
+        return counters;
+    }
+
+    double cpuSeconds { 0 };
+    juce::int64 numSyscalls { 0 };
+};
+
+// NOTE: the far end of the serial port. runs a thread on the pseudo-terminal's master side which feeds data in, drains it, or echoes it back
+class PtyPeer
+{
+public:
+    enum class Role { source, sink, echo };
+
+    PtyPeer ()
+    {
+        termios settings;
+        cfmakeraw (&settings);
+        char slaveName [256];
+        if (openpty (&masterDescriptor, &slaveDescriptor, slaveName, &settings, nullptr) == 0)
+        {
+            portPath = slaveName;
+            fcntl (masterDescriptor, F_SETFL, fcntl (masterDescriptor, F_GETFL) | O_NONBLOCK);
+        }
+    }
+
+    ~PtyPeer ()
+    {
+        stop ();
+        if (masterDescriptor != -1)
+            ::close (masterDescriptor);
+        if (slaveDescriptor != -1)
+            ::close (slaveDescriptor);
+    }
+
+    bool isOpen () const { return portPath.isNotEmpty (); }
+    juce::String getPortPath () const { return portPath; }
+
+    void start (Role roleToPlay, size_t payloadSizeToUse)
+    {
+        role = roleToPlay;
+        payloadSize = payloadSizeToUse;
+        helperThread = std::thread ([this] () { run (); });
+    }
+
+    void stop ()
+    {
+        shouldStop = true;
+        if (helperThread.joinable ())
+            helperThread.join ();
+    }
+
+    std::atomic<juce::int64> numBytes { 0 };
+    // NOTE: only valid after stop ()
+    juce::int64 numSyscalls { 0 };
+    double cpuSeconds { 0 };
+
+private:
+    bool waitFor (short events)
+    {
+        pollfd pollDescriptor { masterDescriptor, events, 0 };
+        return poll (&pollDescriptor, 1, 10) > 0;
+    }
+
+    void writeAll (const uint8_t* data, size_t dataSize)
+    {
+        while (dataSize > 0 && ! shouldStop)
+        {
+            const auto bytesWritten { ::write (masterDescriptor, data, dataSize) };
+            ++numSyscalls;
+            if (bytesWritten > 0)
+            {
+                data += bytesWritten;
+                dataSize -= static_cast<size_t> (bytesWritten);
+            }
+            else
+            {
+                waitFor (POLLOUT);
+            }
+        }
+    }
+
+    void run ()
+    {
+        const auto startCpuSeconds { getThreadCpuSeconds () };
+        std::vector<uint8_t> buffer (juce::jmax (payloadSize, size_t (65536)), 0x55);
+        while (! shouldStop)
+        {
+            if (role == Role::source)
+            {
+                if (! waitFor (POLLOUT))
+                    continue;
+                const auto bytesWritten { ::write (masterDescriptor, buffer.data (), payloadSize) };
+                ++numSyscalls;
+                if (bytesWritten > 0)
+                    numBytes += bytesWritten;
+            }
+            else
+            {
+                if (! waitFor (POLLIN))
+                    continue;
+                const auto bytesRead { ::read (masterDescriptor, buffer.data (), buffer.size ()) };
+                ++numSyscalls;
+                if (bytesRead <= 0)
+                    continue;
+                if (role == Role::echo)
+                    writeAll (buffer.data (), static_cast<size_t> (bytesRead));
+                numBytes += bytesRead;
+            }
+        }
+        cpuSeconds = getThreadCpuSeconds () - startCpuSeconds;
+    }
+
+    int masterDescriptor { -1 };
+    int slaveDescriptor { -1 };
+    juce::String portPath;
+    Role role { Role::sink };
+    size_t payloadSize { 0 };
+    std::atomic<bool> shouldStop { false };
+    std::thread helperThread;
+};
+
+// NOTE: how the consumer finds out there is data waiting, for the notify modes
+class DataAvailableSignal : public SerialPortInputStream::Listener
+{
+public:
+    DataAvailableSignal (SerialPortInputStream& inputStreamToUse, NotifyMode notifyModeToUse)
+        : inputStream (inputStreamToUse), notifyMode (notifyModeToUse)
+    {
+        if (notifyMode == NotifyMode::poll || notifyMode == NotifyMode::blocking)
+            return;
+
+        inputStream.setListenerThread (SerialPortInputStream::NotifyThread::readerThread);
+        if (notifyMode == NotifyMode::coalesced)
+            inputStream.setNotifyPolicy ({ 4096, 1.0, 1.0 });
+        inputStream.addListener (this);
+    }
+
+    ~DataAvailableSignal () override
+    {
+        inputStream.removeListener (this);
+    }
+
+    void wait ()
+    {
+        if (notifyMode == NotifyMode::poll)
+            std::this_thread::sleep_for (std::chrono::microseconds (50));
+        else if (notifyMode == NotifyMode::blocking)
+            inputStream.waitForData (1, 10);
+        else
+            dataAvailable.wait (10);
+    }
+
+    void serialDataAvailable (SerialPortInputStream&, size_t) override
+    {
+        dataAvailable.signal ();
+    }
+
+private:
+    SerialPortInputStream& inputStream;
+    NotifyMode notifyMode;
+    juce::WaitableEvent dataAvailable;
+};
+
+struct RunResult
+{
+    juce::String test;
+    size_t payloadSize { 0 };
+    juce::String notify;
+    juce::String consumer;
+    juce::int64 numBytes { 0 };
+    double seconds { 0 };
+    juce::int64 numMessages { 0 };
+    std::vector<double> latenciesMicroseconds;
+    ProcessCounters before;
+    ProcessCounters after;
+    const PtyPeer* peer { nullptr };
+};
+
+static void printResult (RunResult& result)
+{
+    const auto megabytes { static_cast<double> (result.numBytes) / (1024.0 * 1024.0) };
+    std::cout << result.test << "," << result.payloadSize << "," << result.notify << "," << result.consumer << ","
+              << (result.seconds > 0 ? megabytes / result.seconds : 0.0) << ","
+              << (result.seconds > 0 ? static_cast<double> (result.numMessages) / result.seconds : 0.0) << ",";
+
+    auto& latencies { result.latenciesMicroseconds };
+    std::sort (latencies.begin (), latencies.end ());
+    for (const auto percentile : { 0.5, 0.9, 0.99, 1.0 })
+    {
+        if (! latencies.empty ())
+            std::cout << latencies [static_cast<size_t> (percentile * static_cast<double> (latencies.size () - 1))];
+        std::cout << ",";
+    }
+
+    if (megabytes > 0 && result.after.numSyscalls >= 0)
+        std::cout << static_cast<double> (result.after.numSyscalls - result.before.numSyscalls - result.peer->numSyscalls) / megabytes;
+    std::cout << ",";
+    if (megabytes > 0)
+        std::cout << (result.after.cpuSeconds - result.before.cpuSeconds - result.peer->cpuSeconds) * 1000.0 / megabytes;
+    std::cout << "\n";
+}
+
+static SerialPortConfig getConfig ()
+{
+    return SerialPortConfig (115200, 8, SerialPortConfig::SERIALPORT_PARITY_NONE, SerialPortConfig::STOPBITS_1, SerialPortConfig::FLOWCONTROL_NONE);
+}
+
+static void runReceive (size_t payloadSize, NotifyMode notifyMode, ConsumerSpeed consumerSpeed)
+{
+    PtyPeer peer;
+    SerialPort serialPort (peer.getPortPath (), getConfig (), nullptr);
+    RunResult result;
+    {
+        SerialPortInputStream inputStream (&serialPort);
+        DataAvailableSignal signal (inputStream, notifyMode);
+
+        result.before = ProcessCounters::now ();
+        peer.start (PtyPeer::Role::source, payloadSize);
+        const auto startTime { juce::Time::getMillisecondCounterHiRes () };
+        while (juce::Time::getMillisecondCounterHiRes () - startTime < kRunSeconds * 1000.0)
+        {
+            if (inputStream.isExhausted ())
+            {
+                signal.wait ();
+                continue;
+            }
+
+            const uint8_t* block1;
+            const uint8_t* block2;
+            size_t blockSize1, blockSize2;
+            inputStream.prepareToRead (block1, blockSize1, block2, blockSize2);
+            const auto numBytesToTake { consumerSpeed == ConsumerSpeed::fast ? blockSize1 + blockSize2
+                                                                             : juce::jmin (blockSize1 + blockSize2, kSlowConsumerBytesPerRead) };
+            inputStream.finishedRead (numBytesToTake);
+            result.numBytes += static_cast<juce::int64> (numBytesToTake);
+            if (consumerSpeed == ConsumerSpeed::slow)
+                std::this_thread::sleep_for (std::chrono::milliseconds (1));
+        }
+        result.seconds = (juce::Time::getMillisecondCounterHiRes () - startTime) / 1000.0;
+        peer.stop ();
+        result.after = ProcessCounters::now ();
+    }
+
+    result.test = "receive";
+    result.payloadSize = payloadSize;
+    result.notify = getName (notifyMode);
+    result.consumer = consumerSpeed == ConsumerSpeed::fast ? "fast" : "slow";
+    result.numMessages = result.numBytes / static_cast<juce::int64> (payloadSize);
+    result.peer = &peer;
+    printResult (result);
+}
+
+static void runTransmit (size_t payloadSize)
+{
+    PtyPeer peer;
+    SerialPort serialPort (peer.getPortPath (), getConfig (), nullptr);
+    std::vector<uint8_t> payload (payloadSize, 0xaa);
+    RunResult result;
+    {
+        SerialPortOutputStream outputStream (&serialPort);
+
+        result.before = ProcessCounters::now ();
+        peer.start (PtyPeer::Role::sink, payloadSize);
+        const auto startTime { juce::Time::getMillisecondCounterHiRes () };
+        juce::int64 numBytesQueued { 0 };
+        while (juce::Time::getMillisecondCounterHiRes () - startTime < kRunSeconds * 1000.0)
+        {
+            // NOTE: keep the transmit queue from growing without limit when writes outpace the pseudo-terminal
+            if (numBytesQueued - peer.numBytes > static_cast<juce::int64> (kMaxTransmitBacklog))
+            {
+                std::this_thread::sleep_for (std::chrono::microseconds (50));
+                continue;
+            }
+            outputStream.write (payload.data (), payloadSize);
+            numBytesQueued += static_cast<juce::int64> (payloadSize);
+        }
+        result.seconds = (juce::Time::getMillisecondCounterHiRes () - startTime) / 1000.0;
+        result.numBytes = peer.numBytes;
+        peer.stop ();
+        result.after = ProcessCounters::now ();
+    }
+
+    result.test = "transmit";
+    result.payloadSize = payloadSize;
+    result.numMessages = result.numBytes / static_cast<juce::int64> (payloadSize);
+    result.peer = &peer;
+    printResult (result);
+}
+
+static void runRoundTrip (size_t payloadSize, NotifyMode notifyMode)
+{
+    PtyPeer peer;
+    SerialPort serialPort (peer.getPortPath (), getConfig (), nullptr);
+    std::vector<uint8_t> payload (payloadSize, 0x33);
+    RunResult result;
+    {
+        SerialPortInputStream inputStream (&serialPort);
+        SerialPortOutputStream outputStream (&serialPort);
+        DataAvailableSignal signal (inputStream, notifyMode);
+
+        result.before = ProcessCounters::now ();
+        peer.start (PtyPeer::Role::echo, payloadSize);
+        const auto startTime { juce::Time::getMillisecondCounterHiRes () };
+        while (result.numMessages < kMaxRoundTrips && juce::Time::getMillisecondCounterHiRes () - startTime < kMaxRoundTripSeconds * 1000.0)
+        {
+            const auto sendTime { juce::Time::getMillisecondCounterHiRes () };
+            outputStream.write (payload.data (), payloadSize);
+
+            size_t numBytesReturned { 0 };
+            while (numBytesReturned < payloadSize && juce::Time::getMillisecondCounterHiRes () - sendTime < 1000.0)
+            {
+                if (inputStream.isExhausted ())
+                {
+                    signal.wait ();
+                    continue;
+                }
+                numBytesReturned += static_cast<size_t> (inputStream.read (payload.data (), static_cast<int> (payloadSize - numBytesReturned)));
+            }
+            if (numBytesReturned < payloadSize)
+                break;
+
+            result.latenciesMicroseconds.push_back ((juce::Time::getMillisecondCounterHiRes () - sendTime) * 1000.0);
+            ++result.numMessages;
+        }
+        result.seconds = (juce::Time::getMillisecondCounterHiRes () - startTime) / 1000.0;
+        peer.stop ();
+        result.after = ProcessCounters::now ();
+    }
+
+    result.test = "roundtrip";
+    result.payloadSize = payloadSize;
+    result.notify = getName (notifyMode);
+    result.consumer = "fast";
+    result.numBytes = result.numMessages * static_cast<juce::int64> (payloadSize);
+    result.peer = &peer;
+    printResult (result);
+}
+
+void runEndToEndBenchmark ()
+{
+    if (! PtyPeer ().isOpen ())
+    {
+        std::cout << "end to end: unable to open a pseudo-terminal\n";
+        return;
+    }
+
+    std::cout << "end to end over a pseudo-terminal: syscalls and cpu time are for the streams, per MB transferred\n";
+    std::cout << "test,payload_bytes,notify,consumer,mb_per_s,messages_per_s,p50_us,p90_us,p99_us,max_us,syscalls_per_mb,cpu_ms_per_mb\n";
+
+    const NotifyMode notifyModes [] { NotifyMode::poll, NotifyMode::listener, NotifyMode::coalesced, NotifyMode::blocking };
+    for (const size_t payloadSize : { size_t (1), size_t (64), size_t (1024), size_t (16384) })
+        for (const auto notifyMode : notifyModes)
+            for (const auto consumerSpeed : { ConsumerSpeed::fast, ConsumerSpeed::slow })
+                runReceive (payloadSize, notifyMode, consumerSpeed);
+
+    for (const size_t payloadSize : { size_t (1), size_t (64), size_t (1024), size_t (16384) })
+        runTransmit (payloadSize);
+
+    for (const size_t payloadSize : { size_t (1), size_t (64), size_t (1024) })
+        for (const auto notifyMode : notifyModes)
+            runRoundTrip (payloadSize, notifyMode);
+}
+
+#else
+
+void runEndToEndBenchmark ()
+{
+    std::cout << "end to end: needs openpty (), so only runs on Linux and macOS\n";
+}
+
+#endif
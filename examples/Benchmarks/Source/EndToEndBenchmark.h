@@ -0,0 +1,11 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// NOTE: drives SerialPortInputStream and SerialPortOutputStream through a pseudo-terminal pair, with a helper thread on the
+//       other end feeding, draining or echoing the data. reports receive and transmit throughput, and round trip latency
+//       percentiles, across payload sizes, ways of waiting for data (polling, listeners, coalesced listeners and blocking
+//       in waitForData ()) and consumer speeds, along with the read/write syscalls and CPU time the streams used per MB
+//       (the helper thread's own syscalls and CPU time are taken out).
+//       the results are printed as CSV, one line per run, for tracking over time. only available where there is openpty ()
+void runEndToEndBenchmark ();
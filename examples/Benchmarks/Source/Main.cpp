@@ -0,0 +1,35 @@
+#include <JuceHeader.h>
+#include "ChecksumBenchmark.h"
+#include "CloseLatencyBenchmark.h"
+#include "EndToEndBenchmark.h"
+#include "ReactorBenchmark.h"
+#include "RingBufferBenchmark.h"
+
+// NOTE: run with no arguments to run every benchmark, or pass the names of the ones to run. returns 1 if a benchmark that
+//       checks a limit (such as close) went over it
+int main (int argc, char* argv[])
+{
+    juce::StringArray benchmarksToRun;
+    for (auto argIndex { 1 }; argIndex < argc; ++argIndex)
+        benchmarksToRun.add (argv [argIndex]);
+
+    auto shouldRun = [&benchmarksToRun] (const juce::String& benchmarkName)
+    {
+        return benchmarksToRun.size () == 0 || benchmarksToRun.contains (benchmarkName);
+    };
+
+    if (shouldRun ("ringbuffer"))
+        runRingBufferBenchmark ();
+    if (shouldRun ("checksum"))
+        runChecksumBenchmark ();
+    if (shouldRun ("endtoend"))
+        runEndToEndBenchmark ();
+    if (shouldRun ("reactor"))
+        runReactorBenchmark ();
+
+    auto allPassed { true };
+    if (shouldRun ("close"))
+        allPassed = runCloseLatencyBenchmark () && allPassed;
+
+    return allPassed ? 0 : 1;
+}
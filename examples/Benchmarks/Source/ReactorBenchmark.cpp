@@ -0,0 +1,215 @@
+#include "ReactorBenchmark.h"
+
+#if JUCE_LINUX || JUCE_MAC
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#if JUCE_LINUX
+ #include <pty.h>
+#else
+ #include <util.h>
+#endif
+
+const double kRunSeconds { 0.3 };
+const int kMaxRounds { 2000 };
+const int kReplyTimeoutMs { 1000 };
+const size_t kMessageSize { 16 };
+const int kMaxPorts { 256 };
+
+static double getProcessCpuSeconds ()
+{
+    rusage usage;
+    getrusage (RUSAGE_SELF, &usage);
+    return static_cast<double> (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec)
+         + static_cast<double> (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1.0e-6;
+}
+
+static double getThreadCpuSeconds ()
+{
+    timespec cpuTime;
+    clock_gettime (CLOCK_THREAD_CPUTIME_ID, &cpuTime);
+    return static_cast<double> (cpuTime.tv_sec) + cpuTime.tv_nsec * 1.0e-9;
+}
+
+// NOTE: -1 where it can't be found out
+static int getNumProcessThreads ()
+{
+   #if JUCE_LINUX
+    std::ifstream status ("/proc/self/status");
+    std::string line;
+    while (std::getline (status, line))
+        if (line.compare (0, 8, "Threads:") == 0)
+            return std::stoi (line.substr (8));
+   #endif
+    return -1;
+}
+
+// NOTE: the far ends of all of the ports, echoed by one thread, so the peer's cost doesn't grow with the number of ports
+class PtyEchoPeers
+{
+public:
+    explicit PtyEchoPeers (int numPorts)
+    {
+        for (auto portIndex { 0 }; portIndex < numPorts; ++portIndex)
+        {
+            termios settings;
+            cfmakeraw (&settings);
+            int masterDescriptor { -1 }, slaveDescriptor { -1 };
+            char slaveName [256];
+            if (openpty (&masterDescriptor, &slaveDescriptor, slaveName, &settings, nullptr) != 0)
+                break;
+            fcntl (masterDescriptor, F_SETFL, fcntl (masterDescriptor, F_GETFL) | O_NONBLOCK);
+            pollDescriptors.push_back ({ masterDescriptor, POLLIN, 0 });
+            slaveDescriptors.push_back (slaveDescriptor);
+            portPaths.add (slaveName);
+        }
+        helperThread = std::thread ([this] () { run (); });
+    }
+
+    ~PtyEchoPeers ()
+    {
+        shouldStop = true;
+        helperThread.join ();
+        for (const auto& pollDescriptor : pollDescriptors)
+            ::close (pollDescriptor.fd);
+        for (const auto slaveDescriptor : slaveDescriptors)
+            ::close (slaveDescriptor);
+    }
+
+    const juce::StringArray& getPortPaths () const { return portPaths; }
+
+    std::atomic<double> cpuSeconds { 0 };
+
+private:
+    void run ()
+    {
+        const auto startCpuSeconds { getThreadCpuSeconds () };
+        uint8_t buffer [4096];
+        while (! shouldStop)
+        {
+            if (poll (pollDescriptors.data (), static_cast<nfds_t> (pollDescriptors.size ()), 10) <= 0)
+                continue;
+
+            for (auto& pollDescriptor : pollDescriptors)
+            {
+                if ((pollDescriptor.revents & POLLIN) == 0)
+                    continue;
+                const auto bytesRead { ::read (pollDescriptor.fd, buffer, sizeof (buffer)) };
+                for (auto bytesWritten { decltype (bytesRead) (0) }; bytesWritten < bytesRead && ! shouldStop;)
+                {
+                    const auto result { ::write (pollDescriptor.fd, buffer + bytesWritten, static_cast<size_t> (bytesRead - bytesWritten)) };
+                    if (result > 0)
+                        bytesWritten += result;
+                    else
+                        std::this_thread::yield ();
+                }
+            }
+            cpuSeconds = getThreadCpuSeconds () - startCpuSeconds;
+        }
+    }
+
+    std::vector<pollfd> pollDescriptors;
+    std::vector<int> slaveDescriptors;
+    juce::StringArray portPaths;
+    std::atomic<bool> shouldStop { false };
+    std::thread helperThread;
+};
+
+// NOTE: numReactorThreads of 0 gives every stream its own thread
+static void runScaling (int numPorts, int numReactorThreads)
+{
+    PtyEchoPeers peers (numPorts);
+    if (peers.getPortPaths ().size () < numPorts)
+    {
+        std::cout << "reactor: only " << peers.getPortPaths ().size () << " pseudo-terminals could be opened\n";
+        return;
+    }
+
+    const SerialPortConfig config (115200, 8, SerialPortConfig::SERIALPORT_PARITY_NONE, SerialPortConfig::STOPBITS_1, SerialPortConfig::FLOWCONTROL_NONE);
+    juce::OwnedArray<SerialPort> serialPorts;
+    for (const auto& portPath : peers.getPortPaths ())
+        serialPorts.add (new SerialPort (portPath, config, nullptr));
+
+    std::unique_ptr<SerialPortReactor> reactor;
+    if (numReactorThreads > 0)
+        reactor = std::make_unique<SerialPortReactor> (numReactorThreads);
+
+    std::vector<double> roundMicroseconds;
+    auto numMessages { 0 };
+    auto numFailures { 0 };
+    auto numProcessThreads { 0 };
+    double seconds { 0 };
+    double cpuSeconds { 0 };
+    {
+        juce::OwnedArray<SerialPortInputStream> inputStreams;
+        juce::OwnedArray<SerialPortOutputStream> outputStreams;
+        for (auto* serialPort : serialPorts)
+        {
+            inputStreams.add (reactor != nullptr ? new SerialPortInputStream (serialPort, *reactor) : new SerialPortInputStream (serialPort));
+            outputStreams.add (reactor != nullptr ? new SerialPortOutputStream (serialPort, *reactor) : new SerialPortOutputStream (serialPort));
+        }
+        numProcessThreads = getNumProcessThreads ();
+
+        std::array<uint8_t, kMessageSize> message;
+        std::array<uint8_t, kMessageSize> reply;
+        const auto startCpuSeconds { getProcessCpuSeconds () - peers.cpuSeconds };
+        const auto startTime { juce::Time::getMillisecondCounterHiRes () };
+        for (auto round { 0 }; round < kMaxRounds && juce::Time::getMillisecondCounterHiRes () - startTime < kRunSeconds * 1000.0; ++round)
+        {
+            const auto roundStartTime { juce::Time::getMillisecondCounterHiRes () };
+            message.fill (static_cast<uint8_t> (round));
+            for (auto* outputStream : outputStreams)
+                outputStream->write (message.data (), message.size ());
+
+            for (auto* inputStream : inputStreams)
+            {
+                if (inputStream->readExactly (reply.data (), reply.size (), kReplyTimeoutMs) && reply == message)
+                    ++numMessages;
+                else
+                    ++numFailures;
+            }
+            roundMicroseconds.push_back ((juce::Time::getMillisecondCounterHiRes () - roundStartTime) * 1000.0);
+        }
+        seconds = (juce::Time::getMillisecondCounterHiRes () - startTime) / 1000.0;
+        cpuSeconds = getProcessCpuSeconds () - peers.cpuSeconds - startCpuSeconds;
+    }
+
+    std::cout << (numReactorThreads > 0 ? "reactor" : "threads") << "," << numReactorThreads << "," << numPorts << ","
+              << (seconds > 0 ? static_cast<double> (numMessages) / seconds : 0.0) << ",";
+    std::sort (roundMicroseconds.begin (), roundMicroseconds.end ());
+    for (const auto percentile : { 0.5, 0.99 })
+    {
+        if (! roundMicroseconds.empty ())
+            std::cout << roundMicroseconds [static_cast<size_t> (percentile * static_cast<double> (roundMicroseconds.size () - 1))];
+        std::cout << ",";
+    }
+    if (numMessages > 0)
+        std::cout << cpuSeconds * 1.0e6 / numMessages;
+    std::cout << "," << numProcessThreads << "," << numFailures << "\n";
+}
+
+void runReactorBenchmark ()
+{
+    std::cout << "reactor scaling over pseudo-terminals, " << kMessageSize << " byte messages echoed on every port each round\n";
+    std::cout << "mode,reactor_threads,ports,messages_per_s,round_p50_us,round_p99_us,cpu_us_per_message,process_threads,failures\n";
+
+    if (! SerialPortReactor::isSupported ())
+        std::cout << "reactor: not supported on this platform, so the reactor runs start their own threads\n";
+
+    for (auto numPorts { 1 }; numPorts <= kMaxPorts; numPorts *= 2)
+        for (const auto numReactorThreads : { 0, 1, 4 })
+            runScaling (numPorts, numReactorThreads);
+}
+
+#else
+
+void runReactorBenchmark ()
+{
+    std::cout << "reactor: needs openpty (), so only runs on Linux and macOS\n";
+}
+
+#endif
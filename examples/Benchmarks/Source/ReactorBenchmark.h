@@ -0,0 +1,10 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// NOTE: opens from 1 to 256 pseudo-terminal ports at once, with one helper thread echoing everything back on the other
+//       ends, and sends a small message through every port each round, waiting for all of the replies. the ports' streams
+//       either start their own reader and writer threads, or share a SerialPortReactor with 1 or 4 threads.
+//       reports messages per second, round latency percentiles, CPU time per message (the helper thread's own is taken
+//       out) and the number of threads the process is running, as CSV. only available where there is openpty ()
+void runReactorBenchmark ();
@@ -0,0 +1,65 @@
+#include "RingBufferBenchmark.h"
+
+const size_t kChunkSize { 64 };
+const int kIterations { 20000 };
+
+// NOTE: this is how SerialPortInputStream used to store received data, kept here as the baseline
+class MemoryBlockReceiveBuffer
+{
+public:
+    void write (const void* data, size_t numBytes)
+    {
+        const juce::ScopedLock l (bufferCriticalSection);
+        buffer.ensureSize (bufferedBytes + numBytes);
+        memcpy (static_cast<uint8_t*> (buffer.getData ()) + bufferedBytes, data, numBytes);
+        bufferedBytes += numBytes;
+    }
+
+    size_t read (void* destBuffer, size_t maxBytesToRead)
+    {
+        const juce::ScopedLock l (bufferCriticalSection);
+        const auto numBytes { juce::jmin (maxBytesToRead, bufferedBytes) };
+        memcpy (destBuffer, buffer.getData (), numBytes);
+        buffer.removeSection (0, numBytes);
+        bufferedBytes -= numBytes;
+        return numBytes;
+    }
+
+private:
+    juce::MemoryBlock buffer;
+    juce::CriticalSection bufferCriticalSection;
+    size_t bufferedBytes { 0 };
+};
+
+template <typename BufferType>
+double measureReadCost (size_t backlogSize)
+{
+    BufferType receiveBuffer;
+    std::vector<uint8_t> chunk (kChunkSize, 0x55);
+    for (size_t bytesWritten { 0 }; bytesWritten < backlogSize; bytesWritten += kChunkSize)
+        receiveBuffer.write (chunk.data (), kChunkSize);
+
+    // NOTE: keep the backlog constant, one chunk in and one chunk out per iteration, and only time the read
+    juce::int64 readTicks { 0 };
+    for (auto iteration { 0 }; iteration < kIterations; ++iteration)
+    {
+        receiveBuffer.write (chunk.data (), kChunkSize);
+        const auto startTicks { juce::Time::getHighResolutionTicks () };
+        receiveBuffer.read (chunk.data (), kChunkSize);
+        readTicks += juce::Time::getHighResolutionTicks () - startTicks;
+    }
+
+    return juce::Time::highResolutionTicksToSeconds (readTicks) * 1.0e9 / kIterations;
+}
+
+void runRingBufferBenchmark ()
+{
+    std::cout << "ring buffer: ns per " << kChunkSize << " byte read against a standing backlog\n";
+    std::cout << "backlog bytes, SerialPortRingBuffer, MemoryBlock\n";
+    for (const size_t backlogSize : { size_t (1) << 10, size_t (1) << 16, size_t (1) << 20, size_t (1) << 24 })
+    {
+        std::cout << backlogSize << ", "
+                  << measureReadCost<SerialPortRingBuffer> (backlogSize) << ", "
+                  << measureReadCost<MemoryBlockReceiveBuffer> (backlogSize) << "\n";
+    }
+}
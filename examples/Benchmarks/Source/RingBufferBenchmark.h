@@ -0,0 +1,7 @@
+#pragma once
+
+#include <JuceHeader.h>
+
+// NOTE: measures the cost of a small read out of the receive buffer while a backlog of unread data is sitting in it.
+//       the old MemoryBlock + removeSection approach is measured alongside for comparison
+void runRingBufferBenchmark ();
@@ -0,0 +1,830 @@
+//juce_serialport.cpp
+//platform independent parts of the Serial Port classes
+//see juce_serialport.h for details
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+using namespace juce;
+
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include "juce_serialport.h"
+
+/////////////////////////////////
+// SerialPort statistics
+/////////////////////////////////
+SerialPortStatistics SerialPort::getStatistics () const
+{
+    SerialPortStatistics statistics;
+    statistics.bytesReceived = counters.bytesReceived.load (std::memory_order_relaxed);
+    statistics.bytesSent = counters.bytesSent.load (std::memory_order_relaxed);
+    statistics.numReads = counters.numReads.load (std::memory_order_relaxed);
+    statistics.numWrites = counters.numWrites.load (std::memory_order_relaxed);
+    statistics.receiveHighWaterMark = counters.receiveHighWaterMark.load (std::memory_order_relaxed);
+    statistics.transmitHighWaterMark = counters.transmitHighWaterMark.load (std::memory_order_relaxed);
+    statistics.numNotifications = counters.numNotifications.load (std::memory_order_relaxed);
+    statistics.numErrors = counters.numErrors.load (std::memory_order_relaxed);
+    statistics.numOverflows = counters.numOverflows.load (std::memory_order_relaxed);
+    statistics.bytesDropped = counters.bytesDropped.load (std::memory_order_relaxed);
+    statistics.numReopens = counters.numReopens.load (std::memory_order_relaxed);
+    statistics.timeBlockedMs = static_cast<double> (counters.microsecondsBlocked.load (std::memory_order_relaxed)) / 1000.0;
+    return statistics;
+}
+
+void SerialPort::resetStatistics ()
+{
+    // hasBeenOpened is left alone, so an open after a reset still counts as a reopen
+    for (auto* counter : { &counters.bytesReceived, &counters.bytesSent, &counters.numReads, &counters.numWrites,
+                           &counters.numNotifications, &counters.numErrors, &counters.numOverflows, &counters.bytesDropped,
+                           &counters.numReopens, &counters.microsecondsBlocked })
+        counter->store (0, std::memory_order_relaxed);
+    counters.receiveHighWaterMark.store (0, std::memory_order_relaxed);
+    counters.transmitHighWaterMark.store (0, std::memory_order_relaxed);
+}
+
+/////////////////////////////////
+// SerialPort low latency profile
+/////////////////////////////////
+SerialPortLatencyReport SerialPort::setLowLatency (const SerialPortLatencyOptions& options)
+{
+    const ScopedLock l (latencyLock);
+    latencyOptions = options;
+    lowLatency = true;
+    // the threads' parts start again, and are filled in as they pick up the new profile
+    latencyReport = SerialPortLatencyReport ();
+    if (exists ())
+        applyDriverLatency (latencyOptions, latencyReport);
+    else
+        latencyReport.notes.add ("the port isn't open, so the driver settings are left until it is");
+    ++latencyGeneration;
+    return latencyReport;
+}
+
+SerialPortLatencyReport SerialPort::getLatencyReport () const
+{
+    const ScopedLock l (latencyLock);
+    return latencyReport;
+}
+
+void SerialPort::reapplyDriverLatency ()
+{
+    const ScopedLock l (latencyLock);
+    if (! lowLatency)
+        return;
+
+    // the driver's parts are found out again, the threads' parts still stand
+    SerialPortLatencyReport report;
+    report.readerCpu = latencyReport.readerCpu;
+    report.writerCpu = latencyReport.writerCpu;
+    report.readerRealtime = latencyReport.readerRealtime;
+    report.writerRealtime = latencyReport.writerRealtime;
+    applyDriverLatency (latencyOptions, report);
+    latencyReport = report;
+}
+
+void SerialPort::tuneStreamThread (int& tunedGeneration, bool isReader)
+{
+    const auto generation = latencyGeneration.load (std::memory_order_acquire);
+    if (generation == tunedGeneration)
+        return;
+    tunedGeneration = generation;
+
+    const ScopedLock l (latencyLock);
+    const String threadName (isReader ? "reader" : "writer");
+    if (latencyOptions.cpu >= 0)
+    {
+        if (pinCurrentThread (latencyOptions.cpu))
+            (isReader ? latencyReport.readerCpu : latencyReport.writerCpu) = latencyOptions.cpu;
+        else
+            latencyReport.notes.add ("couldn't pin the " + threadName + " thread to CPU " + String (latencyOptions.cpu));
+    }
+    if (latencyOptions.realtimePriority)
+    {
+        if (makeCurrentThreadRealtime ())
+            (isReader ? latencyReport.readerRealtime : latencyReport.writerRealtime) = true;
+        else
+            latencyReport.notes.add ("couldn't give the " + threadName + " thread real-time priority, which may need privileges");
+    }
+}
+
+/////////////////////////////////
+// SerialPort pending operations
+/////////////////////////////////
+bool SerialPort::startOperation (SerialPortPendingOperation& operation)
+{
+    const ScopedLock l (operationLock);
+    if (operation.isReady ())
+        return false;
+
+    pendingOperations.add (&operation);
+    numPendingOperations = pendingOperations.size ();
+    return true;
+}
+
+void SerialPort::completeReadyOperations ()
+{
+    if (numPendingOperations.load (std::memory_order_acquire) == 0)
+        return;
+
+    // operations are completed outside of the lock, as completing one may start another. they are collected a few at a
+    // time, so this never allocates
+    const int maxOperationsAtOnce = 16;
+    SerialPortPendingOperation* readyOperations[maxOperationsAtOnce];
+    auto numReady = 0;
+    do
+    {
+        numReady = 0;
+        {
+            const ScopedLock l (operationLock);
+            for (auto operationIndex = 0; operationIndex < pendingOperations.size () && numReady < maxOperationsAtOnce;)
+            {
+                auto* operation = pendingOperations[operationIndex];
+                if (operation->isReady ())
+                {
+                    readyOperations[numReady++] = operation;
+                    pendingOperations.remove (operationIndex);
+                }
+                else
+                {
+                    ++operationIndex;
+                }
+            }
+            numPendingOperations = pendingOperations.size ();
+        }
+
+        for (auto readyIndex = 0; readyIndex < numReady; ++readyIndex)
+            readyOperations[readyIndex]->complete (false);
+    }
+    while (numReady == maxOperationsAtOnce);
+}
+
+void SerialPort::cancelOperations (const void* stream)
+{
+    const int maxOperationsAtOnce = 16;
+    SerialPortPendingOperation* cancelledOperations[maxOperationsAtOnce];
+    auto numCancelled = 0;
+    do
+    {
+        numCancelled = 0;
+        {
+            const ScopedLock l (operationLock);
+            for (auto operationIndex = 0; operationIndex < pendingOperations.size () && numCancelled < maxOperationsAtOnce;)
+            {
+                auto* operation = pendingOperations[operationIndex];
+                if (stream == nullptr || operation->stream == stream)
+                {
+                    cancelledOperations[numCancelled++] = operation;
+                    pendingOperations.remove (operationIndex);
+                }
+                else
+                {
+                    ++operationIndex;
+                }
+            }
+            numPendingOperations = pendingOperations.size ();
+        }
+
+        for (auto cancelledIndex = 0; cancelledIndex < numCancelled; ++cancelledIndex)
+            cancelledOperations[cancelledIndex]->complete (true);
+    }
+    while (numCancelled == maxOperationsAtOnce);
+}
+
+/////////////////////////////////
+// SerialPortReactor
+/////////////////////////////////
+#if ! (JUCE_LINUX || JUCE_MAC)
+// no epoll or kqueue version, so attach () turns every stream away and they start their own threads
+class SerialPortReactor::PlatformWorker : public SerialPortReactor::Worker
+{
+public:
+    bool isValid () const override { return false; }
+    bool attach (SerialPort*, SerialPortInputStream*, SerialPortOutputStream*) override { return false; }
+    void detach (SerialPortInputStream*, SerialPortOutputStream*) override {}
+    void wake () override {}
+};
+
+std::unique_ptr<SerialPortReactor::Worker> SerialPortReactor::createWorker ()
+{
+    return std::make_unique<PlatformWorker> ();
+}
+#endif
+
+SerialPortReactor::SerialPortReactor (int numThreads)
+{
+    for (auto workerIndex = 0; workerIndex < jmax (1, numThreads); ++workerIndex)
+        workers.add (createWorker ().release ());
+}
+
+SerialPortReactor::~SerialPortReactor ()
+{
+    // the streams attached to a reactor must be deleted before it is
+    jassert (assignments.size () == 0);
+}
+
+bool SerialPortReactor::isSupported ()
+{
+   #if JUCE_LINUX || JUCE_MAC
+    return true;
+   #else
+    return false;
+   #endif
+}
+
+int SerialPortReactor::getNumPorts () const
+{
+    const ScopedLock l (assignmentLock);
+    return assignments.size ();
+}
+
+bool SerialPortReactor::attach (SerialPortInputStream* input, SerialPortOutputStream* output)
+{
+    auto* port = input != nullptr ? input->port : output->port;
+    if (port == nullptr)
+        return false;
+
+    const ScopedLock l (assignmentLock);
+    auto assignmentIndex = 0;
+    while (assignmentIndex < assignments.size () && assignments[assignmentIndex].port != port)
+        ++assignmentIndex;
+
+    if (assignmentIndex == assignments.size ())
+    {
+        // a new port goes to the thread with the fewest
+        Array<int> numPortsPerWorker;
+        for (auto workerIndex = 0; workerIndex < workers.size (); ++workerIndex)
+            numPortsPerWorker.add (0);
+        for (const auto& assignment : assignments)
+            numPortsPerWorker.getReference (assignment.workerIndex) += 1;
+        auto leastBusyWorker = 0;
+        for (auto workerIndex = 1; workerIndex < workers.size (); ++workerIndex)
+            if (numPortsPerWorker[workerIndex] < numPortsPerWorker[leastBusyWorker])
+                leastBusyWorker = workerIndex;
+
+        if (! workers[leastBusyWorker]->isValid ())
+            return false;
+        assignments.add ({ port, leastBusyWorker, 0 });
+    }
+
+    auto& assignment = assignments.getReference (assignmentIndex);
+    if (output != nullptr)
+        output->reactorWorkerIndex = assignment.workerIndex;
+    if (! workers[assignment.workerIndex]->attach (port, input, output))
+    {
+        if (assignment.numStreams == 0)
+            assignments.remove (assignmentIndex);
+        return false;
+    }
+    ++assignment.numStreams;
+    return true;
+}
+
+void SerialPortReactor::detach (SerialPortInputStream* input, SerialPortOutputStream* output)
+{
+    auto* port = input != nullptr ? input->port : output->port;
+    const ScopedLock l (assignmentLock);
+    for (auto assignmentIndex = 0; assignmentIndex < assignments.size (); ++assignmentIndex)
+    {
+        auto& assignment = assignments.getReference (assignmentIndex);
+        if (assignment.port != port)
+            continue;
+
+        workers[assignment.workerIndex]->detach (input, output);
+        if (--assignment.numStreams == 0)
+            assignments.remove (assignmentIndex);
+        return;
+    }
+}
+
+void SerialPortReactor::requestWrite (SerialPortOutputStream& output)
+{
+    // one wake up covers everything queued until the thread gets round to it
+    if (! output.writeRequested.exchange (true))
+        workers[output.reactorWorkerIndex]->wake ();
+}
+
+/////////////////////////////////
+// SerialPortWakeup, where the stream threads don't wait on descriptors or events
+/////////////////////////////////
+#if ! (JUCE_LINUX || JUCE_MAC || JUCE_WINDOWS)
+SerialPortWakeup::SerialPortWakeup () {}
+SerialPortWakeup::~SerialPortWakeup () {}
+void SerialPortWakeup::signal () {}
+void SerialPortWakeup::reset () {}
+#endif
+
+/////////////////////////////////
+// SerialPortWatcher
+/////////////////////////////////
+#if ! (JUCE_LINUX || JUCE_MAC || JUCE_WINDOWS)
+// no device events, so the watcher polls. wait () only returns early to be woken
+class SerialPortWatcher::PlatformDeviceEvents : public SerialPortWatcher::DeviceEvents
+{
+public:
+    bool isValid () const override { return false; }
+    bool wait (int timeoutMs) override
+    {
+        woken.wait (timeoutMs);
+        return false;
+    }
+    void wake () override { woken.signal (); }
+
+private:
+    WaitableEvent woken;
+};
+
+std::unique_ptr<SerialPortWatcher::DeviceEvents> SerialPortWatcher::createDeviceEvents ()
+{
+    return std::make_unique<PlatformDeviceEvents> ();
+}
+#endif
+
+namespace
+{
+    // devices tend to arrive as a burst of events (eg. a node, then its permissions), which are let settle into one scan
+    const auto kWatcherSettleTimeMs { 20 };
+    const auto kWatcherMaxSettles { 10 };
+}
+
+SerialPortWatcher::SerialPortWatcher (int fallbackPollIntervalMs)
+    : Thread ("SerialPortWatcher"),
+      // set up before the first scan, so a device arriving meanwhile isn't missed
+      deviceEvents (createDeviceEvents ()),
+      pollIntervalMs (jmax (10, fallbackPollIntervalMs))
+{
+    portIndex = std::make_shared<SerialPortInfoIndex> (SerialPort::getSerialPortInfo ());
+    for (const auto& port : portIndex->getPorts ())
+        paths.set (port.name, port.path);
+    startThread ();
+}
+
+SerialPortWatcher::~SerialPortWatcher ()
+{
+    signalThreadShouldExit ();
+    deviceEvents->wake ();
+    stopThread (5000);
+}
+
+StringPairArray SerialPortWatcher::getSerialPortPaths () const
+{
+    const ScopedLock l (pathsLock);
+    return paths;
+}
+
+std::shared_ptr<const SerialPortInfoIndex> SerialPortWatcher::getPortIndex () const
+{
+    const ScopedLock l (pathsLock);
+    return portIndex;
+}
+
+bool SerialPortWatcher::isEventDriven () const
+{
+    return deviceEvents->isValid ();
+}
+
+void SerialPortWatcher::run ()
+{
+    while (! threadShouldExit ())
+    {
+        const auto eventDriven { deviceEvents->isValid () };
+        const auto devicesChanged { deviceEvents->wait (eventDriven ? -1 : pollIntervalMs.load ()) };
+        if (threadShouldExit ())
+            break;
+        if (devicesChanged)
+        {
+            for (auto settle { 0 }; settle < kWatcherMaxSettles && deviceEvents->wait (kWatcherSettleTimeMs); ++settle)
+            {
+            }
+            if (threadShouldExit ())
+                break;
+        }
+        if (devicesChanged || ! eventDriven)
+            rescan ();
+    }
+}
+
+void SerialPortWatcher::rescan ()
+{
+    // one pass for the details as well as the paths, so they always agree
+    auto newIndex { std::make_shared<SerialPortInfoIndex> (SerialPort::getSerialPortInfo ()) };
+    StringPairArray newPaths;
+    for (const auto& port : newIndex->getPorts ())
+        newPaths.set (port.name, port.path);
+    StringPairArray added, removed;
+    {
+        const ScopedLock l (pathsLock);
+        // a port whose path changed under the same name counts as one going away and another arriving
+        for (const auto& name : newPaths.getAllKeys ())
+            if (! paths.containsKey (name) || paths[name] != newPaths[name])
+                added.set (name, newPaths[name]);
+        for (const auto& name : paths.getAllKeys ())
+            if (! newPaths.containsKey (name) || paths[name] != newPaths[name])
+                removed.set (name, paths[name]);
+        // kept even if the paths haven't changed, in case another device has taken the place of one that went away
+        portIndex = std::move (newIndex);
+        if (added.size () == 0 && removed.size () == 0)
+            return;
+        paths = newPaths;
+        ++changeCount;
+    }
+    listeners.call ([&added, &removed] (Listener& listener) { listener.serialPortsChanged (added, removed); });
+}
+
+/////////////////////////////////
+// SerialPortInputStream blocking reads
+/////////////////////////////////
+bool SerialPortInputStream::waitForData (size_t minBytes, int timeoutMs)
+{
+    const auto startTime = Time::getMillisecondCounter ();
+    // counted before the check, so the reader thread either sees a waiter and signals, or wrote its data before the check
+    ++numDataWaiters;
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    auto hasEnoughData = false;
+    for (;;)
+    {
+        hasEnoughData = buffer.getNumReady () >= minBytes;
+        if (hasEnoughData || readerStopped)
+            break;
+
+        auto waitTimeMs = -1;
+        if (timeoutMs >= 0)
+        {
+            waitTimeMs = timeoutMs - static_cast<int> (Time::getMillisecondCounter () - startTime);
+            if (waitTimeMs <= 0)
+                break;
+        }
+        dataArrived.wait (waitTimeMs);
+    }
+    --numDataWaiters;
+    return hasEnoughData;
+}
+
+int SerialPortInputStream::read (void* destBuffer, int maxBytesToRead, int timeoutMs)
+{
+    if (! waitForData (1, timeoutMs))
+        return 0;
+    return read (destBuffer, maxBytesToRead);
+}
+
+bool SerialPortInputStream::readExactly (void* destBuffer, size_t numBytes, int timeoutMs)
+{
+    const auto startTime = Time::getMillisecondCounter ();
+    for (;;)
+    {
+        auto timeLeftMs = -1;
+        if (timeoutMs >= 0)
+            timeLeftMs = jmax (0, timeoutMs - static_cast<int> (Time::getMillisecondCounter () - startTime));
+        if (! waitForData (numBytes, timeLeftMs))
+            return false;
+
+        // counted again with the data in hand, as the reader can drop the oldest of it meanwhile (see setReceiveLimit ())
+        const uint8_t* block1;
+        const uint8_t* block2;
+        size_t blockSize1, blockSize2;
+        buffer.prepareToRead (block1, blockSize1, block2, blockSize2);
+        if (blockSize1 + blockSize2 >= numBytes)
+        {
+            const auto numFromBlock1 = jmin (numBytes, blockSize1);
+            memcpy (destBuffer, block1, numFromBlock1);
+            memcpy (static_cast<uint8_t*> (destBuffer) + numFromBlock1, block2, numBytes - numFromBlock1);
+            buffer.finishedRead (numBytes);
+            return true;
+        }
+        buffer.finishedRead (0);
+    }
+}
+
+void SerialPortInputStream::signalDataWaiters ()
+{
+    // pairs with the increment in waitForData (), so the new data or the waiter is always seen by the other side
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (numDataWaiters.load (std::memory_order_relaxed) > 0)
+        dataArrived.signal ();
+}
+
+/////////////////////////////////
+// SerialPortOutputStream flushing
+/////////////////////////////////
+bool SerialPortOutputStream::flush (int timeoutMs)
+{
+    if (port == nullptr)
+        return false;
+
+    const auto startTime = Time::getMillisecondCounter ();
+    const auto getTimeLeftMs = [startTime, timeoutMs]
+    {
+        return timeoutMs < 0 ? -1 : jmax (0, timeoutMs - static_cast<int> (Time::getMillisecondCounter () - startTime));
+    };
+
+    // first the queue, which isn't held back for a coalescing window. counted before the check, so the writer either sees a waiter and signals, or took the data before the check
+    const auto numBytesToSend = getNumBytesQueued ();
+    sendNow ();
+    ++numFlushWaiters;
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    auto allTaken = false;
+    for (;;)
+    {
+        allTaken = getNumBytesSent () >= numBytesToSend;
+        if (allTaken || ! port->exists ())
+            break;
+
+        const auto timeLeftMs = getTimeLeftMs ();
+        if (timeLeftMs == 0)
+            break;
+        // nothing is signalled when the port closes, so that is checked every so often
+        dataSent.wait (timeLeftMs < 0 ? 100 : jmin (100, timeLeftMs));
+    }
+    --numFlushWaiters;
+
+    // then the driver's own queue, which empties at the speed of the line
+    return allTaken && port->waitForDriverToSend (getTimeLeftMs ());
+}
+
+size_t SerialPortOutputStream::getPendingTxBytes () const
+{
+    const auto numBytesQueued = buffer.getNumPending ();
+    return port != nullptr ? numBytesQueued + port->getNumBytesWaitingInDriver () : numBytesQueued;
+}
+
+void SerialPortOutputStream::signalFlushWaiters ()
+{
+    // pairs with the increment in flush (), so the data being taken or the waiter is always seen by the other side
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (numFlushWaiters.load (std::memory_order_relaxed) > 0)
+        dataSent.signal ();
+}
+
+/////////////////////////////////
+// SerialPortOutputStream write coalescing
+/////////////////////////////////
+void SerialPortOutputStream::setWriteCoalescing (int windowMicroseconds, size_t sendThresholdBytes)
+{
+    coalescingThreshold = sendThresholdBytes;
+    coalescingWindowMicroseconds = jmax (0, windowMicroseconds);
+    // a window that is being waited out ends with the old settings
+    if (holdingWrites)
+        triggerWrite.signal ();
+}
+
+void SerialPortOutputStream::sendNow ()
+{
+    // a position rather than a flag, so it stops mattering once that much has been sent, whether or not a window was open
+    const auto numBytesQueued = getNumBytesQueued ();
+    auto position = sendNowPosition.load (std::memory_order_relaxed);
+    while (position < numBytesQueued && ! sendNowPosition.compare_exchange_weak (position, numBytesQueued, std::memory_order_acq_rel))
+    {
+    }
+    if (holdingWrites)
+        triggerWrite.signal ();
+}
+
+void SerialPortOutputStream::waitToCoalesce ()
+{
+    const auto windowMicroseconds = coalescingWindowMicroseconds.load (std::memory_order_relaxed);
+    if (windowMicroseconds <= 0 || buffer.getNumPending () == 0)
+        return;
+
+    // meanwhile writes only wake the writer if they make the write due (see queuedData ()). they are sent once it is cleared
+    holdingWrites = true;
+    const auto endTimeMs = Time::getMillisecondCounterHiRes () + windowMicroseconds / 1000.0;
+    while (! isCoalescedWriteDue () && ! threadShouldExit ())
+    {
+        const auto timeLeftMs = endTimeMs - Time::getMillisecondCounterHiRes ();
+        if (timeLeftMs <= 0)
+            break;
+        // the event only waits for whole milliseconds, so the last one is slept out in short steps
+        if (timeLeftMs >= 1.0)
+            triggerWrite.wait (static_cast<int> (timeLeftMs));
+        else
+            std::this_thread::sleep_for (std::chrono::microseconds (jmin (50, static_cast<int> (timeLeftMs * 1000.0) + 1)));
+    }
+    holdingWrites = false;
+}
+
+/////////////////////////////////
+// SerialPortInputStream notifications
+/////////////////////////////////
+void SerialPortInputStream::addReceivedData (const void* data, size_t numBytes)
+{
+    const auto numBytesReceived = numBytes;
+    const auto maxBytes = receiveLimit.load (std::memory_order_relaxed);
+    if (maxBytes > 0 && buffer.getNumReady () + numBytes > maxBytes)
+    {
+        size_t numBytesDropped = 0;
+        if (overflowPolicy == OverflowPolicy::dropOldest)
+        {
+            if (numBytes > maxBytes)
+            {
+                // only the end of the chunk would survive, so the start of it isn't stored at all
+                numBytesDropped = numBytes - maxBytes;
+                data = static_cast<const uint8_t*> (data) + numBytesDropped;
+                numBytes = maxBytes;
+            }
+            numBytesDropped += buffer.makeRoom (numBytes, maxBytes);
+        }
+        else
+        {
+            // dropNewest, or stopReading after the limit was lowered while the reader had data in hand
+            const auto numReady = buffer.getNumReady ();
+            const auto numBytesThatFit = numReady < maxBytes ? maxBytes - numReady : 0;
+            numBytesDropped = numBytes - jmin (numBytes, numBytesThatFit);
+            numBytes -= numBytesDropped;
+        }
+        if (numBytesDropped > 0)
+            overflowed (numBytesDropped);
+    }
+
+    buffer.write (data, numBytes);
+    port->counters.received (numBytesReceived, buffer.getNumReady ());
+    if (numBytes == 0)
+    {
+        updateNotifications ();
+        return;
+    }
+    signalDataWaiters ();
+
+    // one notification covers the whole chunk, and however many more chunks arrive before the policy lets it go
+    lastReceiveTime = Time::getMillisecondCounterHiRes ();
+    numBytesSinceNotification += numBytes;
+    pendingReasons |= dataReason;
+    if (notify == NOTIFY_ON_CHAR && memchr (data, notifyChar, numBytes) != nullptr)
+        pendingReasons |= notifyCharReason;
+    if (! listeners.isEmpty () && (memchr (data, '\n', numBytes) != nullptr || memchr (data, '\r', numBytes) != nullptr))
+        pendingReasons |= lineReason;
+
+    updateNotifications ();
+    port->completeReadyOperations ();
+}
+
+void SerialPortInputStream::notifyError (const String& errorMessage)
+{
+    port->counters.error ();
+    {
+        const SpinLock::ScopedLockType l (errorMessageLock);
+        lastErrorMessage = errorMessage;
+    }
+    pendingReasons |= errorReason;
+    updateNotifications ();
+}
+
+void SerialPortInputStream::notifyPortClosed ()
+{
+    readerStopped = true;
+    signalDataWaiters ();
+    port->cancelOperations ();
+    pendingReasons |= closedReason;
+    updateNotifications ();
+}
+
+size_t SerialPortInputStream::getNumBytesToRead (size_t maxBytes)
+{
+    const auto maxBytesWaiting = receiveLimit.load (std::memory_order_relaxed);
+    if (maxBytesWaiting == 0 || overflowPolicy != OverflowPolicy::stopReading)
+    {
+        receiveBufferFull = false;
+        return maxBytes;
+    }
+
+    const auto numReady = buffer.getNumReady ();
+    const auto numBytesThatFit = numReady < maxBytesWaiting ? maxBytesWaiting - numReady : 0;
+    // reported once each time the buffer fills, rather than every time the reader finds it still full
+    if (numBytesThatFit == 0 && ! receiveBufferFull)
+        overflowed (0);
+    receiveBufferFull = numBytesThatFit == 0;
+    return jmin (maxBytes, numBytesThatFit);
+}
+
+void SerialPortInputStream::waitForReceiveSpace ()
+{
+    wait (receiveSpacePollMs);
+    updateNotifications ();
+}
+
+void SerialPortInputStream::overflowed (size_t numBytesDropped)
+{
+    port->counters.overflowed (numBytesDropped);
+    numBytesDroppedSinceNotification += numBytesDropped;
+    pendingReasons |= overflowReason;
+}
+
+void SerialPortInputStream::updateNotifications ()
+{
+    if (pendingReasons == 0)
+        return;
+
+    NotifyPolicy policy;
+    {
+        const ScopedLock l (notifyLock);
+        policy = notifyPolicy;
+    }
+
+    const auto now = Time::getMillisecondCounterHiRes ();
+    const auto isUrgent = (pendingReasons & (errorReason | closedReason)) != 0;
+    const auto intervalElapsed = now - lastNotificationTime >= policy.minIntervalMs;
+    const auto dataIsDue = numBytesSinceNotification >= policy.minBytes
+                           || (policy.idleTimeoutMs > 0 && now - lastReceiveTime >= policy.idleTimeoutMs);
+    const auto eventIsDue = (pendingReasons & (lineReason | notifyCharReason | overflowReason)) != 0;
+    if (! isUrgent && ! (intervalElapsed && (dataIsDue || eventIsDue)))
+        return;
+
+    const auto reasons = pendingReasons;
+    pendingReasons = 0;
+    numBytesSinceNotification = 0;
+    lastNotificationTime = now;
+    deliverNotifications (reasons);
+}
+
+int SerialPortInputStream::getNotificationTimeout (int maxTimeoutMs)
+{
+    if (pendingReasons == 0)
+        return maxTimeoutMs;
+
+    NotifyPolicy policy;
+    {
+        const ScopedLock l (notifyLock);
+        policy = notifyPolicy;
+    }
+
+    auto dueTime = lastNotificationTime + policy.minIntervalMs;
+    if ((pendingReasons & (lineReason | notifyCharReason | overflowReason)) == 0 && numBytesSinceNotification < policy.minBytes)
+    {
+        // below the byte threshold, only the line going idle makes the data due
+        if (policy.idleTimeoutMs <= 0)
+            return maxTimeoutMs;
+        dueTime = jmax (dueTime, lastReceiveTime + policy.idleTimeoutMs);
+    }
+
+    const auto msUntilDue = std::ceil (dueTime - Time::getMillisecondCounterHiRes ());
+    return msUntilDue <= 0 ? 0 : jmin (maxTimeoutMs, static_cast<int> (msUntilDue));
+}
+
+void SerialPortInputStream::deliverNotifications (uint32_t reasons)
+{
+    // change messages mean what they always have, the policy only decides when they go
+    if ((notify == NOTIFY_ALWAYS && (reasons & dataReason) != 0) || (reasons & notifyCharReason) != 0)
+    {
+        sendChangeMessage ();
+        port->counters.notified ();
+    }
+
+    if (listeners.isEmpty ())
+        return;
+
+    pendingEvents |= reasons;
+
+    const ScopedLock l (notifyLock);
+    if (listenerThread == NotifyThread::readerThread)
+    {
+        port->counters.notified ();
+        dispatchPendingEvents ();
+        return;
+    }
+
+    // events that arrive while a dispatch is queued are picked up by it, so there is never more than one in flight
+    if (dispatchQueued.exchange (true))
+        return;
+    port->counters.notified ();
+
+    auto dispatch = [guard = dispatchGuard]
+    {
+        const ScopedLock guardLock (guard->lock);
+        if (guard->stream != nullptr)
+        {
+            guard->stream->dispatchQueued = false;
+            guard->stream->dispatchPendingEvents ();
+        }
+    };
+
+    if (listenerThread == NotifyThread::executor && executor != nullptr)
+        executor (std::move (dispatch));
+    else
+        MessageManager::callAsync (std::move (dispatch));
+}
+
+void SerialPortInputStream::dispatchPendingEvents ()
+{
+    const auto events = pendingEvents.exchange (0);
+
+    if ((events & dataReason) != 0)
+        listeners.call ([this] (Listener& l) { l.serialDataAvailable (*this, buffer.getNumReady ()); });
+    if ((events & lineReason) != 0)
+        listeners.call ([this] (Listener& l) { l.serialLineAvailable (*this); });
+    if ((events & errorReason) != 0)
+    {
+        String errorMessage;
+        {
+            const SpinLock::ScopedLockType l (errorMessageLock);
+            errorMessage = lastErrorMessage;
+        }
+        listeners.call ([this, &errorMessage] (Listener& l) { l.serialError (*this, errorMessage); });
+    }
+    if ((events & overflowReason) != 0)
+    {
+        const auto numBytesDropped = numBytesDroppedSinceNotification.exchange (0);
+        listeners.call ([this, numBytesDropped] (Listener& l) { l.serialOverflow (*this, numBytesDropped); });
+    }
+    if ((events & closedReason) != 0)
+        listeners.call ([this] (Listener& l) { l.serialPortClosed (*this); });
+}
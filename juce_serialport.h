@@ -9,11 +9,12 @@
   website:          
   license:          
 
-  dependencies:     juce_core
+  dependencies:     juce_core, juce_events
   OSXFrameworks:
   iOSFrameworks:
   linuxLibs:
-  mingwLibs:
+  windowsLibs:      setupapi
+  mingwLibs:        setupapi
 
  END_JUCE_MODULE_DECLARATION
 ***********************************************************************************/
@@ -29,6 +30,9 @@ a typical serialport scenario may be:
 {
 	//get a list of serial ports installed on the system, as a StringPairArray containing a friendly name and the port path
 	StringPairArray portlist = SerialPort::getSerialPortPaths();
+	//(or keep a SerialPortWatcher, which keeps the list up to date and says when ports come and go)
+	//or find a particular device by its USB ids or serial number, without opening anything (see juce_serialport_PortInfo.h)
+	SerialPortInfoIndex ports(SerialPort::getSerialPortInfo());
 	if(portlist.size())
 	{
 		//open the first port on the system
@@ -40,6 +44,7 @@ a typical serialport scenario may be:
 			SerialPortInputStream * pInputStream = new SerialPortInputStream(pSP);
 
 			pOutputStream->write("hello world via serial", 22); //write some bytes
+			pOutputStream->flush(1000); //and wait (up to a second) for them to have left the machine, eg. before closing the port
 
 			//read chars one at a time:
 			char c;
@@ -59,6 +64,29 @@ a typical serialport scenario may be:
 			//NOTE - use with care at high baud rates!!!!
 			pInputStream->setNotify(SerialPortInputStream::NOTIFY_ALWAYS);
 
+			//notifications can be coalesced, eg. at most every 10ms, once 64 bytes are waiting or the line goes quiet for 5ms
+			pInputStream->setNotifyPolicy({ 64, 5.0, 10.0 });
+
+			//or delivered as typed callbacks, on the reader thread or an executor of our own rather than the message thread
+			pInputStream->addListener(this); //we must be a SerialPortInputStream::Listener
+			pInputStream->setListenerThread(SerialPortInputStream::NotifyThread::readerThread);
+
+			//keep at most 1MB of received data waiting, throwing away the oldest if the consumer falls behind
+			pInputStream->setReceiveLimit(1 << 20, SerialPortInputStream::OverflowPolicy::dropOldest);
+
+			//counters (bytes, driver calls, buffer high-water marks, errors etc) can be read from any thread
+			SerialPortStatistics stats = pSP->getStatistics();
+
+			//for request/response traffic, cut the driver's batching of received data, and see what took effect
+			SerialPortLatencyReport report = pSP->setLowLatency();
+
+			//with many ports open, their streams can share the threads of a SerialPortReactor instead of starting two each
+			SerialPortReactor reactor; //must outlive the streams that use it
+			SerialPortInputStream * pSharedInputStream = new SerialPortInputStream(pSP, reactor);
+
+			//decoded frames can be handled on a pool of threads, still in order for each port (see juce_serialport_Dispatch.h)
+			pInputStream->readFrames(framer, strand); //strand is a SerialPortFrameDispatcher::Strand
+
 			//please see class definitions for other features/functions etc		
 		}
 	}
@@ -74,7 +102,27 @@ a typical serialport scenario may be:
 	#include <jni.h>
 #endif
 
+#include "juce_serialport_RingBuffer.h"
+#include "juce_serialport_TransmitQueue.h"
+#include "juce_serialport_Checksum.h"
+#include "juce_serialport_Framing.h"
+#include "juce_serialport_Packet.h"
+#include "juce_serialport_Dispatch.h"
+#include "juce_serialport_PortInfo.h"
+
 using DebugFunction = std::function<void (juce::String, juce::String)>;
+//runs the function it is given on a thread of its choosing, eg. a thread pool or the message thread
+using SerialPortExecutor = std::function<void (std::function<void ()>)>;
+
+//the co_await-able API in juce_serialport_Coroutines.h needs C++20 coroutine support
+#if defined (__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L && __has_include (<coroutine>)
+ #define SERIALPORT_COROUTINES 1
+class SerialPortReadAwaiter;
+class SerialPortReadUntilAwaiter;
+class SerialPortWriteAwaiter;
+#else
+ #define SERIALPORT_COROUTINES 0
+#endif
 
 class JUCE_API SerialPortConfig
 {
@@ -95,6 +143,90 @@ public:
 	SerialPortFlowControl flowcontrol;
 };
 
+//////////////////////////////////////////////////////////////////
+//a snapshot of a port's counters, from SerialPort::getStatistics (). the totals are since the port was created, or since
+//resetStatistics (). each value is read on its own, so a snapshot taken while data is moving need not add up exactly
+struct SerialPortStatistics
+{
+	uint64_t bytesReceived { 0 };
+	uint64_t bytesSent { 0 };
+	uint64_t numReads { 0 };                 //reads from the driver that returned data
+	uint64_t numWrites { 0 };                //writes to the driver, including any that it could not take anything from
+	size_t receiveHighWaterMark { 0 };       //the most received bytes that have been waiting to be read at once
+	size_t transmitHighWaterMark { 0 };      //the most bytes that have been waiting to be sent at once
+	uint64_t numNotifications { 0 };         //change messages sent, and listener callbacks dispatched or queued
+	uint64_t numErrors { 0 };
+	uint64_t numOverflows { 0 };             //times received data has not fitted within the receive limit
+	uint64_t bytesDropped { 0 };             //received bytes thrown away because of the receive limit
+	uint64_t numReopens { 0 };               //successful opens after the first
+	double timeBlockedMs { 0 };              //time spent waiting for the driver to take more data to send
+};
+
+//////////////////////////////////////////////////////////////////
+//an opt-in profile for request/response traffic, whose round trips are otherwise dominated by drivers batching up
+//received data. see SerialPort::setLowLatency ()
+struct SerialPortLatencyOptions
+{
+	bool driverLowLatency { true };          //ASYNC_LOW_LATENCY on Linux, the shortest receive latency (IOSSDATALAT) on macOS
+	int usbLatencyTimerMs { 1 };             //for USB adapters with a latency timer (FTDI's is 16ms by default), 0 to leave it as it is
+	int cpu { -1 };                          //the CPU to pin the port's stream threads to, -1 to leave them where they are
+	bool realtimePriority { false };         //real-time scheduling for the stream threads, which may need privileges (eg. CAP_SYS_NICE)
+};
+
+//what SerialPort::setLowLatency () managed to do. the threads' parts are filled in as each stream thread picks the
+//profile up, within 100ms or so, so read them again with SerialPort::getLatencyReport ()
+struct SerialPortLatencyReport
+{
+	bool driverLowLatency { false };         //the driver accepted its low latency setting
+	int usbLatencyTimerMs { -1 };            //the adapter's latency timer, as read back afterwards. -1 where it has none that can be read
+	bool immediateReads { false };           //reads return as soon as anything has arrived, rather than waiting for more
+	int readerCpu { -1 }, writerCpu { -1 };  //the CPU each stream thread was pinned to, -1 if it wasn't (or hasn't yet)
+	bool readerRealtime { false }, writerRealtime { false };
+	juce::StringArray notes;                 //why each thing that was asked for didn't happen
+};
+
+//////////////////////////////////////////////////////////////////
+//something waiting for a port's streams to make progress, such as a co_await from juce_serialport_Coroutines.h.
+//once it has been passed to SerialPort::startOperation (), the stream threads complete it when isReady () returns true
+class JUCE_API SerialPortPendingOperation
+{
+public:
+	virtual ~SerialPortPendingOperation () = default;
+	//called with the port's operation lock held, by the thread that has just received or sent data
+	virtual bool isReady () = 0;
+	//called exactly once, without the lock held. wasCancelled is set if SerialPort::cancel () was called, the port
+	//closed, or the stream it was waiting on was deleted
+	virtual void complete (bool wasCancelled) = 0;
+
+	const void* stream { nullptr }; //the stream it is waiting on
+};
+
+class SerialPortInputStream;
+class SerialPortOutputStream;
+class SerialPortReactor;
+
+//////////////////////////////////////////////////////////////////
+//what a stream thread waits on alongside the driver, so that another thread can cut the wait short: an eventfd on
+//Linux, a pipe on macOS and a manual reset event on Windows. once signalled it stays that way until it is reset
+class JUCE_API SerialPortWakeup
+{
+public:
+	SerialPortWakeup ();
+	~SerialPortWakeup ();
+	void signal ();
+	void reset ();
+	//the descriptor to wait on for reading (-1 if there is none), or on Windows the event handle
+	int getDescriptor () const { return readDescriptor; }
+	void* getHandle () const { return handle; }
+
+private:
+	int readDescriptor { -1 };
+	int writeDescriptor { -1 };
+	void* handle { nullptr };
+
+	JUCE_DECLARE_NON_COPYABLE (SerialPortWakeup)
+};
+
 //////////////////////////////////////////////////////////////////
 class JUCE_API SerialPort
 {
@@ -123,19 +255,118 @@ public:
 	bool getConfig(SerialPortConfig & config);
 	juce::String getPortPath(){return portPath;}
 	static juce::StringPairArray getSerialPortPaths();
+	//the same ports, with their drivers and USB details, all found in one pass
+	static juce::Array<SerialPortInfo> getSerialPortInfo ();
 	bool exists();
+	//also completes every pending operation (eg. co_awaits on the port's streams) as cancelled
     virtual void cancel ();
 	void DebugLog (juce::String prefix, juce::String msg) { if (DebugLogInternal != nullptr) DebugLogInternal (prefix, msg); }
 	void setDebugLogFunction (DebugFunction theDebugLog) { DebugLogInternal = theDebugLog; }
 
+	//the port's counters, which are kept without locking, so this can be called from any thread at any time
+	SerialPortStatistics getStatistics () const;
+	void resetStatistics ();
+
+	//applies the low latency profile to the driver straight away, and again whenever the port is reopened or reconfigured.
+	//the port's stream threads pick up the thread options themselves, unless they are serviced by a SerialPortReactor,
+	//whose threads are shared with other ports and so are left alone. passing options with everything turned off undoes
+	//what it can of the driver settings, but threads stay where they have been put
+	SerialPortLatencyReport setLowLatency (const SerialPortLatencyOptions& options = {});
+	SerialPortLatencyReport getLatencyReport () const;
+
+	//adds an operation for the stream threads to complete when it is ready. if it is ready already it is not added,
+	//and false is returned, so the caller can carry on straight away
+	bool startOperation (SerialPortPendingOperation& operation);
+
 	juce_UseDebuggingNewOperator
 private:
 	friend class SerialPortInputStream;
 	friend class SerialPortOutputStream;
+	friend class SerialPortReactor;
 	void * portHandle;
 	int portDescriptor;
-    bool canceled;
 	juce::String portPath;
+	// signalled by close (), and reset by open (), so stream threads waiting on the driver find out straight away
+	SerialPortWakeup closedWakeup;
+
+	// updated by the stream threads, and by the platform code for opens. relaxed atomics, as each one only
+	// needs to be right on its own, and they are touched once per driver call rather than once per byte
+	struct Counters
+	{
+		void received (size_t numBytes, size_t numWaiting)
+		{
+			bytesReceived.fetch_add (numBytes, std::memory_order_relaxed);
+			numReads.fetch_add (1, std::memory_order_relaxed);
+			raise (receiveHighWaterMark, numWaiting);
+		}
+		void sent (size_t numBytes)
+		{
+			bytesSent.fetch_add (numBytes, std::memory_order_relaxed);
+			numWrites.fetch_add (1, std::memory_order_relaxed);
+		}
+		void queued (size_t numPending) { raise (transmitHighWaterMark, numPending); }
+		void blocked (juce::int64 startTicks)
+		{
+			const auto ticksBlocked = juce::Time::getHighResolutionTicks () - startTicks;
+			microsecondsBlocked.fetch_add (static_cast<uint64_t> (juce::Time::highResolutionTicksToSeconds (ticksBlocked) * 1.0e6), std::memory_order_relaxed);
+		}
+		void notified () { numNotifications.fetch_add (1, std::memory_order_relaxed); }
+		void error () { numErrors.fetch_add (1, std::memory_order_relaxed); }
+		void overflowed (size_t numBytesDropped)
+		{
+			numOverflows.fetch_add (1, std::memory_order_relaxed);
+			bytesDropped.fetch_add (numBytesDropped, std::memory_order_relaxed);
+		}
+		void opened ()
+		{
+			if (hasBeenOpened.exchange (true))
+				numReopens.fetch_add (1, std::memory_order_relaxed);
+		}
+
+		static void raise (std::atomic<size_t>& highWaterMark, size_t value)
+		{
+			auto current = highWaterMark.load (std::memory_order_relaxed);
+			while (value > current && ! highWaterMark.compare_exchange_weak (current, value, std::memory_order_relaxed))
+			{
+			}
+		}
+
+		std::atomic<uint64_t> bytesReceived { 0 }, bytesSent { 0 }, numReads { 0 }, numWrites { 0 };
+		std::atomic<size_t> receiveHighWaterMark { 0 }, transmitHighWaterMark { 0 };
+		std::atomic<uint64_t> numNotifications { 0 }, numErrors { 0 }, numOverflows { 0 }, bytesDropped { 0 }, numReopens { 0 }, microsecondsBlocked { 0 };
+		std::atomic<bool> hasBeenOpened { false };
+	};
+	Counters counters;
+
+	// called by the stream threads whenever they have received or sent data
+	void completeReadyOperations ();
+	// completes pending operations as cancelled, either all of them or just the ones waiting on a stream
+	void cancelOperations (const void* stream = nullptr);
+
+	// the low latency profile. the driver side is platform code, called with latencyLock held. the stream threads call
+	// tuneStreamThread () each time round their loops, and tune themselves when latencyGeneration has moved on
+	void applyDriverLatency (const SerialPortLatencyOptions& options, SerialPortLatencyReport& report);
+	// called by the platform open () once the port is set up, and by the macOS setConfig (), as setting the speed there
+	// can undo the driver latency. elsewhere setConfig () leaves the driver's latency settings alone
+	void reapplyDriverLatency ();
+	static bool pinCurrentThread (int cpu);
+	static bool makeCurrentThreadRealtime ();
+	void tuneStreamThread (int& tunedGeneration, bool isReader);
+
+	// for SerialPortOutputStream::flush (), in the platform code. the bytes the driver has been given and not sent yet,
+	// and a wait for them to go, returning false if they haven't within timeoutMs (-1 waits for as long as it takes)
+	size_t getNumBytesWaitingInDriver ();
+	bool waitForDriverToSend (int timeoutMs);
+
+	juce::CriticalSection latencyLock;
+	SerialPortLatencyOptions latencyOptions;
+	SerialPortLatencyReport latencyReport;
+	bool lowLatency { false };
+	std::atomic<int> latencyGeneration { 0 };
+
+	juce::CriticalSection operationLock;
+	juce::Array<SerialPortPendingOperation*> pendingOperations;
+	std::atomic<int> numPendingOperations { 0 }; // lets the stream threads skip the lock when nothing is waiting
 
     DebugFunction DebugLogInternal;
 
@@ -144,21 +375,164 @@ private:
 #endif
 };
 
+//////////////////////////////////////////////////////////////////
+//services the reads and writes of many ports from one thread, or a small fixed pool of them, rather than each stream
+//starting a thread of its own (epoll on Linux, kqueue on macOS). streams are attached by passing the reactor to their
+//constructors, and both of a port's streams are serviced by the same reactor thread, which then stands in for their
+//reader and writer threads: listener callbacks on NotifyThread::readerThread and co_awaits without an executor run
+//there, and hold up every other port on that thread until they return. a port is serviced until it closes, as with
+//the streams' own threads. where it isSupported () is false, the streams start their own threads as usual.
+//the reactor must outlive the streams attached to it
+class JUCE_API SerialPortReactor
+{
+public:
+	//the threads are started straight away. each port goes to the thread with the fewest ports when its first stream is attached
+	explicit SerialPortReactor (int numThreads = 1);
+	~SerialPortReactor ();
+
+	static bool isSupported ();
+	int getNumThreads () const { return workers.size (); }
+	int getNumPorts () const;
+
+private:
+	friend class SerialPortInputStream;
+	friend class SerialPortOutputStream;
+	// one thread, and what it waits on. each platform's is a PlatformWorker (epoll on Linux, kqueue on macOS), made by createWorker ()
+	class Worker
+	{
+	public:
+		virtual ~Worker () = default;
+		//false where there is nothing to wait on, or it couldn't be set up
+		virtual bool isValid () const = 0;
+		//starts servicing one or both of a port's streams, returning false if the port couldn't be waited on
+		virtual bool attach (SerialPort* port, SerialPortInputStream* input, SerialPortOutputStream* output) = 0;
+		//once this returns the thread has finished with the streams
+		virtual void detach (SerialPortInputStream* input, SerialPortOutputStream* output) = 0;
+		//wakes the thread, so it sees writes that have been asked for
+		virtual void wake () = 0;
+	};
+	class PlatformWorker;
+	static std::unique_ptr<Worker> createWorker ();
+
+	// called by the streams' constructors and destructors, with one of them set. attach () returns false if the stream
+	// should start its own thread after all
+	bool attach (SerialPortInputStream* input, SerialPortOutputStream* output);
+	void detach (SerialPortInputStream* input, SerialPortOutputStream* output);
+	// wakes the thread servicing the stream, as it has data to send
+	void requestWrite (SerialPortOutputStream& output);
+
+	// which thread each port is serviced by, and by how many streams
+	struct PortAssignment
+	{
+		SerialPort* port;
+		int workerIndex;
+		int numStreams;
+	};
+
+	juce::OwnedArray<Worker> workers;
+	juce::CriticalSection assignmentLock;
+	juce::Array<PortAssignment> assignments;
+
+	JUCE_DECLARE_NON_COPYABLE (SerialPortReactor)
+};
+
+//////////////////////////////////////////////////////////////////
+//keeps an up to date list of the system's serial ports, and tells listeners which ports came and went as soon as the
+//OS reports a device arriving or leaving (inotify on /dev on Linux, IOKit notifications on macOS, the SERIALCOMM
+//registry key on Windows), rather than every caller polling getSerialPortPaths () and comparing whole lists. the ports
+//are only scanned again once something has changed. where there are no device events (isEventDriven () is false)
+//they are scanned every fallbackPollIntervalMs instead
+class JUCE_API SerialPortWatcher : private juce::Thread
+{
+public:
+	//the first scan is done before the constructor returns, so getSerialPortPaths () is right straight away
+	explicit SerialPortWatcher (int fallbackPollIntervalMs = 1000);
+	~SerialPortWatcher () override;
+
+	class Listener
+	{
+	public:
+		virtual ~Listener () = default;
+		//called on the watcher's thread with the ports (friendly name and path, as from SerialPort::getSerialPortPaths ())
+		//that have appeared and gone away since the last call
+		virtual void serialPortsChanged (const juce::StringPairArray& added, const juce::StringPairArray& removed) = 0;
+	};
+	void addListener (Listener* listener) { listeners.add (listener); }
+	void removeListener (Listener* listener) { listeners.remove (listener); }
+
+	//the ports as of the last scan, without scanning again
+	juce::StringPairArray getSerialPortPaths () const;
+	//their details, indexed. a new index is made each time the ports change, so the one returned stays as it is
+	std::shared_ptr<const SerialPortInfoIndex> getPortIndex () const;
+	//goes up by one every time the list changes, so a caller polling the watcher can tell cheaply
+	uint32_t getChangeCount () const { return changeCount.load (); }
+
+	//false where the ports are being polled, either as the platform has no device events or they couldn't be set up
+	bool isEventDriven () const;
+	void setFallbackPollInterval (int newIntervalMs) { pollIntervalMs = juce::jmax (10, newIntervalMs); }
+
+private:
+	// what the thread waits on for devices to come and go. each platform's is a PlatformDeviceEvents, made by createDeviceEvents ()
+	class DeviceEvents
+	{
+	public:
+		virtual ~DeviceEvents () = default;
+		//false where the platform has no device events, or they couldn't be set up
+		virtual bool isValid () const = 0;
+		//true if devices may have come or gone, false once timeoutMs (-1 for ever) has passed or wake () was called
+		virtual bool wait (int timeoutMs) = 0;
+		virtual void wake () = 0;
+	};
+	class PlatformDeviceEvents;
+	static std::unique_ptr<DeviceEvents> createDeviceEvents ();
+
+	void run () override;
+	void rescan ();
+
+	std::unique_ptr<DeviceEvents> deviceEvents;
+	juce::CriticalSection pathsLock;
+	juce::StringPairArray paths;
+	std::shared_ptr<const SerialPortInfoIndex> portIndex;
+	std::atomic<uint32_t> changeCount { 0 };
+	std::atomic<int> pollIntervalMs;
+	juce::ListenerList<Listener, juce::Array<Listener*, juce::CriticalSection>> listeners;
+
+	JUCE_DECLARE_NON_COPYABLE (SerialPortWatcher)
+};
+
 //////////////////////////////////////////////////////////////////
 class JUCE_API SerialPortInputStream : public juce::InputStream, public juce::ChangeBroadcaster, private juce::Thread
 {
 public:
     SerialPortInputStream(SerialPort * port) :
-		Thread("SerialInThread"), port(port),bufferedbytes(0), notify(NOTIFY_OFF), notifyChar(0)
+		Thread("SerialInThread"), port(port), notify(NOTIFY_OFF), notifyChar(0)
 	{
+		dispatchGuard->stream = this;
 		startThread();
 	}
+	//reads on one of reactorToUse's threads, rather than starting a thread of its own (see SerialPortReactor)
+	SerialPortInputStream (SerialPort* port, SerialPortReactor& reactorToUse) :
+		Thread ("SerialInThread"), port (port), notify (NOTIFY_OFF), notifyChar (0)
+	{
+		dispatchGuard->stream = this;
+		if (reactorToUse.attach (this, nullptr))
+			reactor = &reactorToUse;
+		else
+			startThread ();
+	}
 
 	virtual ~SerialPortInputStream()
 	{
 		signalThreadShouldExit();
         cancel ();
+		if (reactor != nullptr)
+			reactor->detach (this, nullptr);
         waitForThreadToExit (5000);
+		if (port != nullptr)
+			port->cancelOperations (this);
+		//waits for a dispatch that is running on an executor, and stops any that are still queued from reaching us
+		const juce::ScopedLock l (dispatchGuard->lock);
+		dispatchGuard->stream = nullptr;
 	}
 
 	enum notifyflag{NOTIFY_OFF=0, NOTIFY_ON_CHAR, NOTIFY_ALWAYS};
@@ -168,52 +542,284 @@ public:
 		this->notify = _notify;
 	}
 
+	//typed notifications, as an alternative to the change messages set up with setNotify ()
+	class Listener
+	{
+	public:
+		virtual ~Listener () = default;
+		//at least NotifyPolicy::minBytes have arrived since the last notification, or the line has gone idle with data waiting
+		virtual void serialDataAvailable (SerialPortInputStream&, size_t /*numBytesWaiting*/) {}
+		//a CR or LF has arrived since the last notification
+		virtual void serialLineAvailable (SerialPortInputStream&) {}
+		virtual void serialError (SerialPortInputStream&, const juce::String& /*errorMessage*/) {}
+		//received data didn't fit within the receive limit (see setReceiveLimit ()). numBytesDropped is how much has been
+		//thrown away since the last call, which is 0 with OverflowPolicy::stopReading as the data is left with the driver
+		virtual void serialOverflow (SerialPortInputStream&, size_t /*numBytesDropped*/) {}
+		//the reader has stopped because the port was closed, or the device went away
+		virtual void serialPortClosed (SerialPortInputStream&) {}
+	};
+	void addListener (Listener* listener) { listeners.add (listener); }
+	void removeListener (Listener* listener) { listeners.remove (listener); }
+
+	//controls how often notifications (change messages and listener callbacks) are sent. data that arrives between
+	//notifications is coalesced into the next one. errors and closing are always reported straight away
+	struct NotifyPolicy
+	{
+		size_t minBytes { 1 };          //data is only notified once this many bytes have arrived since the last notification...
+		double idleTimeoutMs { 0 };     //...or once no more data has arrived for this long (0 to wait for minBytes regardless)
+		double minIntervalMs { 0 };     //never notify more often than this
+	};
+	//deadlines are checked when the reader thread wakes up, so idle and interval timing is only as fine as its poll
+	//timeout on each platform (100ms when the line is quiet, less when a notification is due sooner on Linux and Windows)
+	void setNotifyPolicy (const NotifyPolicy& newPolicy)
+	{
+		const juce::ScopedLock l (notifyLock);
+		notifyPolicy = newPolicy;
+	}
+
+	//which thread listener callbacks are made on. change messages always arrive on the message thread
+	enum class NotifyThread { messageThread, readerThread, executor };
+	//with NotifyThread::executor, callbacks are made by whatever thread runs the functions passed to executorToUse.
+	//reader thread callbacks must return quickly, as nothing is received while they run
+	void setListenerThread (NotifyThread thread, std::function<void (std::function<void ()>)> executorToUse = nullptr)
+	{
+		jassert (thread != NotifyThread::executor || executorToUse != nullptr);
+		const juce::ScopedLock l (notifyLock);
+		listenerThread = thread;
+		executor = std::move (executorToUse);
+	}
+
+	//what happens to received data that would take the amount waiting to be read over the receive limit
+	enum class OverflowPolicy
+	{
+		dropOldest,     //the oldest unread data is thrown away to make room
+		dropNewest,     //the data that doesn't fit is thrown away
+		stopReading     //the reader stops taking data from the driver until there is room, so hardware or software flow
+		                //control (if enabled) can hold the sender off. otherwise the driver's own buffer may overflow
+	};
+	//limits how much received data is kept waiting to be read, so a stalled consumer can't use unlimited memory. 0 (the
+	//default) is no limit. overflows are counted in the port's statistics and reported to listeners with serialOverflow ()
+	void setReceiveLimit (size_t maxBytes, OverflowPolicy policy = OverflowPolicy::dropOldest)
+	{
+		overflowPolicy = policy;
+		receiveLimit = maxBytes;
+	}
+
 	bool canReadString()
 	{
-		const juce::ScopedLock l (bufferCriticalSection);
-		int iNdx=0;
-		while (iNdx < bufferedbytes)
-			if(buffer[iNdx++]==0)return true;
-		return false;
+		return buffer.getNumDelimiters (0) > 0;
 	}
 
 	bool canReadLine()
 	{
-		const juce::ScopedLock l (bufferCriticalSection);
-		int iNdx=0;
-		while (iNdx < bufferedbytes)
-			if (buffer[iNdx++]=='\n' /*|| (buffer[iNdx++]=='\r')*/)
-				return true;
-		return false;
+		//the LF of a CRLF that was split between reads doesn't count, as its line has been read already
+		dropSkippedLineFeed ();
+		return buffer.getNumDelimiters ('\n') > 0 || buffer.getNumDelimiters ('\r') > 0;
 	}
 
+	//delimiters are counted as data arrives, so these don't search the received data. '\n', '\r' and 0 are always tracked,
+	//others can be added with trackDelimiter () (which returns false once SerialPortRingBuffer::maxTrackedDelimiters are tracked)
+	bool trackDelimiter (char delimiter) { return buffer.trackDelimiter (static_cast<uint8_t> (delimiter)); }
+	//the number of tracked delimiters waiting to be read, or -1 if the delimiter is not tracked
+	int getNumDelimiters (char delimiter) { return buffer.getNumDelimiters (static_cast<uint8_t> (delimiter)); }
+	//the number of bytes before the next tracked delimiter, or -1 if there isn't one waiting
+	int getNumBytesUntilDelimiter (char delimiter) { return buffer.getNumBytesUntilDelimiter (static_cast<uint8_t> (delimiter)); }
+
 	virtual void run();
 	virtual int read(void *destBuffer, int maxBytesToRead);
+
+	//blocking reads, which sleep until the reader thread signals that data has arrived. they are for the one thread that
+	//consumes the stream, and a timeoutMs of -1 waits for as long as it takes (or until the port closes)
+	//waits until at least minBytes are waiting to be read, returning false if they haven't arrived in time
+	bool waitForData (size_t minBytes = 1, int timeoutMs = -1);
+	//waits for anything to arrive, then reads up to maxBytesToRead. returns the number of bytes read, which is 0 on a timeout
+	int read (void* destBuffer, int maxBytesToRead, int timeoutMs);
+	//waits for numBytes to arrive, then reads them all. returns false, having read nothing, if they haven't arrived in time.
+	//numBytes must be within any receive limit, or it can never arrive
+	bool readExactly (void* destBuffer, size_t numBytes, int timeoutMs);
+
+#if SERIALPORT_COROUTINES
+	//co_await-able reads (see juce_serialport_Coroutines.h), which resume on the reader thread, or through executor if one is given.
+	//readAsync () gives true once numBytes have arrived and been read into destBuffer. readUntil () reads the data up to the
+	//next delimiter into destBlock, and gives its length (the delimiter is removed, but not included). both give false (or -1)
+	//if cancelled, or if the port closes first. readAsync () also gives false if the receive limit dropped some of the data it was
+	//waiting for before it could be read
+	SerialPortReadAwaiter readAsync (void* destBuffer, size_t numBytes, SerialPortExecutor executor = nullptr);
+	SerialPortReadUntilAwaiter readUntil (char delimiter, juce::MemoryBlock& destBlock, SerialPortExecutor executor = nullptr);
+#endif
+
 	virtual juce::String readNextLine() //have to override this, because InputStream::readNextLine isn't compatible with SerialPorts (uses setPos)
 	{
-		juce::String s;
-		char c;
-		s.preallocateBytes(32);
-		while(read(&c, 1) && (c!='\n'))
-			s.append(juce::String::charToString(c), 1);
-		s = s.trim();
-		return s;
+		const char* block1;
+		const char* block2;
+		size_t blockSize1, blockSize2;
+		const auto droppedLineFeed = dropSkippedLineFeed ();
+		const auto numBytesInLine = prepareToReadLine (block1, blockSize1, block2, blockSize2);
+		if (numBytesInLine == 0)
+		{
+			//that LF only finished the line before, so the start of the next one is left until it is complete
+			if (droppedLineFeed)
+				return {};
+			//no complete line, so take whatever there is, as this always has
+			juce::MemoryBlock partialLine (buffer.getNumReady ());
+			const auto numBytesRead = buffer.read (partialLine.getData (), partialLine.getSize ());
+			return juce::String::fromUTF8 (static_cast<const char*> (partialLine.getData ()), static_cast<int> (numBytesRead)).trim ();
+		}
+
+		auto s = juce::String::fromUTF8 (block1, static_cast<int> (blockSize1));
+		if (blockSize2 > 0)
+			s += juce::String::fromUTF8 (block2, static_cast<int> (blockSize2));
+		finishedRead (numBytesInLine);
+		return s.trim ();
+	}
+
+	//allocation free line reading. lines can end with CR, LF or CRLF, and the terminator is not included.
+	//copies the next complete line into destBuffer (not null terminated) and returns its length, or -1 if no complete line
+	//has arrived yet. a line longer than maxBytes is returned in pieces, so maxBytes must be at least 1
+	int readNextLine (char* destBuffer, int maxBytes)
+	{
+		jassert (maxBytes > 0);
+		if (maxBytes <= 0)
+			return -1;
+
+		const char* block1;
+		const char* block2;
+		size_t blockSize1, blockSize2;
+		const auto numBytesInLine = prepareToReadLine (block1, blockSize1, block2, blockSize2);
+		if (numBytesInLine == 0)
+			return -1;
+
+		const auto lineLength = blockSize1 + blockSize2;
+		const auto numBytesToCopy = juce::jmin (lineLength, static_cast<size_t> (maxBytes));
+		const auto numFromBlock1 = juce::jmin (numBytesToCopy, blockSize1);
+		memcpy (destBuffer, block1, numFromBlock1);
+		memcpy (destBuffer + numFromBlock1, block2, numBytesToCopy - numFromBlock1);
+		finishedRead (numBytesToCopy < lineLength ? numBytesToCopy : numBytesInLine);
+		return static_cast<int> (numBytesToCopy);
+	}
+
+	//as above, into a block that is reused from line to line, and only grows when a line is longer than any before it
+	int readNextLine (juce::MemoryBlock& destBlock)
+	{
+		//so the line that is measured is the one that is read
+		const SerialPortRingBuffer::ScopedConsumerSection section (buffer);
+		const auto lineLength = getNumBytesUntilEndOfLine ();
+		if (lineLength < 0)
+			return -1;
+
+		//an empty line only has its terminator to remove, and the block may not have any data to copy into yet
+		if (lineLength == 0)
+		{
+			const char* block1;
+			const char* block2;
+			size_t blockSize1, blockSize2;
+			finishedRead (prepareToReadLine (block1, blockSize1, block2, blockSize2));
+			return 0;
+		}
+
+		destBlock.ensureSize (static_cast<size_t> (lineLength));
+		return readNextLine (static_cast<char*> (destBlock.getData ()), lineLength);
+	}
+
+	//zero copy line reading. if a complete line has arrived, gives its text in place as up to two blocks (as with prepareToRead ())
+	//and returns the number of bytes to pass to finishedRead (), which includes the terminator. returns 0 if there is no
+	//complete line, in which case finishedRead () must not be called
+	size_t prepareToReadLine (const char*& block1, size_t& blockSize1, const char*& block2, size_t& blockSize2)
+	{
+		int terminatorLength = 0;
+		size_t lineLength;
+		const uint8_t* dataBlock1;
+		const uint8_t* dataBlock2;
+		size_t dataBlockSize1, dataBlockSize2;
+		{
+			//measured and taken in one go, so the reader can't drop the start of the line in between (see setReceiveLimit ()).
+			//prepareToRead () opens a section of its own, which lasts until finishedRead ()
+			const SerialPortRingBuffer::ScopedConsumerSection section (buffer);
+			const auto endOfLine = findEndOfLine (terminatorLength);
+			if (endOfLine < 0)
+				return 0;
+			lineLength = static_cast<size_t> (endOfLine);
+			buffer.prepareToRead (dataBlock1, dataBlockSize1, dataBlock2, dataBlockSize2);
+		}
+		block1 = reinterpret_cast<const char*> (dataBlock1);
+		block2 = reinterpret_cast<const char*> (dataBlock2);
+		blockSize1 = juce::jmin (dataBlockSize1, lineLength);
+		blockSize2 = lineLength - blockSize1;
+
+		//a CR that is the last thing received may be the first half of a CRLF, so a LF straight after it is skipped
+		const auto numBytesInLine = lineLength + static_cast<size_t> (terminatorLength);
+		skipLeadingLineFeed = (terminatorLength == 1 && numBytesInLine == dataBlockSize1 + dataBlockSize2
+							   && (numBytesInLine <= dataBlockSize1 ? dataBlock1[numBytesInLine - 1] : dataBlock2[numBytesInLine - 1 - dataBlockSize1]) == '\r');
+		return numBytesInLine;
+	}
+
+	//the length of the next complete line, without its terminator, or -1 if no complete line has arrived yet
+	int getNumBytesUntilEndOfLine ()
+	{
+		int terminatorLength = 0;
+		return findEndOfLine (terminatorLength);
+	}
+
+	//as prepareToReadLine (), for the data up to the next occurrence of a tracked delimiter. returns 0 if there isn't one waiting
+	size_t prepareToReadUntil (char delimiter, const uint8_t*& block1, size_t& blockSize1, const uint8_t*& block2, size_t& blockSize2)
+	{
+		size_t length;
+		{
+			const SerialPortRingBuffer::ScopedConsumerSection section (buffer);
+			const auto numBytesUntilDelimiter = buffer.getNumBytesUntilDelimiter (static_cast<uint8_t> (delimiter));
+			if (numBytesUntilDelimiter < 0)
+				return 0;
+			length = static_cast<size_t> (numBytesUntilDelimiter);
+			buffer.prepareToRead (block1, blockSize1, block2, blockSize2);
+		}
+		blockSize1 = juce::jmin (blockSize1, length);
+		blockSize2 = length - blockSize1;
+		return length + 1;
+	}
+
+	//zero copy access to the received data. prepareToRead () gives the unread data as up to two blocks, which can be
+	//parsed in place, then finishedRead () removes however many bytes were used. every call to prepareToRead ()
+	//must be matched by a call to finishedRead (). the reader thread can carry on receiving in between, but if the buffer
+	//is full and set to drop the oldest data, it waits for finishedRead () before dropping any, so don't block in between
+	void prepareToRead (const uint8_t*& block1, size_t& blockSize1, const uint8_t*& block2, size_t& blockSize2)
+	{
+		buffer.prepareToRead (block1, blockSize1, block2, blockSize2);
+	}
+	void finishedRead (size_t numBytesRead)
+	{
+		buffer.finishedRead (numBytesRead);
+	}
+
+	//feeds all of the received data to a framer (see juce_serialport_Framing.h), which calls
+	//onFrame (const uint8_t* frame, size_t frameSize) for each frame it completes. returns the number of bytes used.
+	//onFrame is called from between prepareToRead () and finishedRead (), with the frame still in the buffer, so it
+	//must not block. anything slow should be handed off, eg. by passing a SerialPortFrameDispatcher::Strand as onFrame
+	template <typename Framer, typename FrameHandler>
+	size_t readFrames (Framer& framer, FrameHandler&& onFrame)
+	{
+		const uint8_t* block1;
+		const uint8_t* block2;
+		size_t blockSize1, blockSize2;
+		prepareToRead (block1, blockSize1, block2, blockSize2);
+		framer.process (block1, blockSize1, onFrame);
+		framer.process (block2, blockSize2, onFrame);
+		finishedRead (blockSize1 + blockSize2);
+		return blockSize1 + blockSize2;
 	}
 
 	virtual juce::int64 getTotalLength()
 	{
-		const juce::ScopedLock l(bufferCriticalSection);
-		return bufferedbytes;
+		return static_cast<juce::int64> (buffer.getNumReady ());
 	};
 
 	virtual bool isExhausted()
 	{
-		const juce::ScopedLock l(bufferCriticalSection);
-		return bufferedbytes ? false : true;
+		return buffer.getNumReady () == 0;
 	};
 
 	virtual juce::int64 getPosition(){return 0;}
 	virtual bool setPosition(juce::int64 /*newPosition*/){return false;}
+	//wakes the reader thread from its wait on the driver, so that it sees at once if it has been told to stop
     virtual void cancel ();
     SerialPort* getPort() { return port; }
 #if USING_JUCE_PRIOR_TO_7_0_5
@@ -227,12 +833,113 @@ public:
 #endif
 
 private:
+	friend class SerialPortReactor;
+
+	// one read of up to bytesToRead from the driver, by the reader thread or a SerialPortReactor, which passes the data on.
+	// returns false, having reported the error and closed the port, if the read failed
+	bool readFromDriver (uint8_t* readBuffer, size_t bytesToRead);
+
+	// reader thread side of the notifications, in juce_serialport.cpp
+	// called by the reader thread with each chunk it gets from the driver
+	void addReceivedData (const void* data, size_t numBytes);
+	// called by the reader thread when a read fails, and when it stops because the port has closed
+	void notifyError (const juce::String& errorMessage);
+	void notifyPortClosed ();
+	// how much the reader thread should ask the driver for. with OverflowPolicy::stopReading this is 0 while the receive
+	// buffer is full, and the reader calls waitForReceiveSpace () instead of reading
+	size_t getNumBytesToRead (size_t maxBytes);
+	void waitForReceiveSpace ();
+	void overflowed (size_t numBytesDropped);
+	// wakes anything blocked in waitForData ()
+	void signalDataWaiters ();
+	// sends any notifications that have become due. called after new data, and whenever the reader thread wakes up
+	void updateNotifications ();
+	// how long the reader thread can wait for data before a pending notification becomes due
+	int getNotificationTimeout (int maxTimeoutMs);
+	void deliverNotifications (uint32_t reasons);
+	void dispatchPendingEvents ();
+
+	enum NotifyReason : uint32_t
+	{
+		dataReason = 1, lineReason = 2, notifyCharReason = 4, errorReason = 8, closedReason = 16, overflowReason = 32
+	};
+
+	// shared with the functions posted to the executor or message thread, so they can tell when the stream has gone
+	struct DispatchGuard
+	{
+		juce::CriticalSection lock;
+		SerialPortInputStream* stream;
+	};
+
+	// finds the first CR or LF with the ring's delimiter tracking, and whether it is a CRLF pair
+	int findEndOfLine (int& terminatorLength)
+	{
+		dropSkippedLineFeed ();
+		const auto bytesUntilLineFeed = buffer.getNumBytesUntilDelimiter ('\n');
+		const auto bytesUntilCarriageReturn = buffer.getNumBytesUntilDelimiter ('\r');
+		if (bytesUntilCarriageReturn < 0 || (bytesUntilLineFeed >= 0 && bytesUntilLineFeed < bytesUntilCarriageReturn))
+		{
+			terminatorLength = 1;
+			return bytesUntilLineFeed;
+		}
+		terminatorLength = bytesUntilLineFeed == bytesUntilCarriageReturn + 1 ? 2 : 1;
+		return bytesUntilCarriageReturn;
+	}
+
+	// a line that ended with the last CR received may have been the first half of a CRLF, so a LF that arrives straight after
+	// it is dropped. returns true if it dropped one
+	bool dropSkippedLineFeed ()
+	{
+		if (! skipLeadingLineFeed || buffer.getNumReady () == 0)
+			return false;
+		skipLeadingLineFeed = false;
+
+		const uint8_t* block1;
+		const uint8_t* block2;
+		size_t blockSize1, blockSize2;
+		buffer.prepareToRead (block1, blockSize1, block2, blockSize2);
+		const auto isLineFeed = blockSize1 > 0 && block1[0] == '\n';
+		buffer.finishedRead (isLineFeed ? 1 : 0);
+		return isLineFeed;
+	}
+
 	SerialPort* port;
-	int bufferedbytes;
-	juce::MemoryBlock buffer;
-	juce::CriticalSection bufferCriticalSection;
+	SerialPortReactor* reactor { nullptr }; // set if the stream is serviced by a reactor rather than its own thread
+	SerialPortRingBuffer buffer; // written by the reader thread, read by the owner of the stream
+	SerialPortWakeup wakeup; // signalled by cancel (), and reset by the reader thread once it has woken
+	bool skipLeadingLineFeed { false };
 	notifyflag notify;
 	char notifyChar;
+	static const uint32_t readBufferSize = 4096;
+	// there is no signal from the consumer when it frees space, as that would cost every read, so the reader checks this often
+	static const int receiveSpacePollMs = 2;
+
+	std::atomic<size_t> receiveLimit { 0 };
+	std::atomic<OverflowPolicy> overflowPolicy { OverflowPolicy::dropOldest };
+	bool receiveBufferFull { false }; // reader thread only
+
+	// only signalled while something is waiting, so the reader thread doesn't pay for it otherwise
+	juce::WaitableEvent dataArrived;
+	std::atomic<int> numDataWaiters { 0 };
+	std::atomic<bool> readerStopped { false };
+
+	juce::ListenerList<Listener, juce::Array<Listener*, juce::CriticalSection>> listeners;
+	juce::CriticalSection notifyLock; // guards the policy and the listener thread settings
+	NotifyPolicy notifyPolicy;
+	NotifyThread listenerThread { NotifyThread::messageThread };
+	std::function<void (std::function<void ()>)> executor;
+	// reader thread only
+	uint32_t pendingReasons { 0 };
+	size_t numBytesSinceNotification { 0 };
+	double lastReceiveTime { 0 };
+	double lastNotificationTime { 0 };
+	// handed from the reader thread to whichever thread makes the listener callbacks
+	std::atomic<uint32_t> pendingEvents { 0 };
+	std::atomic<bool> dispatchQueued { false };
+	std::atomic<size_t> numBytesDroppedSinceNotification { 0 };
+	juce::SpinLock errorMessageLock;
+	juce::String lastErrorMessage;
+	std::shared_ptr<DispatchGuard> dispatchGuard { std::make_shared<DispatchGuard> () };
 };
 
 //////////////////////////////////////////////////////////////////
@@ -241,25 +948,78 @@ class JUCE_API SerialPortOutputStream : public juce::OutputStream, private juce:
 {
 public:
     SerialPortOutputStream(SerialPort * port)
-    :Thread("SerialOutThread"), port(port),bufferedbytes(0)
+    :Thread("SerialOutThread"), port(port)
 	{
 		startThread();
 	}
+	//writes on one of reactorToUse's threads, rather than starting a thread of its own (see SerialPortReactor)
+	SerialPortOutputStream (SerialPort* port, SerialPortReactor& reactorToUse) :
+		Thread ("SerialOutThread"), port (port)
+	{
+		if (reactorToUse.attach (nullptr, this))
+			reactor = &reactorToUse;
+		else
+			startThread ();
+	}
 	virtual ~SerialPortOutputStream()
 	{
 		signalThreadShouldExit();
         cancel ();
+		if (reactor != nullptr)
+			reactor->detach (nullptr, this);
         waitForThreadToExit (5000);
+		if (port != nullptr)
+			port->cancelOperations (this);
 //        juce::Logger::outputDebugString ("waiting for SerialPortOutputStream thread to end");
 //         if (! waitForThreadToExit (5000))
 //             juce::Logger::outputDebugString ("thread did not exit");
 //         juce::Logger::outputDebugString ("~SerialPortOutputStream");
 	}
 	virtual void run();
-	virtual void flush(){}
+	//waits for everything written so far to leave the machine (see flush (int))
+	virtual void flush() { flush (-1); }
 	virtual bool setPosition(juce::int64 /*newPosition*/){return false;}
 	virtual juce::int64 getPosition(){return -1;}
 	virtual bool write(const void *dataToWrite, size_t howManyBytes);
+	//queues the first howManyBytes of dataToWrite without copying them. when they have been sent the block is passed to onSent,
+	//on the writer thread, so it can be reused (see SerialPortBufferPool), or it is released if onSent is empty
+	bool write (juce::MemoryBlock&& dataToWrite, size_t howManyBytes, std::function<void (juce::MemoryBlock&&)> onSent = nullptr);
+	bool write (juce::MemoryBlock&& dataToWrite) { const auto howManyBytes = dataToWrite.getSize (); return write (std::move (dataToWrite), howManyBytes); }
+	//returns space for up to maxBytes, directly in the transmit queue, to be filled in place. no other writes can be queued
+	//until finishedWrite () is called with the number of bytes that were filled in, which are then sent
+	uint8_t* prepareToWrite (size_t maxBytes);
+	void finishedWrite (size_t numBytesWritten);
+	//builds a SerialPortPacket (see juce_serialport_Packet.h) directly in the transmit queue, from one value per field
+	template <typename Packet, typename... ValueTypes>
+	void writePacket (const ValueTypes&... values)
+	{
+		finishedWrite (Packet::write (prepareToWrite (Packet::size), values...));
+	}
+	//running totals of the bytes that have been queued, and of those that the driver has taken
+	uint64_t getNumBytesQueued () const { return buffer.getNumAppended (); }
+	uint64_t getNumBytesSent () const { return buffer.getNumConsumed (); }
+	//waits until everything written so far has left the machine: first for the writer thread to hand all of it to the driver,
+	//and then for the driver's own queue to empty. returns false if that hasn't happened within timeoutMs (-1 waits for as long
+	//as it takes), or if the port closes first. for the thread that writes, eg. before changing the line settings or closing
+	bool flush (int timeoutMs);
+	//the bytes written that haven't left the machine yet, both those still queued here and those the driver hasn't sent.
+	//doesn't block, so it can be used to pace writes
+	size_t getPendingTxBytes () const;
+	//gathers small writes into fewer driver writes. once something is written, the writer thread waits up to windowMicroseconds
+	//for more before sending it all at once, unless sendThresholdBytes (if not 0) are queued first, or sendNow () is called.
+	//a window of 0, the default, sends each write as soon as it is made. the writer sleeps out the last millisecond of a window
+	//in short steps, and on Windows the timer can stretch longer ones. streams serviced by a SerialPortReactor, and those on
+	//Android, always send straight away
+	void setWriteCoalescing (int windowMicroseconds, size_t sendThresholdBytes = 0);
+	//sends what is queued without waiting for the rest of the coalescing window, eg. after a latency critical frame. flush ()
+	//and co_await writeAsync () do this for whatever they are waiting for
+	void sendNow ();
+#if SERIALPORT_COROUTINES
+	//queues the data straight away, and gives a co_await-able (see juce_serialport_Coroutines.h) that resumes once the driver
+	//has taken all of it, on the writer thread or through executor if one is given. gives false if cancelled, or if the port closes first
+	SerialPortWriteAwaiter writeAsync (const void* dataToWrite, size_t howManyBytes, SerialPortExecutor executor = nullptr);
+#endif
+	//wakes the writer thread from its wait for data or for room in the driver, so that it sees at once if it has been told to stop
     virtual void cancel ();
     SerialPort* getPort() { return port; }
 #if USING_JUCE_PRIOR_TO_7_0_5
@@ -273,11 +1033,54 @@ public:
 #endif
 
 private:
+	friend class SerialPortReactor;
+
+	// called after anything is added to the queue, to wake the writer thread
+	void queuedData ()
+	{
+		if (port != nullptr)
+			port->counters.queued (buffer.getNumPending ());
+		// a writer that is gathering writes picks this one up too, so it is only woken if it should stop gathering
+		if (holdingWrites && ! isCoalescedWriteDue ())
+			return;
+		if (reactor != nullptr)
+			reactor->requestWrite (*this);
+		else
+			triggerWrite.signal ();
+	}
+
+	// one gather write of as much of the queue as the driver will take, up to maxBytes, by the writer thread or a
+	// SerialPortReactor. returns false, having closed the port, if the write failed. driverIsFull is set if the driver
+	// had no room, and the write should be tried again once it has
+	bool writeToDriver (size_t maxBytes, bool& driverIsFull);
+	// wakes anything blocked in flush (), once the driver has taken more of the queue
+	void signalFlushWaiters ();
+	// called by the writer thread when it wakes to new data, to gather more for the coalescing window (see setWriteCoalescing ())
+	void waitToCoalesce ();
+	bool isCoalescedWriteDue () const
+	{
+		const auto sendThreshold = coalescingThreshold.load (std::memory_order_relaxed);
+		return sendNowPosition.load (std::memory_order_acquire) > getNumBytesSent ()
+			|| (sendThreshold > 0 && buffer.getNumPending () >= sendThreshold);
+	}
+
 	SerialPort * port;
-	int bufferedbytes;
-	juce::MemoryBlock buffer;
-	juce::CriticalSection bufferCriticalSection;
+	SerialPortReactor* reactor { nullptr }; // set if the stream is serviced by a reactor rather than its own thread
+	int reactorWorkerIndex { -1 };
+	std::atomic<bool> writeRequested { false }; // coalesces the wake ups sent to the reactor thread
+	SerialPortTransmitQueue buffer; // appended to by write (), drained by the writer thread
 	juce::WaitableEvent triggerWrite;
-	static const uint32_t writeBufferSize = 128;
+	SerialPortWakeup wakeup; // signalled by cancel (), and reset by the writer thread once it has woken
+	// only signalled while something is waiting, so the writer doesn't pay for it otherwise
+	juce::WaitableEvent dataSent;
+	std::atomic<int> numFlushWaiters { 0 };
+	std::atomic<int> coalescingWindowMicroseconds { 0 };
+	std::atomic<size_t> coalescingThreshold { 0 };
+	std::atomic<bool> holdingWrites { false }; // set while the writer thread is gathering writes
+	std::atomic<uint64_t> sendNowPosition { 0 }; // everything queued up to here goes without waiting, see sendNow ()
+	static const int maxWriteRegions = 64; // most segments handed to the driver in one gather write
 };
+
+#include "juce_serialport_Coroutines.h"
+
 #endif //_SERIALPORT_H_
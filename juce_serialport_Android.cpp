@@ -3,6 +3,8 @@
 #if JUCE_ANDROID
 
 #include <stdio.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "juce_serialport.h"
 
@@ -57,6 +59,7 @@ E.g., for getSerialPortPaths which returns a string, you call it with env->CallO
     FIELD (stopBits, "stopBits", "I") \
     FIELD (parity, "parity", "I") \
     METHOD (getSerialPortPaths, "getSerialPortPaths", "(Landroid/content/Context;)Ljava/lang/String;") \
+    METHOD (getSerialPortInfo, "getSerialPortInfo", "(Landroid/content/Context;)Ljava/lang/String;") \
     METHOD (connect, "connect", "(I)Z") \
     METHOD (isOpen, "isOpen", "()Z") \
     METHOD (setParameters, "setParameters", "(IIII)Z") \
@@ -94,6 +97,42 @@ StringPairArray SerialPort::getSerialPortPaths()
     }
 }
 
+Array<SerialPortInfo> SerialPort::getSerialPortInfo ()
+{
+    Array<SerialPortInfo> ports;
+    try
+    {
+        auto env = getEnv();
+        GlobalRef context(getAppContext());
+        jmethodID constructorMethodId = env->GetMethodID(UsbSerialHelper, "<init>", "(Landroid/content/Context;Landroid/app/Activity;)V");
+        jobject usbSerialHelper = env->NewObject(UsbSerialHelper, constructorMethodId, context.get(), getMainActivity().get());
+
+        // a line per port: path, vendor id, product id, serial number, manufacturer, product and driver, separated by tabs
+        const auto portLines = StringArray::fromLines (juce::juceString ((jstring) env->CallObjectMethod (usbSerialHelper, UsbSerialHelper.getSerialPortInfo, context.get())));
+        for (const auto& portLine : portLines)
+        {
+            const auto fields = StringArray::fromTokens (portLine, "\t", "");
+            if (fields.size () < 7)
+                continue;
+
+            // named by index, as getSerialPortPaths () does
+            SerialPortInfo port;
+            port.name = String (ports.size ());
+            port.path = fields[0];
+            port.vendorId = fields[1].getIntValue ();
+            port.productId = fields[2].getIntValue ();
+            port.serialNumber = fields[3];
+            port.manufacturer = fields[4];
+            port.product = fields[5];
+            port.driver = fields[6];
+            ports.add (port);
+        }
+    } catch (const std::exception& e) {
+        DBG ("EXCEPTION IN SerialPort::getSerialPortInfo()" + String(e.what()));
+    }
+    return ports;
+}
+
 void SerialPort::close()
 {
     auto env = getEnv();
@@ -132,11 +171,50 @@ bool SerialPort::open(const String & newPortPath)
         portDescriptor = -1;
     }
 
+    if (result)
+        counters.opened ();
     return result;
 }
 
 void SerialPort::cancel ()
 {
+    cancelOperations ();
+}
+
+void SerialPort::applyDriverLatency (const SerialPortLatencyOptions& options, SerialPortLatencyReport& report)
+{
+    // the port is driven from Java through the USB host API, which has no latency settings to change
+    if (options.driverLowLatency || options.usbLatencyTimerMs > 0)
+        report.notes.add ("there are no driver latency settings for USB serial ports on Android");
+}
+
+bool SerialPort::pinCurrentThread (int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t cpus;
+    CPU_ZERO (&cpus);
+    CPU_SET (cpu, &cpus);
+    return sched_setaffinity (0, sizeof (cpus), &cpus) == 0;
+}
+
+bool SerialPort::makeCurrentThreadRealtime ()
+{
+    // apps are normally refused SCHED_FIFO, in which case this reports that it didn't happen
+    struct sched_param schedulingParameters {};
+    schedulingParameters.sched_priority = 40;
+    return pthread_setschedparam (pthread_self (), SCHED_FIFO, &schedulingParameters) == 0;
+}
+
+size_t SerialPort::getNumBytesWaitingInDriver ()
+{
+    return 0;
+}
+
+bool SerialPort::waitForDriverToSend (int)
+{
+    // writes are synchronous USB transfers, which have gone to the device by the time they return
+    return exists ();
 }
 
 bool SerialPort::setConfig(const SerialPortConfig & config)
@@ -237,42 +315,47 @@ void SerialPortInputStream::run()
 {
     try
     {
+        auto tunedGeneration = 0;
         while (port && port->portDescriptor != -1 && ! threadShouldExit())
         {
+            // picks up a low latency profile (see SerialPort::setLowLatency ())
+            port->tuneStreamThread (tunedGeneration, true);
+            // with OverflowPolicy::stopReading and a full receive buffer, the data is left with the driver until there is room
+            const auto bytesToRead = getNumBytesToRead (8192);
+            if (bytesToRead == 0)
+            {
+                waitForReceiveSpace ();
+                continue;
+            }
+
             auto env = getEnv();
-            jbyteArray result = env->NewByteArray (8192);
+            jbyteArray result = env->NewByteArray (static_cast<jsize> (bytesToRead));
             const int bytesRead = (jint) env->CallIntMethod (port->usbSerialHelper, UsbSerialHelper.read, result);
             if (bytesRead > 0)
             {
                 jbyte* jbuffer = env->GetByteArrayElements (result, nullptr);
-                {
-                    const ScopedLock lock(bufferCriticalSection);
-                    buffer.ensureSize(bufferedbytes + bytesRead);
-
-                    //String msg;
-                    for (int i = 0; i < bytesRead; ++i)
-                    {
-                        buffer[bufferedbytes++] = jbuffer[i];
-                        //msg += String (std::bitset<8>(static_cast<char>(buffer[bufferedbytes])).to_string()) + " ";
-                    }
-                    //port->DebugLog("*************** SerialPortInputStream::run(): " + msg);
-                }
+                addReceivedData (jbuffer, static_cast<size_t> (bytesRead));
                 env->ReleaseByteArrayElements(result, jbuffer, 0);
-
-                if (notify == NOTIFY_ALWAYS)
-                    sendChangeMessage();
             }
             else if (bytesRead == -1)
             {
                 port->close ();
                 break;
             }
+            else
+            {
+                updateNotifications ();
+            }
 
             env->DeleteLocalRef(result);
         }
     } catch (const std::exception& e) {
         port->DebugLog ("SerialPortInputStream::run", "EXCEPTION: " + String(e.what()));
+        notifyError (e.what ());
     }
+
+    if (! threadShouldExit ())
+        notifyPortClosed ();
 }
 
 void SerialPortInputStream::cancel ()
@@ -284,15 +367,7 @@ int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
     if (! port || port->portHandle == 0)
         return -1;
 
-    const ScopedLock l (bufferCriticalSection);
-
-    if (maxBytesToRead > bufferedbytes)
-        maxBytesToRead = bufferedbytes;
-
-    memcpy (destBuffer, buffer.getData (), maxBytesToRead);
-    buffer.removeSection (0, maxBytesToRead);
-    bufferedbytes -= maxBytesToRead;
-    return maxBytesToRead;
+    return static_cast<int> (buffer.read (destBuffer, static_cast<size_t> (jmax (0, maxBytesToRead))));
 }
 
 /////////////////////////////////
@@ -332,13 +407,46 @@ bool SerialPortOutputStream::write(const void *dataToWrite, size_t howManyBytes)
         //port->DebugLog("*************** SerialPortOutputStream::write (): " + msg);
 
         env->SetByteArrayRegion(jByteArray, 0, howManyBytes, cSignedCharArray);
+        // writes are synchronous here, so all of the call is time spent waiting for the driver
+        const auto blockedSince = Time::getHighResolutionTicks ();
         result = (jboolean) env->CallBooleanMethod(port->usbSerialHelper, UsbSerialHelper.write, jByteArray);
+        port->counters.blocked (blockedSince);
+        port->counters.sent (result ? howManyBytes : 0);
         env->DeleteLocalRef(jByteArray);
     } catch (const std::exception& e) {
         port->DebugLog ("SerialPortOutputStream::write", "EXCEPTION: " + String(e.what()));
+        port->counters.error ();
         return false;
     }
 
     return result;
 }
+
+bool SerialPortOutputStream::write (MemoryBlock&& dataToWrite, size_t howManyBytes, std::function<void (MemoryBlock&&)> onSent)
+{
+    // writes are synchronous here, so the block can be handed straight back
+    const auto result = write (dataToWrite.getData (), howManyBytes);
+    if (onSent != nullptr)
+        onSent (std::move (dataToWrite));
+    return result;
+}
+
+uint8_t* SerialPortOutputStream::prepareToWrite (size_t maxBytes)
+{
+    return buffer.prepareToAppend (maxBytes);
+}
+
+void SerialPortOutputStream::finishedWrite (size_t numBytesWritten)
+{
+    // there is no writer thread here, so the data that was built in the queue is sent straight away
+    SerialPortTransmitQueue::Region region;
+    buffer.finishedAppend (numBytesWritten);
+    while (buffer.getPendingRegions (&region, 1) == 1)
+    {
+        write (region.data, region.size);
+        buffer.consume (region.size);
+    }
+    port->completeReadyOperations ();
+    signalFlushWaiters ();
+}
 #endif // JUCE_ANDROID
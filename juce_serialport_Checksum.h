@@ -0,0 +1,369 @@
+/*Checksums and CRCs for validating frames
+
+All of them work the same way, and can be fed a frame in as many pieces as it arrives in:
+
+	SerialPortCrc16Modbus crc;
+	crc.update (header, headerSize);
+	crc.update (payload, payloadSize);
+	const auto value = crc.getValue ();
+
+or in one go with calculate (). writeValue () and readValue () put the value into, and get it back out of,
+a frame, as numBytes bytes in the byte order that is usual for that algorithm. SerialPortCheckedFramer (in
+juce_serialport_Framing.h) uses them to add a checksum to any of the framers.
+
+The CRCs are table driven, with the tables built at compile time. The reflected ones (CRC-16/Modbus, CRC-32,
+CRC-32C) work through 8 bytes at a time with slice-by-8 tables, and CRC-32C uses the SSE4.2 crc32 instruction,
+or the ARMv8 one, when the processor has it.
+
+check values, for the 9 bytes "123456789":
+	SerialPortCrc8          0xf4        (CRC-8/SMBUS)
+	SerialPortCrc16Ccitt    0x29b1      (CRC-16/CCITT-FALSE)
+	SerialPortCrc16Modbus   0x4b37
+	SerialPortCrc32         0xcbf43926  (as used by zip, ethernet etc.)
+	SerialPortCrc32c        0xe3069283  (Castagnoli)
+	SerialPortFletcher16    0x1ede
+	SerialPortXorChecksum   0x31
+*/
+
+#ifndef _SERIALPORT_CHECKSUM_H_
+#define _SERIALPORT_CHECKSUM_H_
+
+#if JUCE_INTEL
+ #include <nmmintrin.h>
+ #if JUCE_MSVC
+  #define SERIALPORT_SSE42_FUNCTION
+ #else
+  #define SERIALPORT_SSE42_FUNCTION __attribute__ ((target ("sse4.2")))
+ #endif
+#elif JUCE_ARM && defined (__ARM_FEATURE_CRC32)
+ #include <arm_acle.h>
+#endif
+
+//////////////////////////////////////////////////////////////////
+//reads and writes checksum values in a frame
+template <typename ValueType, bool BigEndian>
+struct SerialPortChecksumValue
+{
+    static constexpr size_t numBytes = sizeof (ValueType);
+
+    static void write (ValueType value, uint8_t* dest)
+    {
+        for (size_t byteIndex = 0; byteIndex < numBytes; ++byteIndex)
+            dest[byteIndex] = static_cast<uint8_t> (static_cast<uint64_t> (value) >> (8 * (BigEndian ? numBytes - 1 - byteIndex : byteIndex)));
+    }
+
+    static ValueType read (const uint8_t* source)
+    {
+        uint64_t value = 0;
+        for (size_t byteIndex = 0; byteIndex < numBytes; ++byteIndex)
+            value |= static_cast<uint64_t> (source[byteIndex]) << (8 * (BigEndian ? numBytes - 1 - byteIndex : byteIndex));
+        return static_cast<ValueType> (value);
+    }
+};
+
+//////////////////////////////////////////////////////////////////
+//lookup tables for SerialPortCrc, built at compile time. reflected CRCs get 8 tables, for slice-by-8
+template <typename ValueType, ValueType Polynomial, bool Reflected>
+struct SerialPortCrcTables
+{
+    static constexpr int numBits = 8 * static_cast<int> (sizeof (ValueType));
+    static constexpr size_t numTables = Reflected ? 8 : 1;
+    static constexpr uint32_t valueMask = static_cast<uint32_t> (static_cast<ValueType> (~ValueType (0)));
+
+    static constexpr ValueType reflect (ValueType value)
+    {
+        ValueType reflected = 0;
+        for (auto bit = 0; bit < numBits; ++bit)
+            if ((value >> bit) & 1)
+                reflected = static_cast<ValueType> (reflected | (ValueType (1) << (numBits - 1 - bit)));
+        return reflected;
+    }
+
+    constexpr SerialPortCrcTables () : entries ()
+    {
+        const auto reflectedPolynomial = static_cast<uint32_t> (reflect (Polynomial));
+        const auto topBit = uint32_t (1) << (numBits - 1);
+        for (uint32_t index = 0; index < 256; ++index)
+        {
+            auto entry = Reflected ? index : index << (numBits - 8);
+            for (auto bit = 0; bit < 8; ++bit)
+            {
+                if (Reflected)
+                    entry = (entry & 1) != 0 ? (entry >> 1) ^ reflectedPolynomial : entry >> 1;
+                else
+                    entry = ((entry & topBit) != 0 ? (entry << 1) ^ Polynomial : entry << 1) & valueMask;
+            }
+            entries[0][index] = entry;
+        }
+
+        // each further table moves a byte's contribution on by another byte
+        for (size_t tableIndex = 1; tableIndex < numTables; ++tableIndex)
+            for (uint32_t index = 0; index < 256; ++index)
+            {
+                const auto previous = entries[tableIndex - 1][index];
+                entries[tableIndex][index] = (previous >> 8) ^ entries[0][previous & 0xff];
+            }
+    }
+
+    uint32_t entries[numTables][256];
+};
+
+//////////////////////////////////////////////////////////////////
+/*Table driven CRC of 8, 16 or 32 bits, with the parameters given as in the usual CRC catalogues (the polynomial in
+its normal, unreflected, form). reflected CRCs are sent least significant byte first, the others most significant first
+*/
+template <typename ValueType, ValueType Polynomial, ValueType InitialValue, bool Reflected, ValueType FinalXor>
+class SerialPortCrc
+{
+public:
+    static_assert (sizeof (ValueType) == 1 || sizeof (ValueType) == 2 || sizeof (ValueType) == 4, "only 8, 16 and 32 bit CRCs are supported");
+    using Value = ValueType;
+    using WireFormat = SerialPortChecksumValue<ValueType, ! Reflected>;
+    static constexpr size_t numBytes = sizeof (ValueType);
+
+    void reset () { crc = initialRegister; }
+
+    void update (const void* data, size_t numBytesToAdd)
+    {
+        crc = updateRegister (crc, static_cast<const uint8_t*> (data), numBytesToAdd);
+    }
+
+    ValueType getValue () const { return static_cast<ValueType> (crc ^ FinalXor); }
+
+    static ValueType calculate (const void* data, size_t numBytesToAdd)
+    {
+        return static_cast<ValueType> (updateRegister (initialRegister, static_cast<const uint8_t*> (data), numBytesToAdd) ^ FinalXor);
+    }
+
+    static void writeValue (ValueType value, uint8_t* dest) { WireFormat::write (value, dest); }
+    static ValueType readValue (const uint8_t* source) { return WireFormat::read (source); }
+
+protected:
+    using Tables = SerialPortCrcTables<ValueType, Polynomial, Reflected>;
+
+    // reflected CRCs are worked on with the register (and so the polynomial and initial value) bit reversed
+    static constexpr ValueType initialRegister = Reflected ? Tables::reflect (InitialValue) : InitialValue;
+
+    static ValueType updateRegister (ValueType crcRegister, const uint8_t* data, size_t numBytesToAdd)
+    {
+        const auto& entries = tables.entries;
+        uint32_t value = crcRegister;
+        if constexpr (Reflected)
+        {
+            // 8 bytes at a time, each looked up in its own table, and the results combined
+            for (; numBytesToAdd >= 8; numBytesToAdd -= 8, data += 8)
+            {
+                const auto word1 = juce::ByteOrder::littleEndianInt (data) ^ value;
+                const auto word2 = juce::ByteOrder::littleEndianInt (data + 4);
+                value = entries[7][word1 & 0xff] ^ entries[6][(word1 >> 8) & 0xff]
+                      ^ entries[5][(word1 >> 16) & 0xff] ^ entries[4][word1 >> 24]
+                      ^ entries[3][word2 & 0xff] ^ entries[2][(word2 >> 8) & 0xff]
+                      ^ entries[1][(word2 >> 16) & 0xff] ^ entries[0][word2 >> 24];
+            }
+            for (; numBytesToAdd > 0; --numBytesToAdd)
+                value = (value >> 8) ^ entries[0][(value ^ *data++) & 0xff];
+        }
+        else
+        {
+            for (; numBytesToAdd > 0; --numBytesToAdd)
+                value = ((value << 8) ^ entries[0][((value >> (Tables::numBits - 8)) ^ *data++) & 0xff]) & Tables::valueMask;
+        }
+        return static_cast<ValueType> (value);
+    }
+
+private:
+    static constexpr Tables tables {};
+
+    ValueType crc { initialRegister };
+};
+
+using SerialPortCrc8 = SerialPortCrc<uint8_t, 0x07, 0x00, false, 0x00>;
+using SerialPortCrc16Ccitt = SerialPortCrc<uint16_t, 0x1021, 0xffff, false, 0x0000>;
+using SerialPortCrc16Modbus = SerialPortCrc<uint16_t, 0x8005, 0xffff, true, 0x0000>;
+using SerialPortCrc32 = SerialPortCrc<uint32_t, 0x04c11db7, 0xffffffff, true, 0xffffffff>;
+
+//////////////////////////////////////////////////////////////////
+/*CRC-32C (Castagnoli), which x86 (SSE4.2) and ARMv8 processors can calculate with a single instruction per 8 bytes.
+falls back to slice-by-8 tables on processors without it
+*/
+class SerialPortCrc32c : public SerialPortCrc<uint32_t, 0x1edc6f41, 0xffffffff, true, 0xffffffff>
+{
+public:
+    void update (const void* data, size_t numBytesToAdd)
+    {
+        crc = updateRegisterWithHardware (crc, static_cast<const uint8_t*> (data), numBytesToAdd);
+    }
+
+    uint32_t getValue () const { return crc ^ 0xffffffff; }
+
+    static uint32_t calculate (const void* data, size_t numBytesToAdd)
+    {
+        return updateRegisterWithHardware (initialRegister, static_cast<const uint8_t*> (data), numBytesToAdd) ^ 0xffffffff;
+    }
+
+    static bool hasHardwareSupport ()
+    {
+       #if JUCE_INTEL
+        static const bool supported = juce::SystemStats::hasSSE42 ();
+        return supported;
+       #elif JUCE_ARM && defined (__ARM_FEATURE_CRC32)
+        return true;
+       #else
+        return false;
+       #endif
+    }
+
+    void reset () { crc = initialRegister; }
+
+private:
+    static uint32_t updateRegisterWithHardware (uint32_t crcRegister, const uint8_t* data, size_t numBytesToAdd)
+    {
+       #if JUCE_INTEL || (JUCE_ARM && defined (__ARM_FEATURE_CRC32))
+        if (hasHardwareSupport ())
+            return updateRegisterInstruction (crcRegister, data, numBytesToAdd);
+       #endif
+        return updateRegister (crcRegister, data, numBytesToAdd);
+    }
+
+   #if JUCE_INTEL
+    SERIALPORT_SSE42_FUNCTION static uint32_t updateRegisterInstruction (uint32_t crcRegister, const uint8_t* data, size_t numBytesToAdd)
+    {
+       #if JUCE_64BIT
+        uint64_t value = crcRegister;
+        for (; numBytesToAdd >= 8; numBytesToAdd -= 8, data += 8)
+        {
+            uint64_t word;
+            memcpy (&word, data, sizeof (word));
+            value = _mm_crc32_u64 (value, word);
+        }
+        crcRegister = static_cast<uint32_t> (value);
+       #else
+        for (; numBytesToAdd >= 4; numBytesToAdd -= 4, data += 4)
+        {
+            uint32_t word;
+            memcpy (&word, data, sizeof (word));
+            crcRegister = _mm_crc32_u32 (crcRegister, word);
+        }
+       #endif
+        for (; numBytesToAdd > 0; --numBytesToAdd)
+            crcRegister = _mm_crc32_u8 (crcRegister, *data++);
+        return crcRegister;
+    }
+   #elif JUCE_ARM && defined (__ARM_FEATURE_CRC32)
+    static uint32_t updateRegisterInstruction (uint32_t crcRegister, const uint8_t* data, size_t numBytesToAdd)
+    {
+        for (; numBytesToAdd >= 8; numBytesToAdd -= 8, data += 8)
+        {
+            uint64_t word;
+            memcpy (&word, data, sizeof (word));
+            crcRegister = __crc32cd (crcRegister, word);
+        }
+        for (; numBytesToAdd > 0; --numBytesToAdd)
+            crcRegister = __crc32cb (crcRegister, *data++);
+        return crcRegister;
+    }
+   #endif
+
+    uint32_t crc { initialRegister };
+};
+
+//////////////////////////////////////////////////////////////////
+/*Fletcher-16, sent as sum2 followed by sum1. the sums are only reduced every few thousand bytes, rather than every byte
+*/
+class SerialPortFletcher16
+{
+public:
+    using Value = uint16_t;
+    using WireFormat = SerialPortChecksumValue<uint16_t, true>;
+    static constexpr size_t numBytes = 2;
+
+    void reset ()
+    {
+        sum1 = 0;
+        sum2 = 0;
+    }
+
+    void update (const void* data, size_t numBytesToAdd)
+    {
+        auto source = static_cast<const uint8_t*> (data);
+        while (numBytesToAdd > 0)
+        {
+            // the most bytes that can be added before sum2 could overflow 32 bits
+            const auto numInBlock = juce::jmin (numBytesToAdd, static_cast<size_t> (5802));
+            for (size_t byteIndex = 0; byteIndex < numInBlock; ++byteIndex)
+            {
+                sum1 += source[byteIndex];
+                sum2 += sum1;
+            }
+            sum1 %= 255;
+            sum2 %= 255;
+            source += numInBlock;
+            numBytesToAdd -= numInBlock;
+        }
+    }
+
+    uint16_t getValue () const { return static_cast<uint16_t> ((sum2 << 8) | sum1); }
+
+    static uint16_t calculate (const void* data, size_t numBytesToAdd)
+    {
+        SerialPortFletcher16 fletcher;
+        fletcher.update (data, numBytesToAdd);
+        return fletcher.getValue ();
+    }
+
+    static void writeValue (uint16_t value, uint8_t* dest) { WireFormat::write (value, dest); }
+    static uint16_t readValue (const uint8_t* source) { return WireFormat::read (source); }
+
+private:
+    uint32_t sum1 { 0 };
+    uint32_t sum2 { 0 };
+};
+
+//////////////////////////////////////////////////////////////////
+/*All of the bytes xor'ed together. the weakest check, but the one most simple devices use. works a word at a time
+*/
+class SerialPortXorChecksum
+{
+public:
+    using Value = uint8_t;
+    using WireFormat = SerialPortChecksumValue<uint8_t, true>;
+    static constexpr size_t numBytes = 1;
+
+    void reset () { value = 0; }
+
+    void update (const void* data, size_t numBytesToAdd)
+    {
+        auto source = static_cast<const uint8_t*> (data);
+        uint64_t words = 0;
+        for (; numBytesToAdd >= 8; numBytesToAdd -= 8, source += 8)
+        {
+            uint64_t word;
+            memcpy (&word, source, sizeof (word));
+            words ^= word;
+        }
+        words ^= words >> 32;
+        words ^= words >> 16;
+        words ^= words >> 8;
+        value ^= static_cast<uint8_t> (words);
+
+        for (; numBytesToAdd > 0; --numBytesToAdd)
+            value ^= *source++;
+    }
+
+    uint8_t getValue () const { return value; }
+
+    static uint8_t calculate (const void* data, size_t numBytesToAdd)
+    {
+        SerialPortXorChecksum checksum;
+        checksum.update (data, numBytesToAdd);
+        return checksum.getValue ();
+    }
+
+    static void writeValue (uint8_t checksumValue, uint8_t* dest) { *dest = checksumValue; }
+    static uint8_t readValue (const uint8_t* source) { return *source; }
+
+private:
+    uint8_t value { 0 };
+};
+
+#endif //_SERIALPORT_CHECKSUM_H_
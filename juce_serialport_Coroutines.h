@@ -0,0 +1,305 @@
+/*C++20 coroutine support: co_await-able reads, writes and frames
+
+	MyTask talkToDevice (SerialPortInputStream& input, SerialPortOutputStream& output)
+	{
+		uint8_t header[4];
+		if (! co_await input.readAsync (header, sizeof (header)))       // resumes once 4 bytes have arrived
+			co_return;                                                 // cancelled, or the port closed
+
+		juce::MemoryBlock line;
+		const auto lineLength = co_await input.readUntil ('\n', line);  // -1 if cancelled
+
+		if (! co_await output.writeAsync ("ok\n", 3))                  // resumes once the driver has taken it all
+			co_return;
+
+		SerialPortFrameReader<SerialPortCobsFramer<256>> frames (input);
+		while (const auto frame = co_await frames.nextFrame ())        // see juce_serialport_Framing.h
+			handleFrame (frame.data, frame.size);
+	}
+
+The task type (MyTask above) is up to the caller, these are only the awaitables. A coroutine is resumed by the
+stream's reader or writer thread, as soon as it can carry on, so it should hand anything slow elsewhere. Passing
+an executor to resume it on instead costs a hop, but leaves the stream threads free. SerialPort::cancel (), the
+port closing, and the stream being deleted all resume whatever is waiting, and the result then shows that
+nothing was read or written.
+
+Only one coroutine (or anything else) may read from a stream at a time. These only exist when compiling with
+C++20 coroutine support (when SERIALPORT_COROUTINES is 1).
+*/
+
+#ifndef _SERIALPORT_COROUTINES_H_
+#define _SERIALPORT_COROUTINES_H_
+
+#if SERIALPORT_COROUTINES
+
+#include <coroutine>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////
+//what the awaitables have in common. the stream threads complete them through SerialPortPendingOperation
+class SerialPortAwaiter : public SerialPortPendingOperation
+{
+public:
+    bool await_ready () const noexcept { return false; }
+
+    bool await_suspend (std::coroutine_handle<> handle)
+    {
+        continuation = handle;
+        // returning false carries straight on, without suspending, when the operation is ready already
+        return port.startOperation (*this);
+    }
+
+protected:
+    SerialPortAwaiter (SerialPort& portToUse, const void* streamToWaitOn, SerialPortExecutor executorToUse)
+        : port (portToUse), executor (std::move (executorToUse))
+    {
+        stream = streamToWaitOn;
+    }
+
+    void complete (bool wasCancelled) override
+    {
+        cancelled = wasCancelled;
+        if (executor != nullptr)
+            executor ([handle = continuation] { handle.resume (); });
+        else
+            continuation.resume ();
+    }
+
+    SerialPort& port;
+    SerialPortExecutor executor;
+    std::coroutine_handle<> continuation;
+    bool cancelled { false };
+};
+
+//////////////////////////////////////////////////////////////////
+class SerialPortReadAwaiter : public SerialPortAwaiter
+{
+public:
+    SerialPortReadAwaiter (SerialPortInputStream& streamToUse, void* destBufferToUse, size_t numBytesToRead, SerialPortExecutor executorToUse)
+        : SerialPortAwaiter (*streamToUse.getPort (), &streamToUse, std::move (executorToUse)),
+          inputStream (streamToUse), destBuffer (static_cast<uint8_t*> (destBufferToUse)), numBytes (numBytesToRead)
+    {
+    }
+
+    bool isReady () override
+    {
+        return static_cast<size_t> (inputStream.getTotalLength ()) >= numBytes || ! port.exists ();
+    }
+
+    bool await_resume ()
+    {
+        if (cancelled)
+            return false;
+
+        const uint8_t* block1;
+        const uint8_t* block2;
+        size_t blockSize1, blockSize2;
+        inputStream.prepareToRead (block1, blockSize1, block2, blockSize2);
+        // measured with the blocks, as the reader can drop the oldest data at any time before (see setReceiveLimit ())
+        if (blockSize1 + blockSize2 < numBytes)
+        {
+            inputStream.finishedRead (0);
+            return false;
+        }
+        const auto numFromBlock1 = juce::jmin (numBytes, blockSize1);
+        memcpy (destBuffer, block1, numFromBlock1);
+        memcpy (destBuffer + numFromBlock1, block2, numBytes - numFromBlock1);
+        inputStream.finishedRead (numBytes);
+        return true;
+    }
+
+private:
+    SerialPortInputStream& inputStream;
+    uint8_t* destBuffer;
+    size_t numBytes;
+};
+
+//////////////////////////////////////////////////////////////////
+class SerialPortReadUntilAwaiter : public SerialPortAwaiter
+{
+public:
+    SerialPortReadUntilAwaiter (SerialPortInputStream& streamToUse, char delimiterToUse, juce::MemoryBlock& destBlockToUse, SerialPortExecutor executorToUse)
+        : SerialPortAwaiter (*streamToUse.getPort (), &streamToUse, std::move (executorToUse)),
+          inputStream (streamToUse), delimiter (delimiterToUse), destBlock (destBlockToUse),
+          // the ring counts tracked delimiters as they arrive, so checking for one costs nothing
+          isTracked (streamToUse.trackDelimiter (delimiterToUse))
+    {
+        jassert (isTracked); // too many delimiters are being tracked, see SerialPortRingBuffer::maxTrackedDelimiters
+    }
+
+    bool isReady () override
+    {
+        return ! isTracked || inputStream.getNumDelimiters (delimiter) > 0 || ! port.exists ();
+    }
+
+    int await_resume ()
+    {
+        if (! isTracked || cancelled)
+            return -1;
+
+        const uint8_t* block1;
+        const uint8_t* block2;
+        size_t blockSize1, blockSize2;
+        const auto numBytesToRemove = inputStream.prepareToReadUntil (delimiter, block1, blockSize1, block2, blockSize2);
+        if (numBytesToRemove == 0)
+            return -1;
+
+        destBlock.ensureSize (blockSize1 + blockSize2);
+        memcpy (destBlock.getData (), block1, blockSize1);
+        memcpy (static_cast<uint8_t*> (destBlock.getData ()) + blockSize1, block2, blockSize2);
+        inputStream.finishedRead (numBytesToRemove);
+        return static_cast<int> (blockSize1 + blockSize2);
+    }
+
+private:
+    SerialPortInputStream& inputStream;
+    char delimiter;
+    juce::MemoryBlock& destBlock;
+    bool isTracked;
+};
+
+//////////////////////////////////////////////////////////////////
+class SerialPortWriteAwaiter : public SerialPortAwaiter
+{
+public:
+    SerialPortWriteAwaiter (SerialPortOutputStream& streamToUse, uint64_t sentPositionToWaitFor, SerialPortExecutor executorToUse)
+        : SerialPortAwaiter (*streamToUse.getPort (), &streamToUse, std::move (executorToUse)),
+          outputStream (streamToUse), sentPosition (sentPositionToWaitFor)
+    {
+    }
+
+    bool isReady () override
+    {
+        return outputStream.getNumBytesSent () >= sentPosition || ! port.exists ();
+    }
+
+    bool await_suspend (std::coroutine_handle<> handle)
+    {
+        // something is waiting for the data now, so it isn't held back for the rest of a coalescing window
+        outputStream.sendNow ();
+        return SerialPortAwaiter::await_suspend (handle);
+    }
+
+    bool await_resume () const
+    {
+        return ! cancelled && outputStream.getNumBytesSent () >= sentPosition;
+    }
+
+private:
+    SerialPortOutputStream& outputStream;
+    uint64_t sentPosition;
+};
+
+//////////////////////////////////////////////////////////////////
+//splits a stream into frames with one of the framers from juce_serialport_Framing.h, for co_await nextFrame ().
+//frames that arrive together are queued, so none are lost between one nextFrame () and the next
+template <typename Framer>
+class SerialPortFrameReader
+{
+public:
+    explicit SerialPortFrameReader (SerialPortInputStream& streamToUse) : inputStream (streamToUse) {}
+
+    Framer& getFramer () { return framer; }
+
+    //the result of co_await nextFrame (), which is false if it was cancelled or the port closed
+    struct Frame
+    {
+        const uint8_t* data { nullptr };
+        size_t size { 0 };
+        explicit operator bool () const { return data != nullptr; }
+    };
+
+    class Awaiter : public SerialPortAwaiter
+    {
+    public:
+        Awaiter (SerialPortFrameReader& readerToUse, SerialPortExecutor executorToUse)
+            : SerialPortAwaiter (*readerToUse.inputStream.getPort (), &readerToUse.inputStream, std::move (executorToUse)),
+              reader (readerToUse)
+        {
+        }
+
+        // runs the framer over whatever has arrived, on the thread that is checking, as nothing else reads the stream meanwhile
+        bool isReady () override
+        {
+            return reader.queueFrames () || ! port.exists ();
+        }
+
+        Frame await_resume ()
+        {
+            if (cancelled || ! reader.queueFrames ())
+                return {};
+            return reader.takeFrame ();
+        }
+
+    private:
+        SerialPortFrameReader& reader;
+    };
+
+    //the frame's data stays valid until the next call to nextFrame ()
+    Awaiter nextFrame (SerialPortExecutor executor = nullptr)
+    {
+        // the last frame handed out is finished with now
+        readPosition = nextReadPosition;
+        if (readPosition == queuedFrames.size ())
+            queuedFrames.clear ();
+        readPosition = nextReadPosition = juce::jmin (readPosition, queuedFrames.size ());
+        return Awaiter (*this, std::move (executor));
+    }
+
+private:
+    // frames are queued as their size followed by their data. they are copied out here, rather than handled, as
+    // readFrames () calls this with the buffer held open
+    bool queueFrames ()
+    {
+        inputStream.readFrames (framer, [this] (const uint8_t* frame, size_t frameSize)
+        {
+            const auto sizeOffset = queuedFrames.size ();
+            queuedFrames.resize (sizeOffset + sizeof (size_t) + frameSize);
+            memcpy (queuedFrames.data () + sizeOffset, &frameSize, sizeof (size_t));
+            if (frameSize > 0)
+                memcpy (queuedFrames.data () + sizeOffset + sizeof (size_t), frame, frameSize);
+        });
+        return readPosition < queuedFrames.size ();
+    }
+
+    Frame takeFrame ()
+    {
+        size_t frameSize;
+        memcpy (&frameSize, queuedFrames.data () + readPosition, sizeof (size_t));
+        const auto* frameData = queuedFrames.data () + readPosition + sizeof (size_t);
+        nextReadPosition = readPosition + sizeof (size_t) + frameSize;
+        return { frameData, frameSize };
+    }
+
+    SerialPortInputStream& inputStream;
+    Framer framer;
+    std::vector<uint8_t> queuedFrames;
+    size_t readPosition { 0 };
+    size_t nextReadPosition { 0 };
+};
+
+//////////////////////////////////////////////////////////////////
+inline SerialPortReadAwaiter SerialPortInputStream::readAsync (void* destBuffer, size_t numBytes, SerialPortExecutor executor)
+{
+    return SerialPortReadAwaiter (*this, destBuffer, numBytes, std::move (executor));
+}
+
+inline SerialPortReadUntilAwaiter SerialPortInputStream::readUntil (char delimiter, juce::MemoryBlock& destBlock, SerialPortExecutor executor)
+{
+    return SerialPortReadUntilAwaiter (*this, delimiter, destBlock, std::move (executor));
+}
+
+inline SerialPortWriteAwaiter SerialPortOutputStream::writeAsync (const void* dataToWrite, size_t howManyBytes, SerialPortExecutor executor)
+{
+    if (howManyBytes > 0)
+    {
+        memcpy (prepareToWrite (howManyBytes), dataToWrite, howManyBytes);
+        finishedWrite (howManyBytes);
+    }
+    // anything queued by other threads meanwhile is waited for too, which only ever makes the wait long enough
+    return SerialPortWriteAwaiter (*this, getNumBytesQueued (), std::move (executor));
+}
+
+#endif //SERIALPORT_COROUTINES
+
+#endif //_SERIALPORT_COROUTINES_H_
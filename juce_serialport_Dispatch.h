@@ -0,0 +1,283 @@
+/*Frame handling on a pool of threads, so that a slow handler for one port doesn't hold up the others
+
+Each port (or anything else whose frames have to stay in order) gets a Strand, with the handler for its frames.
+Frames given to a strand are copied into its queue, and the strand is run by one pool thread at a time, which
+handles everything queued so far and then moves on. So a port's frames are handled one at a time and in the order
+they arrived, while different ports' frames are handled side by side on as many cores as there are threads.
+
+Each thread has its own queue of strands waiting to run, and a strand goes back to the same thread each time it
+has new frames, so its handler stays warm in that core's cache. A thread with nothing to do takes waiting strands
+from the others, so one busy port (or thread) doesn't leave the rest of the pool idle.
+
+	SerialPortFrameDispatcher dispatcher; //one thread per core
+	SerialPortFrameDispatcher::Strand strand (dispatcher, [this] (const uint8_t* frame, size_t frameSize) { handleFrame (frame, frameSize); });
+
+	//eg. from a listener on the reader thread. the handler gets the frames on one of the dispatcher's threads
+	inputStream.readFrames (framer, strand);
+
+Strands must be deleted before their dispatcher. Deleting a strand waits for its handler to return, if it is
+running, and throws away any frames that haven't been handled yet, so it must not be deleted from its own handler.
+*/
+
+#ifndef _SERIALPORT_DISPATCH_H_
+#define _SERIALPORT_DISPATCH_H_
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class JUCE_API SerialPortFrameDispatcher
+{
+public:
+    using FrameHandler = std::function<void (const uint8_t* frame, size_t frameSize)>;
+
+    explicit SerialPortFrameDispatcher (int numThreads = juce::SystemStats::getNumCpus ())
+    {
+        for (auto workerIndex = 0; workerIndex < juce::jmax (1, numThreads); ++workerIndex)
+            workers.push_back (std::make_unique<Worker> (*this, workerIndex));
+        for (auto& worker : workers)
+            worker->startThread ();
+    }
+
+    ~SerialPortFrameDispatcher ()
+    {
+        for (auto& worker : workers)
+            worker->signalThreadShouldExit ();
+        for (auto& worker : workers)
+        {
+            worker->workAvailable.signal ();
+            worker->waitForThreadToExit (5000);
+        }
+    }
+
+    int getNumThreads () const { return static_cast<int> (workers.size ()); }
+
+    //////////////////////////////////////////////////////////////////
+    class Strand
+    {
+    public:
+        Strand (SerialPortFrameDispatcher& dispatcherToUse, FrameHandler handlerToUse)
+            : dispatcher (dispatcherToUse), handler (std::move (handlerToUse)),
+              homeWorker (dispatcherToUse.nextHomeWorker++ % dispatcherToUse.getNumThreads ())
+        {
+        }
+
+        ~Strand ()
+        {
+            bool wasQueued;
+            {
+                const juce::ScopedLock l (queueLock);
+                isDeleted = true;
+                queuedFrames.clear ();
+                numFramesWaiting = 0;
+                wasQueued = isQueued;
+            }
+            // once it is deleted it never goes back on a thread's queue, so if it isn't on one now, it is running
+            if (wasQueued && ! dispatcher.unschedule (*this))
+            {
+                finishedRunning.wait (-1);
+                const juce::ScopedLock l (queueLock); // the thread signals with the lock held, so wait for it to let go
+            }
+        }
+
+        //queues a copy of the frame to be handled on the pool. can be passed to SerialPortInputStream::readFrames () or a framer's process ()
+        void operator() (const uint8_t* frame, size_t frameSize)
+        {
+            const juce::ScopedLock l (queueLock);
+            if (isDeleted)
+                return;
+
+            const auto sizeOffset = queuedFrames.size ();
+            queuedFrames.resize (sizeOffset + sizeof (size_t) + frameSize);
+            memcpy (queuedFrames.data () + sizeOffset, &frameSize, sizeof (size_t));
+            if (frameSize > 0)
+                memcpy (queuedFrames.data () + sizeOffset + sizeof (size_t), frame, frameSize);
+            ++numFramesWaiting;
+
+            // a strand that is waiting or running already picks the frame up without being scheduled again
+            if (! isQueued)
+            {
+                isQueued = true;
+                dispatcher.schedule (*this, homeWorker, false);
+            }
+        }
+
+        //frames that have been queued, and haven't been handled yet
+        size_t getNumFramesWaiting () const { return numFramesWaiting.load (std::memory_order_relaxed); }
+
+    private:
+        friend class SerialPortFrameDispatcher;
+
+        // called by a pool thread, which has just taken the strand from a queue
+        void handleQueuedFrames (int workerIndex)
+        {
+            {
+                const juce::ScopedLock l (queueLock);
+                std::swap (queuedFrames, handlingFrames);
+            }
+
+            for (size_t readPosition = 0; readPosition < handlingFrames.size ();)
+            {
+                size_t frameSize;
+                memcpy (&frameSize, handlingFrames.data () + readPosition, sizeof (size_t));
+                handler (handlingFrames.data () + readPosition + sizeof (size_t), frameSize);
+                readPosition += sizeof (size_t) + frameSize;
+                --numFramesWaiting;
+            }
+            handlingFrames.clear ();
+
+            const juce::ScopedLock l (queueLock);
+            if (isDeleted)
+            {
+                isQueued = false;
+                finishedRunning.signal ();
+            }
+            else if (! queuedFrames.empty ())
+            {
+                // frames that arrived meanwhile wait their turn behind the thread's other strands
+                dispatcher.schedule (*this, workerIndex, true);
+            }
+            else
+            {
+                isQueued = false;
+            }
+        }
+
+        SerialPortFrameDispatcher& dispatcher;
+        FrameHandler handler;
+        const int homeWorker;
+        juce::CriticalSection queueLock;
+        std::vector<uint8_t> queuedFrames;   // each frame's size, then its data
+        std::vector<uint8_t> handlingFrames; // the batch being handled, swapped out so more can be queued meanwhile
+        bool isQueued { false };             // on a thread's queue, or running
+        bool isDeleted { false };
+        std::atomic<size_t> numFramesWaiting { 0 };
+        juce::WaitableEvent finishedRunning;
+    };
+
+private:
+    class Worker : public juce::Thread
+    {
+    public:
+        Worker (SerialPortFrameDispatcher& ownerToUse, int indexToUse)
+            : Thread ("SerialDispatchThread"), owner (ownerToUse), index (indexToUse)
+        {
+        }
+
+        void run () override
+        {
+            while (! threadShouldExit ())
+            {
+                if (auto* strand = owner.take (index))
+                {
+                    strand->handleQueuedFrames (index);
+                    continue;
+                }
+
+                // announced before the last look, so a strand scheduled meanwhile is either seen here or wakes us
+                isSleeping = true;
+                std::atomic_thread_fence (std::memory_order_seq_cst);
+                if (auto* strand = owner.take (index))
+                {
+                    isSleeping = false;
+                    strand->handleQueuedFrames (index);
+                    continue;
+                }
+                workAvailable.wait (100);
+                isSleeping = false;
+            }
+        }
+
+        SerialPortFrameDispatcher& owner;
+        const int index;
+        juce::CriticalSection lock; // guards strands
+        std::deque<Strand*> strands;
+        std::atomic<bool> isSleeping { false };
+        juce::WaitableEvent workAvailable;
+    };
+
+    // queues a strand on a thread, and makes sure a thread is awake to run it
+    void schedule (Strand& strand, int workerIndex, bool fromThatWorker)
+    {
+        auto& worker = *workers[static_cast<size_t> (workerIndex)];
+        size_t numWaiting;
+        {
+            const juce::ScopedLock l (worker.lock);
+            worker.strands.push_back (&strand);
+            numWaiting = worker.strands.size ();
+        }
+
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        if (worker.isSleeping)
+        {
+            worker.workAvailable.signal ();
+            return;
+        }
+        // the thread is busy, so another may as well take it. a thread rescheduling its own strand only needs
+        // help if it has others waiting too
+        if (fromThatWorker && numWaiting == 1)
+            return;
+        for (auto& otherWorker : workers)
+        {
+            if (otherWorker->isSleeping)
+            {
+                otherWorker->workAvailable.signal ();
+                return;
+            }
+        }
+    }
+
+    // the next strand for a thread to run: the oldest on its own queue, or else the newest on another's
+    Strand* take (int workerIndex)
+    {
+        const auto numWorkers = static_cast<int> (workers.size ());
+        for (auto offset = 0; offset < numWorkers; ++offset)
+        {
+            auto& worker = *workers[static_cast<size_t> ((workerIndex + offset) % numWorkers)];
+            const juce::ScopedLock l (worker.lock);
+            if (worker.strands.empty ())
+                continue;
+
+            Strand* strand;
+            if (offset == 0)
+            {
+                strand = worker.strands.front ();
+                worker.strands.pop_front ();
+            }
+            else
+            {
+                strand = worker.strands.back ();
+                worker.strands.pop_back ();
+            }
+            return strand;
+        }
+        return nullptr;
+    }
+
+    // takes a deleted strand off whichever queue it is on. false if it isn't on one, as a thread is running it
+    bool unschedule (Strand& strand)
+    {
+        for (auto& worker : workers)
+        {
+            const juce::ScopedLock l (worker->lock);
+            for (auto strandIterator = worker->strands.begin (); strandIterator != worker->strands.end (); ++strandIterator)
+            {
+                if (*strandIterator == &strand)
+                {
+                    worker->strands.erase (strandIterator);
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<int> nextHomeWorker { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE (SerialPortFrameDispatcher)
+};
+
+#endif //_SERIALPORT_DISPATCH_H_
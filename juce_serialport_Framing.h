@@ -0,0 +1,579 @@
+/*Framers, for splitting the received byte stream into packets
+
+Every framer works the same way. process () takes a chunk of received data, which can begin or end
+anywhere in a frame, and calls onFrame (const uint8_t* frame, size_t frameSize) for each frame it
+completes. A frame that is split across chunks is gathered in a buffer of MaxFrameSize bytes inside
+the framer until the rest of it arrives. Where a frame is entirely inside one chunk and needs no
+decoding it is handed over in place, without being copied. The frame data is only valid during the
+call to onFrame. Frames that are malformed, or too big for the framer, are dropped and counted by
+getNumErrors ().
+
+The protocol details are template parameters and the handler is a template argument of process (), so
+the compiler can specialise and inline the whole byte loop for each protocol. Runs of payload are
+copied in bulk rather than byte by byte wherever the protocol allows.
+
+Each framer also has a static encode (), which writes a complete frame into a caller supplied buffer
+of at least getMaxEncodedSize () bytes (eg. one from SerialPortOutputStream::prepareToWrite ()) and
+returns its size.
+
+	SerialPortSlipFramer<256> framer;
+	inputStream.readFrames (framer, [this] (const uint8_t* frame, size_t frameSize) { handlePacket (frame, frameSize); });
+*/
+
+#ifndef _SERIALPORT_FRAMING_H_
+#define _SERIALPORT_FRAMING_H_
+
+#include <array>
+
+//////////////////////////////////////////////////////////////////
+//buffer and error count shared by the framers
+template <size_t MaxFrameSize>
+class SerialPortFrameAssembler
+{
+public:
+    static constexpr size_t maxFrameSize = MaxFrameSize;
+
+    //frames dropped because they were malformed or too big, since the framer was created or reset ()
+    uint64_t getNumErrors () const { return numErrors; }
+
+protected:
+    //returns false, and drops the rest of the frame, if it doesn't fit
+    bool appendToFrame (const uint8_t* data, size_t numBytes)
+    {
+        if (discardingFrame)
+            return false;
+        if (numBytes > MaxFrameSize - frameSize)
+        {
+            dropFrame ();
+            return false;
+        }
+        memcpy (frame.data () + frameSize, data, numBytes);
+        frameSize += numBytes;
+        return true;
+    }
+
+    bool appendToFrame (uint8_t dataByte)
+    {
+        if (discardingFrame)
+            return false;
+        if (frameSize == MaxFrameSize)
+        {
+            dropFrame ();
+            return false;
+        }
+        frame[frameSize++] = dataByte;
+        return true;
+    }
+
+    //counts the frame in progress as an error, and ignores the rest of it until the next one starts
+    void dropFrame ()
+    {
+        if (! discardingFrame)
+            ++numErrors;
+        discardingFrame = true;
+    }
+
+    void startNewFrame ()
+    {
+        frameSize = 0;
+        discardingFrame = false;
+    }
+
+    std::array<uint8_t, MaxFrameSize> frame;
+    size_t frameSize { 0 };
+    bool discardingFrame { false };
+    uint64_t numErrors { 0 };
+};
+
+//////////////////////////////////////////////////////////////////
+/*Two start bytes, a command byte, a one byte payload length and the payload, as used by the example app:
+
+	'*' '~' command length payload...
+
+the frame passed to onFrame is the command byte followed by the payload. commands of NumCommands or above,
+and lengths above MaxPayloadSize, are treated as noise, and the search for the start bytes carries on from there
+*/
+template <uint8_t StartByte1, uint8_t StartByte2, size_t MaxPayloadSize, unsigned NumCommands = 256>
+class SerialPortStartBytesFramer : public SerialPortFrameAssembler<MaxPayloadSize + 1>
+{
+public:
+    static_assert (MaxPayloadSize <= 255, "the payload length is sent as a single byte");
+    static constexpr size_t headerSize = 4;
+
+    template <typename FrameHandler>
+    void process (const uint8_t* data, size_t numBytes, FrameHandler&& onFrame)
+    {
+        auto position = data;
+        const auto end = data + numBytes;
+        while (position < end)
+        {
+            switch (state)
+            {
+                case State::waitingForStartByte1:
+                {
+                    position = static_cast<const uint8_t*> (memchr (position, StartByte1, static_cast<size_t> (end - position)));
+                    if (position == nullptr)
+                        return;
+                    ++position;
+                    state = State::waitingForStartByte2;
+                }
+                break;
+                case State::waitingForStartByte2:
+                {
+                    // a mismatch isn't used up, as it may be the first start byte of the real frame
+                    if (*position == StartByte2)
+                    {
+                        ++position;
+                        state = State::waitingForCommand;
+                    }
+                    else
+                    {
+                        state = State::waitingForStartByte1;
+                    }
+                }
+                break;
+                case State::waitingForCommand:
+                {
+                    if (*position >= NumCommands)
+                    {
+                        ++this->numErrors;
+                        state = State::waitingForStartByte1;
+                        break;
+                    }
+                    this->startNewFrame ();
+                    this->appendToFrame (*position++);
+                    state = State::waitingForLength;
+                }
+                break;
+                case State::waitingForLength:
+                {
+                    if (*position > MaxPayloadSize)
+                    {
+                        ++this->numErrors;
+                        state = State::waitingForStartByte1;
+                        break;
+                    }
+                    payloadSize = *position++;
+                    state = State::waitingForPayload;
+                    completeFrameIfReady (onFrame);
+                }
+                break;
+                case State::waitingForPayload:
+                {
+                    const auto numBytesToCopy = juce::jmin (static_cast<size_t> (end - position), payloadSize + 1 - this->frameSize);
+                    this->appendToFrame (position, numBytesToCopy);
+                    position += numBytesToCopy;
+                    completeFrameIfReady (onFrame);
+                }
+                break;
+            }
+        }
+    }
+
+    void reset ()
+    {
+        state = State::waitingForStartByte1;
+        this->startNewFrame ();
+    }
+
+    static constexpr size_t getMaxEncodedSize (size_t payloadSize) { return headerSize + payloadSize; }
+
+    static size_t encode (uint8_t command, const uint8_t* payload, size_t payloadSize, uint8_t* dest)
+    {
+        jassert (command < NumCommands && payloadSize <= MaxPayloadSize);
+        dest[0] = StartByte1;
+        dest[1] = StartByte2;
+        dest[2] = command;
+        dest[3] = static_cast<uint8_t> (payloadSize);
+        if (payloadSize > 0)
+            memcpy (dest + headerSize, payload, payloadSize);
+        return headerSize + payloadSize;
+    }
+
+private:
+    enum class State { waitingForStartByte1, waitingForStartByte2, waitingForCommand, waitingForLength, waitingForPayload };
+
+    template <typename FrameHandler>
+    void completeFrameIfReady (FrameHandler& onFrame)
+    {
+        if (this->frameSize != payloadSize + 1)
+            return;
+        onFrame (this->frame.data (), this->frameSize);
+        state = State::waitingForStartByte1;
+    }
+
+    State state { State::waitingForStartByte1 };
+    size_t payloadSize { 0 };
+};
+
+//////////////////////////////////////////////////////////////////
+/*A 1, 2 or 4 byte length followed by that many bytes of payload. frames longer than MaxFrameSize are skipped over
+*/
+template <int LengthBytes, bool BigEndian, size_t MaxFrameSize>
+class SerialPortLengthPrefixedFramer : public SerialPortFrameAssembler<MaxFrameSize>
+{
+public:
+    static_assert (LengthBytes == 1 || LengthBytes == 2 || LengthBytes == 4, "the length must be 1, 2 or 4 bytes");
+
+    template <typename FrameHandler>
+    void process (const uint8_t* data, size_t numBytes, FrameHandler&& onFrame)
+    {
+        auto position = data;
+        const auto end = data + numBytes;
+        while (position < end)
+        {
+            if (numLengthBytesReceived < LengthBytes)
+            {
+                const auto lengthByte = static_cast<uint32_t> (*position++);
+                frameLength = BigEndian ? (frameLength << 8) | lengthByte : frameLength | (lengthByte << (8 * numLengthBytesReceived));
+                if (++numLengthBytesReceived < LengthBytes)
+                    continue;
+
+                this->startNewFrame ();
+                if (frameLength > MaxFrameSize)
+                    this->dropFrame ();
+                numPayloadBytesReceived = 0;
+                // a whole frame that is already here is passed on where it is
+                if (! this->discardingFrame && static_cast<size_t> (end - position) >= frameLength)
+                {
+                    onFrame (position, static_cast<size_t> (frameLength));
+                    position += frameLength;
+                    startNextLength ();
+                    continue;
+                }
+            }
+
+            const auto numBytesToTake = juce::jmin (static_cast<size_t> (end - position), static_cast<size_t> (frameLength - numPayloadBytesReceived));
+            this->appendToFrame (position, numBytesToTake);
+            position += numBytesToTake;
+            numPayloadBytesReceived += static_cast<uint32_t> (numBytesToTake);
+            if (numPayloadBytesReceived == frameLength)
+            {
+                if (! this->discardingFrame)
+                    onFrame (this->frame.data (), this->frameSize);
+                startNextLength ();
+            }
+        }
+    }
+
+    void reset ()
+    {
+        startNextLength ();
+        this->startNewFrame ();
+    }
+
+    static constexpr size_t getMaxEncodedSize (size_t payloadSize) { return LengthBytes + payloadSize; }
+
+    static size_t encode (const uint8_t* payload, size_t payloadSize, uint8_t* dest)
+    {
+        jassert (payloadSize <= MaxFrameSize && (LengthBytes == 4 || payloadSize < (size_t (1) << (8 * LengthBytes))));
+        for (auto byteIndex = 0; byteIndex < LengthBytes; ++byteIndex)
+        {
+            const auto shift = 8 * (BigEndian ? LengthBytes - 1 - byteIndex : byteIndex);
+            dest[byteIndex] = static_cast<uint8_t> (static_cast<uint64_t> (payloadSize) >> shift);
+        }
+        if (payloadSize > 0)
+            memcpy (dest + LengthBytes, payload, payloadSize);
+        return LengthBytes + payloadSize;
+    }
+
+private:
+    void startNextLength ()
+    {
+        numLengthBytesReceived = 0;
+        frameLength = 0;
+    }
+
+    int numLengthBytesReceived { 0 };
+    uint32_t frameLength { 0 };
+    uint32_t numPayloadBytesReceived { 0 };
+};
+
+//////////////////////////////////////////////////////////////////
+/*Consistent Overhead Byte Stuffing. the payload is encoded so that it contains no zeros, and each frame ends with a zero.
+empty frames (consecutive zeros) are ignored
+*/
+template <size_t MaxFrameSize>
+class SerialPortCobsFramer : public SerialPortFrameAssembler<MaxFrameSize>
+{
+public:
+    template <typename FrameHandler>
+    void process (const uint8_t* data, size_t numBytes, FrameHandler&& onFrame)
+    {
+        auto position = data;
+        const auto end = data + numBytes;
+        while (position < end)
+        {
+            if (*position == 0)
+            {
+                // the frame is only complete if its last block is
+                if (numBlockBytesLeft == 0 && ! this->discardingFrame && receivedAnything)
+                    onFrame (this->frame.data (), this->frameSize);
+                else if (numBlockBytesLeft != 0)
+                    this->dropFrame ();
+                ++position;
+                reset ();
+                continue;
+            }
+
+            receivedAnything = true;
+            if (numBlockBytesLeft == 0)
+            {
+                // the zero that ended the previous block is only added now that we know it wasn't the last one
+                if (zeroEndsBlock)
+                    this->appendToFrame (static_cast<uint8_t> (0));
+                numBlockBytesLeft = static_cast<size_t> (*position - 1);
+                zeroEndsBlock = *position != 0xff;
+                ++position;
+                continue;
+            }
+
+            // the rest of the block has no zeros in it, so runs up to the next zero can be taken in one go
+            const auto available = static_cast<size_t> (end - position);
+            const auto nextZero = static_cast<const uint8_t*> (memchr (position, 0, juce::jmin (available, numBlockBytesLeft)));
+            const auto numBytesToTake = nextZero != nullptr ? static_cast<size_t> (nextZero - position) : juce::jmin (available, numBlockBytesLeft);
+            this->appendToFrame (position, numBytesToTake);
+            position += numBytesToTake;
+            numBlockBytesLeft -= numBytesToTake;
+        }
+    }
+
+    void reset ()
+    {
+        numBlockBytesLeft = 0;
+        zeroEndsBlock = false;
+        receivedAnything = false;
+        this->startNewFrame ();
+    }
+
+    static constexpr size_t getMaxEncodedSize (size_t payloadSize) { return payloadSize + payloadSize / 254 + 2; }
+
+    //includes the terminating zero
+    static size_t encode (const uint8_t* payload, size_t payloadSize, uint8_t* dest)
+    {
+        auto codePosition = dest;
+        auto writePosition = dest + 1;
+        uint8_t code = 1;
+        for (size_t payloadIndex = 0; payloadIndex < payloadSize; ++payloadIndex)
+        {
+            if (payload[payloadIndex] != 0)
+            {
+                *writePosition++ = payload[payloadIndex];
+                ++code;
+            }
+            if (payload[payloadIndex] == 0 || code == 0xff)
+            {
+                *codePosition = code;
+                codePosition = writePosition++;
+                code = 1;
+            }
+        }
+        *codePosition = code;
+        *writePosition++ = 0;
+        return static_cast<size_t> (writePosition - dest);
+    }
+
+private:
+    size_t numBlockBytesLeft { 0 };
+    bool zeroEndsBlock { false };
+    bool receivedAnything { false };
+};
+
+//////////////////////////////////////////////////////////////////
+/*SLIP (RFC 1055). frames end with 0xC0, and 0xC0 and 0xDB in the payload are escaped. empty frames are ignored, so
+frames may also start with 0xC0 to flush any line noise
+*/
+template <size_t MaxFrameSize>
+class SerialPortSlipFramer : public SerialPortFrameAssembler<MaxFrameSize>
+{
+public:
+    static constexpr uint8_t endByte = 0xc0, escapeByte = 0xdb, escapedEndByte = 0xdc, escapedEscapeByte = 0xdd;
+
+    template <typename FrameHandler>
+    void process (const uint8_t* data, size_t numBytes, FrameHandler&& onFrame)
+    {
+        auto position = data;
+        const auto end = data + numBytes;
+        while (position < end)
+        {
+            if (escaping)
+            {
+                escaping = false;
+                if (*position == escapedEndByte || *position == escapedEscapeByte)
+                {
+                    this->appendToFrame (*position++ == escapedEndByte ? endByte : escapeByte);
+                    continue;
+                }
+                // anything else is a broken frame, and the byte is looked at as usual
+                this->dropFrame ();
+            }
+
+            if (*position == endByte)
+            {
+                if (this->frameSize > 0 && ! this->discardingFrame)
+                    onFrame (this->frame.data (), this->frameSize);
+                this->startNewFrame ();
+                ++position;
+                continue;
+            }
+            if (*position == escapeByte)
+            {
+                escaping = true;
+                ++position;
+                continue;
+            }
+
+            // take the run of ordinary bytes in one go
+            auto runEnd = position + 1;
+            while (runEnd < end && *runEnd != endByte && *runEnd != escapeByte)
+                ++runEnd;
+            this->appendToFrame (position, static_cast<size_t> (runEnd - position));
+            position = runEnd;
+        }
+    }
+
+    void reset ()
+    {
+        escaping = false;
+        this->startNewFrame ();
+    }
+
+    static constexpr size_t getMaxEncodedSize (size_t payloadSize) { return 2 * payloadSize + 2; }
+
+    //starts and ends with endByte
+    static size_t encode (const uint8_t* payload, size_t payloadSize, uint8_t* dest)
+    {
+        auto writePosition = dest;
+        *writePosition++ = endByte;
+        for (size_t payloadIndex = 0; payloadIndex < payloadSize; ++payloadIndex)
+        {
+            const auto dataByte = payload[payloadIndex];
+            if (dataByte == endByte || dataByte == escapeByte)
+            {
+                *writePosition++ = escapeByte;
+                *writePosition++ = dataByte == endByte ? escapedEndByte : escapedEscapeByte;
+            }
+            else
+            {
+                *writePosition++ = dataByte;
+            }
+        }
+        *writePosition++ = endByte;
+        return static_cast<size_t> (writePosition - dest);
+    }
+
+private:
+    bool escaping { false };
+};
+
+//////////////////////////////////////////////////////////////////
+/*Frames that end with a delimiter byte, which isn't included in the frame. empty frames are ignored, so eg. '\n'
+also copes with CRLF line endings if the '\r' is stripped by the handler
+*/
+template <uint8_t Delimiter, size_t MaxFrameSize>
+class SerialPortDelimiterFramer : public SerialPortFrameAssembler<MaxFrameSize>
+{
+public:
+    template <typename FrameHandler>
+    void process (const uint8_t* data, size_t numBytes, FrameHandler&& onFrame)
+    {
+        auto position = data;
+        const auto end = data + numBytes;
+        while (position < end)
+        {
+            const auto delimiter = static_cast<const uint8_t*> (memchr (position, Delimiter, static_cast<size_t> (end - position)));
+            if (delimiter == nullptr)
+            {
+                this->appendToFrame (position, static_cast<size_t> (end - position));
+                return;
+            }
+
+            const auto numBytesInFrame = static_cast<size_t> (delimiter - position);
+            if (this->frameSize == 0 && ! this->discardingFrame)
+            {
+                // the whole frame is in this chunk, so it is passed on where it is
+                if (numBytesInFrame > MaxFrameSize)
+                    ++this->numErrors;
+                else if (numBytesInFrame > 0)
+                    onFrame (position, numBytesInFrame);
+            }
+            else if (this->appendToFrame (position, numBytesInFrame))
+            {
+                onFrame (this->frame.data (), this->frameSize);
+            }
+            this->startNewFrame ();
+            position = delimiter + 1;
+        }
+    }
+
+    void reset () { this->startNewFrame (); }
+
+    static constexpr size_t getMaxEncodedSize (size_t payloadSize) { return payloadSize + 1; }
+
+    static size_t encode (const uint8_t* payload, size_t payloadSize, uint8_t* dest)
+    {
+        jassert (memchr (payload, Delimiter, payloadSize) == nullptr);
+        memcpy (dest, payload, payloadSize);
+        dest[payloadSize] = Delimiter;
+        return payloadSize + 1;
+    }
+};
+
+//////////////////////////////////////////////////////////////////
+/*Adds a checksum (see juce_serialport_Checksum.h) to the end of every frame of another framer. frames whose checksum
+doesn't match are dropped and counted by getNumChecksumErrors (), and the checksum is removed from the ones passed on.
+the wrapped framer's maximum frame or payload size must leave room for the checksum
+
+	SerialPortCheckedFramer<SerialPortCobsFramer<256>, SerialPortCrc16Modbus> framer;
+*/
+template <typename Framer, typename Checksum>
+class SerialPortCheckedFramer : public Framer
+{
+public:
+    static constexpr size_t checksumSize = Checksum::numBytes;
+
+    template <typename FrameHandler>
+    void process (const uint8_t* data, size_t numBytes, FrameHandler&& onFrame)
+    {
+        Framer::process (data, numBytes, [this, &onFrame] (const uint8_t* checkedFrame, size_t checkedFrameSize)
+        {
+            if (checkedFrameSize >= checksumSize
+                && Checksum::calculate (checkedFrame, checkedFrameSize - checksumSize) == Checksum::readValue (checkedFrame + checkedFrameSize - checksumSize))
+                onFrame (checkedFrame, checkedFrameSize - checksumSize);
+            else
+                ++numChecksumErrors;
+        });
+    }
+
+    uint64_t getNumChecksumErrors () const { return numChecksumErrors; }
+
+    static constexpr size_t getMaxEncodedSize (size_t payloadSize) { return Framer::getMaxEncodedSize (payloadSize + checksumSize); }
+
+    //for framers whose frame is just the payload
+    static size_t encode (const uint8_t* payload, size_t payloadSize, uint8_t* dest)
+    {
+        uint8_t checkedPayload[Framer::maxFrameSize];
+        jassert (payloadSize + checksumSize <= Framer::maxFrameSize);
+        memcpy (checkedPayload, payload, payloadSize);
+        Checksum::writeValue (Checksum::calculate (payload, payloadSize), checkedPayload + payloadSize);
+        return Framer::encode (checkedPayload, payloadSize + checksumSize, dest);
+    }
+
+    //for SerialPortStartBytesFramer, where the checksum covers the command byte as well as the payload
+    static size_t encode (uint8_t command, const uint8_t* payload, size_t payloadSize, uint8_t* dest)
+    {
+        uint8_t checkedPayload[Framer::maxFrameSize];
+        jassert (payloadSize + checksumSize < Framer::maxFrameSize);
+        memcpy (checkedPayload, payload, payloadSize);
+        Checksum checksum;
+        checksum.update (&command, 1);
+        checksum.update (payload, payloadSize);
+        Checksum::writeValue (checksum.getValue (), checkedPayload + payloadSize);
+        return Framer::encode (command, checkedPayload, payloadSize + checksumSize, dest);
+    }
+
+private:
+    uint64_t numChecksumErrors { 0 };
+};
+
+#endif //_SERIALPORT_FRAMING_H_
@@ -0,0 +1,1064 @@
+//linux_SerialPort.cpp
+//Serial Port classes in a Juce stylee
+//see SerialPort.h for details
+//
+// termios based implementation, derived from the OSX version
+//
+
+#include "../JuceLibraryCode/JuceHeader.h"
+
+#if JUCE_LINUX
+
+using namespace juce;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <linux/serial.h>
+#include "juce_serialport.h"
+
+namespace
+{
+    struct BaudRateMapping
+    {
+        uint32_t bps;
+        speed_t speed;
+    };
+
+    const BaudRateMapping baudRates[] =
+    {
+        { 50, B50 }, { 75, B75 }, { 110, B110 }, { 134, B134 }, { 150, B150 }, { 200, B200 }, { 300, B300 },
+        { 600, B600 }, { 1200, B1200 }, { 1800, B1800 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+        { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 },
+        { 460800, B460800 }, { 500000, B500000 }, { 576000, B576000 }, { 921600, B921600 }, { 1000000, B1000000 },
+        { 1152000, B1152000 }, { 1500000, B1500000 }, { 2000000, B2000000 }, { 2500000, B2500000 },
+        { 3000000, B3000000 }, { 3500000, B3500000 }, { 4000000, B4000000 }
+    };
+
+    bool bpsToSpeed (uint32_t bps, speed_t& speed)
+    {
+        for (const auto& baudRate : baudRates)
+        {
+            if (baudRate.bps == bps)
+            {
+                speed = baudRate.speed;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t speedToBps (speed_t speed)
+    {
+        for (const auto& baudRate : baudRates)
+            if (baudRate.speed == speed)
+                return baudRate.bps;
+        return 0;
+    }
+
+    // the eventfds here are all non blocking. an eventfd adds up what is written to it, so a write that fails with EAGAIN
+    // (the count is full) still leaves it signalled
+    void signalEventDescriptor (int descriptor)
+    {
+        const uint64_t numWakes = 1;
+        while (::write (descriptor, &numWakes, sizeof (numWakes)) == -1 && errno == EINTR)
+        {
+        }
+    }
+
+    // reads until there is nothing left (EAGAIN), or the descriptor is bad
+    void clearEventDescriptor (int descriptor)
+    {
+        uint64_t numWakes;
+        while (::read (descriptor, &numWakes, sizeof (numWakes)) != -1 || errno == EINTR)
+        {
+        }
+    }
+
+    // the legacy 8250 driver registers a tty for every possible uart, whether or not the hardware is there
+    bool isRealSerial8250Port (const String& devicePath)
+    {
+        const auto fd = ::open (devicePath.getCharPointer (), O_RDWR | O_NOCTTY | O_NONBLOCK);
+        if (fd == -1)
+            return false;
+
+        struct serial_struct serialInfo;
+        const auto isReal = ioctl (fd, TIOCGSERIAL, &serialInfo) == 0 && serialInfo.type != PORT_UNKNOWN;
+        ::close (fd);
+        return isReal;
+    }
+
+    String readAttribute (const File& folder, const char* attributeName)
+    {
+        return folder.getChildFile (attributeName).loadFileAsString ().trim ();
+    }
+
+    // the device folder is a link into /sys/devices. for a USB port, the folders above it are the USB interface (with
+    // bInterfaceNumber) and then the USB device (with idVendor etc), whose names are where they are plugged in, eg. 1-1.4:1.0
+    void addDeviceDetails (const File& deviceFolder, SerialPortInfo& port)
+    {
+        char resolvedPath[PATH_MAX];
+        if (realpath (deviceFolder.getFullPathName ().toRawUTF8 (), resolvedPath) == nullptr)
+            return;
+
+        const File devicesFolder ("/sys/devices");
+        File folder (resolvedPath);
+        port.location = folder.getFileName ();
+        for (; folder.getFullPathName ().startsWith (devicesFolder.getFullPathName () + "/"); folder = folder.getParentDirectory ())
+        {
+            if (port.interfaceNumber < 0 && folder.getChildFile ("bInterfaceNumber").existsAsFile ())
+            {
+                port.interfaceNumber = readAttribute (folder, "bInterfaceNumber").getHexValue32 ();
+                port.location = folder.getFileName ();
+            }
+            if (folder.getChildFile ("idVendor").existsAsFile ())
+            {
+                port.vendorId = readAttribute (folder, "idVendor").getHexValue32 ();
+                port.productId = readAttribute (folder, "idProduct").getHexValue32 ();
+                port.serialNumber = readAttribute (folder, "serial");
+                port.manufacturer = readAttribute (folder, "manufacturer");
+                port.product = readAttribute (folder, "product");
+                if (port.interfaceNumber < 0)
+                    port.location = folder.getFileName ();
+                return;
+            }
+        }
+    }
+}
+
+StringPairArray SerialPort::getSerialPortPaths()
+{
+    StringPairArray SerialPortPaths;
+    for (const auto& port : getSerialPortInfo ())
+        SerialPortPaths.set (port.name, port.path);
+    return SerialPortPaths;
+}
+Array<SerialPortInfo> SerialPort::getSerialPortInfo ()
+{
+    Array<SerialPortInfo> ports;
+    const File ttyClassFolder ("/sys/class/tty");
+    for (const auto& ttyFolder : ttyClassFolder.findChildFiles (File::findFilesAndDirectories, false))
+    {
+        // virtual terminals, pseudo terminals, and the console have no backing device
+        const auto deviceFolder { ttyFolder.getChildFile ("device") };
+        if (! deviceFolder.exists ())
+            continue;
+
+        const auto ttyName { ttyFolder.getFileName () };
+        const auto devicePath { "/dev/" + ttyName };
+        if (! File (devicePath).exists ())
+            continue;
+
+        const auto driverName { deviceFolder.getChildFile ("driver").getLinkedTarget ().getFileName () };
+        if (driverName == "serial8250" && ! isRealSerial8250Port (devicePath))
+            continue;
+
+        SerialPortInfo port;
+        port.name = ttyName;
+        port.path = devicePath;
+        port.driver = driverName;
+        addDeviceDetails (deviceFolder, port);
+        ports.add (port);
+    }
+    return ports;
+}
+bool SerialPort::exists()
+{
+    return (-1 != portDescriptor);
+}
+void SerialPort::close()
+{
+    DebugLog ("SerialPort::close", "closing port:" + portPath);
+
+    if (-1 != portDescriptor)
+    {
+        // closing a descriptor doesn't wake a thread polling it, so the stream threads are woken to find it gone
+        const auto descriptor = portDescriptor;
+        portDescriptor = -1;
+        closedWakeup.signal ();
+        ::close (descriptor);
+    }
+}
+bool SerialPort::open(const String & newPortPath)
+{
+    portPath = newPortPath;
+    closedWakeup.reset ();
+    DebugLog ("SerialPort::open", "opening port:" + portPath);
+
+    struct termios options;
+    // the descriptor stays non-blocking, the stream threads use poll() to wait for data or space to write
+    portDescriptor = ::open (portPath.getCharPointer (), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (portDescriptor == -1)
+    {
+        DebugLog ("SerialPort::open", "open() failed, errno: " + String (errno));
+        return false;
+    }
+    // don't allow multiple opens
+    if (ioctl (portDescriptor, TIOCEXCL) == -1)
+    {
+        DebugLog ("SerialPort::open", "ioctl error, non critical");
+    }
+    // Get the current options
+    if (tcgetattr (portDescriptor, &options) == -1)
+    {
+        DebugLog ("SerialPort::open", "can't get port settings to set timeouts");
+        close ();
+        return false;
+    }
+    //non canonical, read returns whatever is available immediately
+    cfmakeraw (&options);
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    if (tcsetattr (portDescriptor, TCSANOW, &options) == -1)
+    {
+        DebugLog ("SerialPort::open", "can't set port settings (timeouts)");
+        close ();
+        return false;
+    }
+    counters.opened ();
+    reapplyDriverLatency ();
+    return true;
+}
+void SerialPort::cancel ()
+{
+    cancelOperations ();
+}
+
+bool SerialPort::setConfig(const SerialPortConfig & config)
+{
+    if (-1 == portDescriptor)
+        return false;
+    speed_t speed;
+    if (! bpsToSpeed (config.bps, speed))
+    {
+        DebugLog ("SerialPort::setConfig", "unsupported baud rate: " + String (config.bps));
+        return false;
+    }
+    struct termios options;
+    memset (&options, 0, sizeof (struct termios));
+    //non canonical, read returns whatever is available immediately
+    cfmakeraw (&options);
+    options.c_cc[VMIN] = 0;
+    options.c_cc[VTIME] = 0;
+    options.c_cflag |= CREAD; //enable receiver
+    options.c_cflag |= CLOCAL;//don't monitor modem control lines
+    //baud and bits
+    cfsetispeed (&options, speed);
+    cfsetospeed (&options, speed);
+    options.c_cflag &= ~CSIZE;
+    switch (config.databits)
+    {
+        case 5: options.c_cflag |= CS5; break;
+        case 6: options.c_cflag |= CS6; break;
+        case 7: options.c_cflag |= CS7; break;
+        case 8: options.c_cflag |= CS8; break;
+    }
+    //parity
+    switch (config.parity)
+    {
+        case SerialPortConfig::SERIALPORT_PARITY_ODD:
+            options.c_cflag |= PARENB;
+            options.c_cflag |= PARODD;
+            break;
+        case SerialPortConfig::SERIALPORT_PARITY_EVEN:
+            options.c_cflag |= PARENB;
+            break;
+        case SerialPortConfig::SERIALPORT_PARITY_MARK:
+            options.c_cflag |= PARENB;
+            options.c_cflag |= CMSPAR;
+            options.c_cflag |= PARODD;
+            break;
+        case SerialPortConfig::SERIALPORT_PARITY_SPACE:
+            options.c_cflag |= PARENB;
+            options.c_cflag |= CMSPAR;
+            break;
+        case SerialPortConfig::SERIALPORT_PARITY_NONE:
+        default:
+            break;
+    }
+    //stopbits
+    if (config.stopbits == SerialPortConfig::STOPBITS_1ANDHALF)
+    {
+        DebugLog ("SerialPort::setConfig", "STOPBITS_1ANDHALF not supported on Linux");
+        return false;//not supported
+    }
+    if (config.stopbits == SerialPortConfig::STOPBITS_2)
+        options.c_cflag |= CSTOPB;
+    //flow control
+    switch (config.flowcontrol)
+    {
+        case SerialPortConfig::FLOWCONTROL_XONXOFF:
+            options.c_iflag |= IXON;
+            options.c_iflag |= IXOFF;
+            break;
+        case SerialPortConfig::FLOWCONTROL_HARDWARE:
+            options.c_cflag |= CRTSCTS;
+            break;
+        case SerialPortConfig::FLOWCONTROL_NONE:
+        default:
+            break;
+    }
+    if (tcsetattr (portDescriptor, TCSANOW, &options) == -1)
+    {
+        DebugLog ("SerialPort::setConfig", "can't set port settings, errno: " + String (errno));
+        return false;
+    }
+    return true;
+}
+bool SerialPort::getConfig(SerialPortConfig & config)
+{
+    struct termios options;
+    if (-1 == portDescriptor)
+        return false;
+    if (tcgetattr (portDescriptor, &options) == -1)
+    {
+        DebugLog ("SerialPort::getConfig", "cannot get port settings");
+        return false;
+    }
+    config.bps = jmax (speedToBps (cfgetispeed (&options)), speedToBps (cfgetospeed (&options)));
+    switch (options.c_cflag & CSIZE)
+    {
+        case CS5: config.databits = 5; break;
+        case CS6: config.databits = 6; break;
+        case CS7: config.databits = 7; break;
+        case CS8: config.databits = 8; break;
+    }
+    config.parity = SerialPortConfig::SERIALPORT_PARITY_NONE;
+    if (options.c_cflag & PARENB)
+    {
+        if (options.c_cflag & CMSPAR)
+            config.parity = (options.c_cflag & PARODD) ? SerialPortConfig::SERIALPORT_PARITY_MARK : SerialPortConfig::SERIALPORT_PARITY_SPACE;
+        else if (options.c_cflag & PARODD)
+            config.parity = SerialPortConfig::SERIALPORT_PARITY_ODD;
+        else
+            config.parity = SerialPortConfig::SERIALPORT_PARITY_EVEN;
+    }
+    //stopbits
+    config.stopbits = SerialPortConfig::STOPBITS_1;
+    if (options.c_cflag & CSTOPB)
+        config.stopbits = SerialPortConfig::STOPBITS_2;
+    //flow control
+    config.flowcontrol = SerialPortConfig::FLOWCONTROL_NONE;
+    if ((options.c_iflag & IXON) || (options.c_iflag & IXOFF))
+        config.flowcontrol = SerialPortConfig::FLOWCONTROL_XONXOFF;
+    else if (options.c_cflag & CRTSCTS)
+        config.flowcontrol = SerialPortConfig::FLOWCONTROL_HARDWARE;
+
+    return true;
+}
+/////////////////////////////////
+// SerialPort transmit queue
+/////////////////////////////////
+size_t SerialPort::getNumBytesWaitingInDriver ()
+{
+    int bytesQueued = 0;
+    if (portDescriptor == -1 || ioctl (portDescriptor, TIOCOUTQ, &bytesQueued) == -1)
+        return 0;
+    return static_cast<size_t> (jmax (0, bytesQueued));
+}
+
+bool SerialPort::waitForDriverToSend (int timeoutMs)
+{
+    // tcdrain () can't be given a timeout, so it isn't called until TIOCOUTQ says the driver's queue is empty
+    const auto startTime = Time::getMillisecondCounter ();
+    int bytesQueued = 0;
+    while (portDescriptor != -1 && ioctl (portDescriptor, TIOCOUTQ, &bytesQueued) == 0 && bytesQueued > 0)
+    {
+        if (timeoutMs >= 0 && static_cast<int> (Time::getMillisecondCounter () - startTime) >= timeoutMs)
+            return false;
+        Thread::sleep (1);
+    }
+    // then it waits for the last character or two to leave the uart
+    return portDescriptor != -1 && tcdrain (portDescriptor) == 0;
+}
+
+/////////////////////////////////
+// SerialPort low latency profile
+/////////////////////////////////
+void SerialPort::applyDriverLatency (const SerialPortLatencyOptions& options, SerialPortLatencyReport& report)
+{
+    // VMIN and VTIME are always 0, and the reader waits in poll (), so reads already return whatever has arrived
+    report.immediateReads = true;
+
+    // ASYNC_LOW_LATENCY has the tty layer push received data to readers straight away, and some usb-serial drivers
+    // (eg. ftdi_sio on older kernels) turn their latency timer down for it too
+    struct serial_struct serialInfo;
+    if (ioctl (portDescriptor, TIOCGSERIAL, &serialInfo) == 0)
+    {
+        if (options.driverLowLatency)
+            serialInfo.flags |= ASYNC_LOW_LATENCY;
+        else
+            serialInfo.flags &= ~ASYNC_LOW_LATENCY;
+        if (ioctl (portDescriptor, TIOCSSERIAL, &serialInfo) == 0)
+            report.driverLowLatency = options.driverLowLatency;
+        else if (options.driverLowLatency)
+            report.notes.add ("the driver refused ASYNC_LOW_LATENCY, errno: " + String (errno));
+    }
+    else if (options.driverLowLatency)
+    {
+        report.notes.add ("the driver has no serial settings (TIOCGSERIAL) to set ASYNC_LOW_LATENCY in");
+    }
+
+    // usb-serial drivers with a latency timer (eg. ftdi_sio) have it in sysfs, next to the port. writing it takes root,
+    // or a udev rule. the port may have been opened through a link, eg. /dev/serial/by-id/..., so that is followed first
+    char resolvedPath[PATH_MAX];
+    const auto ttyName { File (realpath (portPath.toRawUTF8 (), resolvedPath) != nullptr ? String (resolvedPath) : portPath).getFileName () };
+    const auto deviceFolder { File ("/sys/class/tty").getChildFile (ttyName).getChildFile ("device") };
+    const auto latencyTimerPath { deviceFolder.getChildFile ("latency_timer").getFullPathName () };
+    if (File (latencyTimerPath).existsAsFile ())
+    {
+        if (options.usbLatencyTimerMs > 0)
+        {
+            const auto fd = ::open (latencyTimerPath.toRawUTF8 (), O_WRONLY | O_CLOEXEC);
+            const auto value = String (options.usbLatencyTimerMs);
+            const auto numBytes = static_cast<ssize_t> (value.getNumBytesAsUTF8 ());
+            if (fd == -1 || ::write (fd, value.toRawUTF8 (), static_cast<size_t> (numBytes)) != numBytes)
+                report.notes.add ("couldn't write " + latencyTimerPath + ", which needs root or a udev rule, errno: " + String (errno));
+            if (fd != -1)
+                ::close (fd);
+        }
+        const auto latencyTimer = readAttribute (deviceFolder, "latency_timer");
+        report.usbLatencyTimerMs = latencyTimer.isNotEmpty () ? latencyTimer.getIntValue () : -1;
+    }
+    else if (options.usbLatencyTimerMs > 0)
+    {
+        report.notes.add ("the port's driver has no latency timer");
+    }
+}
+
+bool SerialPort::pinCurrentThread (int cpu)
+{
+    if (cpu < 0 || cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t cpus;
+    CPU_ZERO (&cpus);
+    CPU_SET (cpu, &cpus);
+    return pthread_setaffinity_np (pthread_self (), sizeof (cpus), &cpus) == 0;
+}
+
+bool SerialPort::makeCurrentThreadRealtime ()
+{
+    // above ordinary threads, and below the kernel's threaded interrupt handlers (50), which deliver the data
+    struct sched_param schedulingParameters {};
+    schedulingParameters.sched_priority = 40;
+    return pthread_setschedparam (pthread_self (), SCHED_FIFO, &schedulingParameters) == 0;
+}
+
+/////////////////////////////////
+// SerialPortWakeup
+/////////////////////////////////
+SerialPortWakeup::SerialPortWakeup ()
+{
+    readDescriptor = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    writeDescriptor = readDescriptor;
+}
+
+SerialPortWakeup::~SerialPortWakeup ()
+{
+    if (readDescriptor != -1)
+        ::close (readDescriptor);
+}
+
+void SerialPortWakeup::signal ()
+{
+    signalEventDescriptor (writeDescriptor);
+}
+
+void SerialPortWakeup::reset ()
+{
+    clearEventDescriptor (readDescriptor);
+}
+
+/////////////////////////////////
+// SerialPortInputStream
+/////////////////////////////////
+void SerialPortInputStream::cancel ()
+{
+    wakeup.signal ();
+}
+
+void SerialPortInputStream::run()
+{
+    //port->DebugLog ("SerialPortInputStream::run", "starting thread");
+
+    unsigned char readBuffer[readBufferSize];
+    auto tunedGeneration = 0;
+    while (port != nullptr && port->portDescriptor != -1 && ! threadShouldExit ())
+    {
+        // picks up a low latency profile (see SerialPort::setLowLatency ())
+        port->tuneStreamThread (tunedGeneration, true);
+        // with OverflowPolicy::stopReading and a full receive buffer, the data is left with the driver until there is room
+        const auto bytesToRead = getNumBytesToRead (readBufferSize);
+        if (bytesToRead == 0)
+        {
+            waitForReceiveSpace ();
+            continue;
+        }
+
+        // cancel () and close () wake the poll straight away. otherwise it wakes up periodically, so that threadShouldExit ()
+        // is checked even when the line is idle, and in time to send any notification that is being held back by the notify policy
+        struct pollfd pollDescriptors[] { { port->portDescriptor, POLLIN, 0 },
+                                          { wakeup.getDescriptor (), POLLIN, 0 },
+                                          { port->closedWakeup.getDescriptor (), POLLIN, 0 } };
+        const auto pollResult = poll (pollDescriptors, 3, getNotificationTimeout (100));
+        if (pollResult == 0 || (pollResult == -1 && errno == EINTR))
+        {
+            updateNotifications ();
+            continue;
+        }
+        if (pollDescriptors[1].revents != 0 || pollDescriptors[2].revents != 0)
+        {
+            wakeup.reset ();
+            continue;
+        }
+        const auto& pollDescriptor = pollDescriptors[0];
+        if (pollResult == -1 || (pollDescriptor.revents & (POLLERR | POLLNVAL)))
+        {
+            port->DebugLog ("SerialPortInputStream::run", "poll() failed, errno: " + String (errno));
+            notifyError ("poll() failed, errno: " + String (errno));
+            port->close ();
+            break;
+        }
+
+        // read everything the driver has queued, up to the size of our buffer (or the room left in the receive buffer), in one go
+        if (! readFromDriver (readBuffer, bytesToRead))
+            break;
+    }
+
+    if (! threadShouldExit ())
+        notifyPortClosed ();
+
+    //port->DebugLog ("SerialPortInputStream::run", "stopping thread");
+}
+
+bool SerialPortInputStream::readFromDriver (uint8_t* readBuffer, size_t bytesToRead)
+{
+    const auto bytesread = ::read (port->portDescriptor, readBuffer, bytesToRead);
+    if (bytesread > 0)
+    {
+        addReceivedData (readBuffer, static_cast<size_t> (bytesread));
+    }
+    else if (bytesread == 0 || (errno != EAGAIN && errno != EINTR))
+    {
+        // the descriptor was reported readable, but there is nothing to read, the device has gone away
+        port->DebugLog ("SerialPortInputStream::readFromDriver", "::read() returned " + String (bytesread) + ", errno: " + String (errno));
+        notifyError ("::read() returned " + String (bytesread) + ", errno: " + String (errno));
+        port->close ();
+        return false;
+    }
+    return true;
+}
+
+int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
+{
+    if (port != nullptr && port->portDescriptor != -1)
+        return static_cast<int> (buffer.read (destBuffer, static_cast<size_t> (jmax (0, maxBytesToRead))));
+    else
+        return -1;
+}
+/////////////////////////////////
+// SerialPortOutputStream
+/////////////////////////////////
+void SerialPortOutputStream::cancel ()
+{
+    wakeup.signal ();
+    triggerWrite.signal ();
+}
+
+void SerialPortOutputStream::run()
+{
+    //port->DebugLog ("SerialPortOutputStream::run", "starting thread");
+
+    auto tunedGeneration = 0;
+    while (port != nullptr && port->portDescriptor != -1 && ! threadShouldExit ())
+    {
+        // picks up a low latency profile (see SerialPort::setLowLatency ())
+        port->tuneStreamThread (tunedGeneration, false);
+        if (buffer.getNumPending () == 0)
+        {
+            triggerWrite.wait (100);
+            // gathers more small writes before sending, if write coalescing is on (see setWriteCoalescing ())
+            waitToCoalesce ();
+        }
+
+        bool driverIsFull = false;
+        if (! writeToDriver (std::numeric_limits<size_t>::max (), driverIsFull))
+            break;
+        if (driverIsFull)
+        {
+            // the driver's output queue is full, wait until it can accept more, or until cancel () or close ()
+            struct pollfd pollDescriptors[] { { port->portDescriptor, POLLOUT, 0 },
+                                              { wakeup.getDescriptor (), POLLIN, 0 },
+                                              { port->closedWakeup.getDescriptor (), POLLIN, 0 } };
+            const auto blockedSince = Time::getHighResolutionTicks ();
+            if (poll (pollDescriptors, 3, 100) > 0 && pollDescriptors[1].revents != 0)
+                wakeup.reset ();
+            port->counters.blocked (blockedSince);
+        }
+    }
+    //port->DebugLog ("SerialPortOutputStream::run", "stopping thread");
+}
+
+bool SerialPortOutputStream::writeToDriver (size_t maxBytes, bool& driverIsFull)
+{
+    // hand the driver as much of the queue as it will take in one gather write
+    SerialPortTransmitQueue::Region regions[maxWriteRegions];
+    struct iovec writeVectors[maxWriteRegions];
+    const auto numRegions = buffer.getPendingRegions (regions, maxWriteRegions);
+    auto numVectors = 0;
+    for (size_t numBytes = 0; numVectors < numRegions && numBytes < maxBytes; ++numVectors)
+    {
+        const auto regionSize = jmin (regions[numVectors].size, maxBytes - numBytes);
+        writeVectors[numVectors] = { const_cast<uint8_t*> (regions[numVectors].data), regionSize };
+        numBytes += regionSize;
+    }
+    driverIsFull = false;
+    if (numVectors == 0)
+        return true;
+
+    const auto byteswritten = ::writev (port->portDescriptor, writeVectors, numVectors);
+    port->counters.sent (byteswritten > 0 ? static_cast<size_t> (byteswritten) : 0);
+    if (byteswritten > 0)
+    {
+        buffer.consume (static_cast<size_t> (byteswritten));
+        port->completeReadyOperations ();
+        signalFlushWaiters ();
+    }
+    else if (byteswritten == -1 && (errno == EAGAIN || errno == EINTR))
+    {
+        driverIsFull = true;
+    }
+    else
+    {
+        port->DebugLog ("SerialPortOutputStream::writeToDriver", "::writev() couldn't write anything, errno: " + String (errno));
+        port->counters.error ();
+        port->close ();
+        return false;
+    }
+    return true;
+}
+
+bool SerialPortOutputStream::write(const void *dataToWrite, size_t howManyBytes)
+{
+    if (port == nullptr || port->portDescriptor == -1)
+        return false;
+
+    buffer.append (dataToWrite, howManyBytes);
+    queuedData ();
+    return true;
+}
+
+bool SerialPortOutputStream::write (MemoryBlock&& dataToWrite, size_t howManyBytes, std::function<void (MemoryBlock&&)> onSent)
+{
+    if (port == nullptr || port->portDescriptor == -1)
+        return false;
+
+    buffer.append (std::move (dataToWrite), howManyBytes, std::move (onSent));
+    queuedData ();
+    return true;
+}
+
+uint8_t* SerialPortOutputStream::prepareToWrite (size_t maxBytes)
+{
+    return buffer.prepareToAppend (maxBytes);
+}
+
+void SerialPortOutputStream::finishedWrite (size_t numBytesWritten)
+{
+    buffer.finishedAppend (numBytesWritten);
+    queuedData ();
+}
+
+/////////////////////////////////
+// SerialPortReactor
+/////////////////////////////////
+// an epoll descriptor, and the thread that waits on it, servicing both streams of each port assigned to it
+class SerialPortReactor::PlatformWorker : public SerialPortReactor::Worker, private Thread
+{
+public:
+    PlatformWorker () : Thread ("SerialReactorThread")
+    {
+        epollDescriptor = epoll_create1 (EPOLL_CLOEXEC);
+        wakeDescriptor = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+        // the wake descriptor is the only one registered without a Registration
+        struct epoll_event wakeEvent {};
+        wakeEvent.events = EPOLLIN;
+        wakeEvent.data.ptr = nullptr;
+        if (isValid () && epoll_ctl (epollDescriptor, EPOLL_CTL_ADD, wakeDescriptor, &wakeEvent) == 0)
+            startThread ();
+    }
+
+    ~PlatformWorker () override
+    {
+        signalThreadShouldExit ();
+        wake ();
+        waitForThreadToExit (5000);
+        if (wakeDescriptor != -1)
+            ::close (wakeDescriptor);
+        if (epollDescriptor != -1)
+            ::close (epollDescriptor);
+    }
+
+    bool isValid () const override { return epollDescriptor != -1 && wakeDescriptor != -1; }
+
+    void wake () override
+    {
+        signalEventDescriptor (wakeDescriptor);
+    }
+
+    bool attach (SerialPort* port, SerialPortInputStream* input, SerialPortOutputStream* output) override
+    {
+        const ScopedLock l (lock);
+        auto* registration = findRegistration (port);
+        if (registration == nullptr)
+        {
+            registration = new Registration ();
+            registration->port = port;
+            registration->descriptor = port->portDescriptor;
+            struct epoll_event event {};
+            event.data.ptr = registration;
+            if (registration->descriptor != -1 && epoll_ctl (epollDescriptor, EPOLL_CTL_ADD, registration->descriptor, &event) == -1)
+            {
+                port->DebugLog ("SerialPortReactor::attach", "epoll_ctl() failed, errno: " + String (errno));
+                delete registration;
+                return false;
+            }
+            registrations.add (registration);
+        }
+
+        if (input != nullptr)
+            registration->input = input;
+        if (output != nullptr)
+            registration->output = output;
+        updateEvents (*registration);
+        // the new stream gets its first look on the thread's next pass
+        wake ();
+        return true;
+    }
+
+    void detach (SerialPortInputStream* input, SerialPortOutputStream* output) override
+    {
+        // once the lock is held the thread is between passes, or this is the thread itself, so it is done with the stream.
+        // the registration stays until the end of the pass, as the events being handled may still refer to it
+        const ScopedLock l (lock);
+        for (auto registrationIndex = 0; registrationIndex < registrations.size (); ++registrationIndex)
+        {
+            auto& registration = *registrations[registrationIndex];
+            if (input != nullptr && registration.input == input)
+                registration.input = nullptr;
+            else if (output != nullptr && registration.output == output)
+                registration.output = nullptr;
+            else
+                continue;
+
+            if (registration.input == nullptr && registration.output == nullptr)
+                stop (registration);
+            else
+                updateEvents (registration);
+        }
+    }
+
+private:
+    struct Registration
+    {
+        SerialPort* port { nullptr };
+        int descriptor { -1 };
+        SerialPortInputStream* input { nullptr };
+        SerialPortOutputStream* output { nullptr };
+        uint32_t events { 0 };                  // what the descriptor is registered with epoll for
+        bool stopped { false };                 // the port has closed, or both streams have gone
+        bool waitingForReceiveSpace { false };  // OverflowPolicy::stopReading, with the receive buffer full
+        bool writeBlocked { false };            // waiting for the driver to have room for more data to send
+        int64 blockedSince { 0 };
+    };
+
+    void run () override
+    {
+        uint8_t readBuffer[SerialPortInputStream::readBufferSize];
+        struct epoll_event events[maxEventsAtOnce];
+        auto timeoutMs = 0;
+        while (! threadShouldExit ())
+        {
+            const auto numEvents = epoll_wait (epollDescriptor, events, maxEventsAtOnce, timeoutMs);
+
+            const ScopedLock l (lock);
+            for (auto eventIndex = 0; eventIndex < numEvents; ++eventIndex)
+            {
+                auto* registration = static_cast<Registration*> (events[eventIndex].data.ptr);
+                if (registration != nullptr)
+                {
+                    service (*registration, events[eventIndex].events, readBuffer);
+                }
+                else
+                {
+                    clearEventDescriptor (wakeDescriptor);
+                }
+            }
+
+            // everything that isn't signalled by the descriptors: writes that have been asked for, ports closed by
+            // other threads, receive space for OverflowPolicy::stopReading, and notifications that are being held back
+            timeoutMs = idleTimeoutMs;
+            for (auto registrationIndex = registrations.size (); --registrationIndex >= 0;)
+            {
+                auto& registration = *registrations[registrationIndex];
+                if (registration.input == nullptr && registration.output == nullptr)
+                {
+                    registrations.remove (registrationIndex);
+                    continue;
+                }
+                if (registration.stopped)
+                    continue;
+                if (registration.descriptor == -1 || registration.port->portDescriptor != registration.descriptor)
+                {
+                    stop (registration);
+                    continue;
+                }
+
+                if (registration.output != nullptr && registration.output->writeRequested.exchange (false) && ! registration.writeBlocked)
+                    send (registration);
+
+                if (auto* input = registration.input)
+                {
+                    if (registration.waitingForReceiveSpace)
+                    {
+                        if (input->getNumBytesToRead (SerialPortInputStream::readBufferSize) > 0)
+                        {
+                            registration.waitingForReceiveSpace = false;
+                            updateEvents (registration);
+                        }
+                        else
+                        {
+                            timeoutMs = jmin (timeoutMs, SerialPortInputStream::receiveSpacePollMs);
+                        }
+                    }
+                    input->updateNotifications ();
+                    timeoutMs = input->getNotificationTimeout (timeoutMs);
+                }
+            }
+        }
+    }
+
+    void service (Registration& registration, uint32_t events, uint8_t* readBuffer)
+    {
+        if (registration.stopped)
+            return;
+
+        if ((events & EPOLLERR) != 0)
+        {
+            fail (registration, "epoll_wait() reported an error");
+            return;
+        }
+        if ((events & (EPOLLIN | EPOLLHUP)) != 0)
+        {
+            // a hang up is read like data, so the read reports why. without anything to read it with, the port is done with
+            if (registration.input == nullptr || registration.waitingForReceiveSpace)
+            {
+                fail (registration, "the device hung up");
+                return;
+            }
+            receive (registration, readBuffer);
+        }
+        if ((events & EPOLLOUT) != 0 && ! registration.stopped && registration.output != nullptr)
+        {
+            registration.port->counters.blocked (registration.blockedSince);
+            registration.writeBlocked = false;
+            send (registration);
+        }
+    }
+
+    void receive (Registration& registration, uint8_t* readBuffer)
+    {
+        // with OverflowPolicy::stopReading and a full receive buffer, the data is left with the driver until there is room
+        const auto bytesToRead = registration.input->getNumBytesToRead (SerialPortInputStream::readBufferSize);
+        if (bytesToRead == 0)
+        {
+            registration.waitingForReceiveSpace = true;
+            updateEvents (registration);
+            return;
+        }
+
+        if (! registration.input->readFromDriver (readBuffer, bytesToRead))
+            stop (registration);
+    }
+
+    void send (Registration& registration)
+    {
+        auto* output = registration.output;
+        while (output->buffer.getNumPending () > 0)
+        {
+            auto driverIsFull = false;
+            if (! output->writeToDriver (std::numeric_limits<size_t>::max (), driverIsFull))
+            {
+                stop (registration);
+                return;
+            }
+            if (driverIsFull)
+            {
+                registration.writeBlocked = true;
+                registration.blockedSince = Time::getHighResolutionTicks ();
+                break;
+            }
+        }
+        updateEvents (registration);
+    }
+
+    void fail (Registration& registration, const String& errorMessage)
+    {
+        registration.port->DebugLog ("SerialPortReactor", errorMessage);
+        if (registration.input != nullptr)
+            registration.input->notifyError (errorMessage);
+        else
+            registration.port->counters.error ();
+        registration.port->close ();
+        stop (registration);
+    }
+
+    void stop (Registration& registration)
+    {
+        if (registration.stopped)
+            return;
+        registration.stopped = true;
+
+        // closing the port has taken it out of the epoll set already, and its descriptor may belong to another port by now
+        if (registration.descriptor != -1 && registration.port->portDescriptor == registration.descriptor)
+            epoll_ctl (epollDescriptor, EPOLL_CTL_DEL, registration.descriptor, nullptr);
+        if (registration.input != nullptr)
+            registration.input->notifyPortClosed ();
+    }
+
+    void updateEvents (Registration& registration)
+    {
+        if (registration.stopped || registration.descriptor == -1)
+            return;
+
+        uint32_t wantedEvents = 0;
+        if (registration.input != nullptr && ! registration.waitingForReceiveSpace)
+            wantedEvents |= EPOLLIN;
+        if (registration.output != nullptr && registration.writeBlocked)
+            wantedEvents |= EPOLLOUT;
+        if (wantedEvents == registration.events)
+            return;
+
+        struct epoll_event event {};
+        event.events = wantedEvents;
+        event.data.ptr = &registration;
+        epoll_ctl (epollDescriptor, EPOLL_CTL_MOD, registration.descriptor, &event);
+        registration.events = wantedEvents;
+    }
+
+    Registration* findRegistration (SerialPort* port)
+    {
+        for (auto* registration : registrations)
+            if (registration->port == port && ! registration->stopped)
+                return registration;
+        return nullptr;
+    }
+
+    static const int maxEventsAtOnce = 64;
+    // the longest the thread sleeps, so ports closed by other threads are noticed, as with the streams' own threads
+    static const int idleTimeoutMs = 100;
+
+    int epollDescriptor { -1 };
+    int wakeDescriptor { -1 };
+    CriticalSection lock; // guards the registrations, and is held by the thread for each pass over its events
+    OwnedArray<Registration> registrations;
+};
+
+std::unique_ptr<SerialPortReactor::Worker> SerialPortReactor::createWorker ()
+{
+    return std::make_unique<PlatformWorker> ();
+}
+
+/////////////////////////////////
+// SerialPortWatcher
+/////////////////////////////////
+// inotify on /dev, where the kernel (devtmpfs) adds and removes a node for every tty that comes and goes, whether or
+// not udev is running. only /dev itself is watched, so pseudo terminals coming and going under /dev/pts are left out
+class SerialPortWatcher::PlatformDeviceEvents : public SerialPortWatcher::DeviceEvents
+{
+public:
+    PlatformDeviceEvents ()
+    {
+        wakeDescriptor = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+        inotifyDescriptor = inotify_init1 (IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyDescriptor != -1 && inotify_add_watch (inotifyDescriptor, "/dev", IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO) == -1)
+        {
+            ::close (inotifyDescriptor);
+            inotifyDescriptor = -1;
+        }
+    }
+
+    ~PlatformDeviceEvents () override
+    {
+        if (inotifyDescriptor != -1)
+            ::close (inotifyDescriptor);
+        if (wakeDescriptor != -1)
+            ::close (wakeDescriptor);
+    }
+
+    bool isValid () const override { return inotifyDescriptor != -1 && wakeDescriptor != -1; }
+
+    // true if a device node was added or removed. without inotify (poll () skips a descriptor of -1) this only waits
+    bool wait (int timeoutMs) override
+    {
+        struct pollfd descriptors[2] = { { inotifyDescriptor, POLLIN, 0 }, { wakeDescriptor, POLLIN, 0 } };
+        if (poll (descriptors, 2, timeoutMs) <= 0)
+            return false;
+
+        if (descriptors[1].revents != 0)
+        {
+            clearEventDescriptor (wakeDescriptor);
+            return false;
+        }
+        return descriptors[0].revents != 0 && readEvents ();
+    }
+
+    void wake () override
+    {
+        signalEventDescriptor (wakeDescriptor);
+    }
+
+private:
+    bool readEvents ()
+    {
+        auto nodesChanged = false;
+        alignas (struct inotify_event) char events[4096];
+        for (;;)
+        {
+            const auto numBytesRead = ::read (inotifyDescriptor, events, sizeof (events));
+            if (numBytesRead <= 0)
+                break;
+            for (auto eventOffset = 0; eventOffset < numBytesRead;)
+            {
+                const auto* event = reinterpret_cast<const struct inotify_event*> (events + eventOffset);
+                // directories (eg. /dev/serial, made by udev) come with the nodes they point to anyway
+                if ((event->mask & IN_ISDIR) == 0 || (event->mask & IN_Q_OVERFLOW) != 0)
+                    nodesChanged = true;
+                eventOffset += static_cast<int> (sizeof (struct inotify_event) + event->len);
+            }
+        }
+        return nodesChanged;
+    }
+
+    int inotifyDescriptor { -1 };
+    int wakeDescriptor { -1 };
+};
+
+std::unique_ptr<SerialPortWatcher::DeviceEvents> SerialPortWatcher::createDeviceEvents ()
+{
+    return std::make_unique<PlatformDeviceEvents> ();
+}
+
+#endif // JUCE_LINUX
@@ -14,7 +14,9 @@ using namespace juce;
 #define Point DUMMY_Point
 #define Component DUMMY_Component
 #include <stdio.h>
+#include <sys/event.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <termios.h>
 #include <IOKit/serial/IOSerialKeys.h>
@@ -22,53 +24,109 @@ using namespace juce;
 #include <IOKit/IOBSD.h>
 #include <IOKit/storage/IOCDTypes.h>
 #include <IOKit/serial/ioss.h>
+#include <dispatch/dispatch.h>
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
 #undef Point
 #undef Component
 #include "juce_serialport.h"
 
+namespace
+{
+    // looks in the service itself, or else in the nearest of its parents that has it, eg. the USB device for idVendor
+    CFTypeRef copyProperty (io_object_t service, const char* key, bool searchParents)
+    {
+        const auto keyAsCFString = CFStringCreateWithCString (kCFAllocatorDefault, key, kCFStringEncodingUTF8);
+        const auto property = searchParents
+            ? IORegistryEntrySearchCFProperty (service, kIOServicePlane, keyAsCFString, kCFAllocatorDefault, kIORegistryIterateRecursively | kIORegistryIterateParents)
+            : IORegistryEntryCreateCFProperty (service, keyAsCFString, kCFAllocatorDefault, 0);
+        CFRelease (keyAsCFString);
+        return property;
+    }
+
+    String getStringProperty (io_object_t service, const char* key, bool searchParents)
+    {
+        String value;
+        if (const auto property = copyProperty (service, key, searchParents))
+        {
+            if (CFGetTypeID (property) == CFStringGetTypeID ())
+                value = String::fromCFString (static_cast<CFStringRef> (property));
+            CFRelease (property);
+        }
+        return value;
+    }
+
+    int getIntProperty (io_object_t service, const char* key)
+    {
+        SInt64 value = -1;
+        if (const auto property = copyProperty (service, key, true))
+        {
+            if (CFGetTypeID (property) != CFNumberGetTypeID () || ! CFNumberGetValue (static_cast<CFNumberRef> (property), kCFNumberSInt64Type, &value))
+                value = -1;
+            CFRelease (property);
+        }
+        return static_cast<int> (value);
+    }
+}
+
 StringPairArray SerialPort::getSerialPortPaths()
 {
-	StringPairArray SerialPortPaths;
-	io_iterator_t matchingServices;
-	mach_port_t         masterPort;
-    CFMutableDictionaryRef  classesToMatch;
-	io_object_t     modemService;
-	char deviceFilePath[512];
-	char deviceFriendly[1024];
-    if (KERN_SUCCESS != IOMasterPort(MACH_PORT_NULL, &masterPort))
+    StringPairArray SerialPortPaths;
+    for (const auto& port : getSerialPortInfo ())
+        SerialPortPaths.set (port.name, port.path);
+    return SerialPortPaths;
+}
+Array<SerialPortInfo> SerialPort::getSerialPortInfo ()
+{
+    Array<SerialPortInfo> ports;
+    const auto classesToMatch = IOServiceMatching (kIOSerialBSDServiceValue);
+    if (classesToMatch == nullptr)
     {
-        DBG ("SerialPort::getSerialPortPaths : IOMasterPort failed");
-		return SerialPortPaths;
+        DBG ("SerialPort::getSerialPortInfo : IOServiceMatching failed");
+        return ports;
     }
-    classesToMatch = IOServiceMatching(kIOSerialBSDServiceValue);
-    if (classesToMatch == NULL)
-	{
-        DBG ("SerialPort::getSerialPortPaths : IOServiceMatching failed");
-		return SerialPortPaths;
-	}
-	CFDictionarySetValue(classesToMatch, CFSTR(kIOSerialBSDTypeKey), CFSTR(kIOSerialBSDAllTypes));    
-	if (KERN_SUCCESS != IOServiceGetMatchingServices(masterPort, classesToMatch, &matchingServices))
-	{
-        DBG ("SerialPort::getSerialPortPaths : IOServiceGetMatchingServices failed");
-		return SerialPortPaths;
-	}
-	while ((modemService = IOIteratorNext(matchingServices)))
-	{
-		CFTypeRef   deviceFilePathAsCFString;
-		CFTypeRef   deviceFriendlyAsCFString;
-		deviceFilePathAsCFString = IORegistryEntryCreateCFProperty(modemService,CFSTR(kIODialinDeviceKey), kCFAllocatorDefault, 0);
-		deviceFriendlyAsCFString = IORegistryEntryCreateCFProperty(modemService,CFSTR(kIOTTYDeviceKey), kCFAllocatorDefault, 0);
-		if(deviceFilePathAsCFString)
-		{
-			if(CFStringGetCString((const __CFString*)deviceFilePathAsCFString, deviceFilePath, 512, kCFStringEncodingASCII)
-			&& CFStringGetCString((const __CFString*)deviceFriendlyAsCFString, deviceFriendly, 1024, kCFStringEncodingASCII) )
-				SerialPortPaths.set(deviceFriendly, deviceFilePath);
-			CFRelease(deviceFilePathAsCFString);
-			CFRelease(deviceFriendlyAsCFString);
-		}
-	}
-	IOObjectRelease(modemService);
-	return SerialPortPaths;
+    CFDictionarySetValue (classesToMatch, CFSTR (kIOSerialBSDTypeKey), CFSTR (kIOSerialBSDAllTypes));
+    io_iterator_t matchingServices;
+    if (KERN_SUCCESS != IOServiceGetMatchingServices (MACH_PORT_NULL, classesToMatch, &matchingServices))
+    {
+        DBG ("SerialPort::getSerialPortInfo : IOServiceGetMatchingServices failed");
+        return ports;
+    }
+    while (const auto modemService = IOIteratorNext (matchingServices))
+    {
+        SerialPortInfo port;
+        port.path = getStringProperty (modemService, kIODialinDeviceKey, false);
+        port.name = getStringProperty (modemService, kIOTTYDeviceKey, false);
+        if (port.path.isNotEmpty () && port.name.isNotEmpty ())
+        {
+            io_registry_entry_t driverService;
+            if (IORegistryEntryGetParentEntry (modemService, kIOServicePlane, &driverService) == KERN_SUCCESS)
+            {
+                io_name_t driverClass;
+                if (IOObjectGetClass (driverService, driverClass) == KERN_SUCCESS)
+                    port.driver = driverClass;
+                IOObjectRelease (driverService);
+            }
+            port.vendorId = getIntProperty (modemService, "idVendor");
+            if (port.isUsb ())
+            {
+                port.productId = getIntProperty (modemService, "idProduct");
+                port.serialNumber = getStringProperty (modemService, "USB Serial Number", true);
+                port.manufacturer = getStringProperty (modemService, "USB Vendor Name", true);
+                port.product = getStringProperty (modemService, "USB Product Name", true);
+                port.interfaceNumber = getIntProperty (modemService, "bInterfaceNumber");
+                const auto locationId = getIntProperty (modemService, "locationID");
+                if (locationId != -1)
+                    port.location = "0x" + String::toHexString (static_cast<uint32> (locationId)).paddedLeft ('0', 8);
+            }
+            ports.add (port);
+        }
+        IOObjectRelease (modemService);
+    }
+    IOObjectRelease (matchingServices);
+    return ports;
 }
 bool SerialPort::exists()
 {
@@ -80,15 +138,18 @@ void SerialPort::close()
 
 	if(-1 != portDescriptor)
 	{
-		//wait for garbage to go? nah...
-		//tcdrain(portDescriptor);
-		::close(portDescriptor);
+		//anything still to be sent is thrown away, SerialPortOutputStream::flush () waits for it to go first
+		// the stream threads are woken to find it gone, rather than at the end of their waits
+		const auto descriptor = portDescriptor;
 		portDescriptor = -1;
+		closedWakeup.signal ();
+		::close(descriptor);
 	}
 }
 bool SerialPort::open(const String & portPath)
 {
 	this->portPath = portPath;
+	closedWakeup.reset ();
     DebugLog ("SerialPort::open", "opening port:" + this->portPath);
 
     struct termios options;
@@ -103,13 +164,8 @@ bool SerialPort::open(const String & portPath)
     {
         DebugLog ("SerialPort::open", "ioctl error, non critical");
     }
-    // we want blocking io actually
-	if (fcntl(portDescriptor, F_SETFL, 0) == -1)
-    {
-        DebugLog ("SerialPort::open", "fcntl error");
-		close();
-        return false;
-    }
+	// the descriptor stays non-blocking, the stream threads wait in kevent () for data or space to write, so that
+	// they can be woken by cancel () and close () rather than being stuck in a blocking call
 	// Get the current options
     if (tcgetattr(portDescriptor, &options) == -1)
     {
@@ -117,20 +173,23 @@ bool SerialPort::open(const String & portPath)
 		close();
         return false;
     }
-	//non canocal, 0.5 second timeout, read returns as soon as any data is recieved
+	//non canocal, read returns whatever is available immediately
 	cfmakeraw(&options);
     options.c_cc[VMIN] = 0;
-    options.c_cc[VTIME] = 5;
+    options.c_cc[VTIME] = 0;
 	if (tcsetattr(portDescriptor, TCSANOW, &options) == -1)
     {
         DebugLog ("SerialPort::open", "can't set port settings (timeouts)");
 		close();
         return false;
     }
+	counters.opened ();
+	reapplyDriverLatency ();
 	return true;
 }
 void SerialPort::cancel ()
 {
+    cancelOperations ();
 }
 
 bool SerialPort::setConfig(const SerialPortConfig & config)
@@ -138,10 +197,10 @@ bool SerialPort::setConfig(const SerialPortConfig & config)
 	if(-1==portDescriptor)return false;
 	struct termios options;
 	memset(&options, 0, sizeof(struct termios));
-	//non canocal, 0.5 second timeout, read returns as soon as any data is recieved
+	//non canocal, read returns whatever is available immediately
 	cfmakeraw(&options);
     options.c_cc[VMIN] = 0;
-    options.c_cc[VTIME] = 5;
+    options.c_cc[VTIME] = 0;
 	options.c_cflag |= CREAD; //enable reciever (daft)
 	options.c_cflag |= CLOCAL;//don't monitor modem control lines
 	//baud and bits
@@ -207,7 +266,8 @@ bool SerialPort::setConfig(const SerialPortConfig & config)
         DebugLog ("SerialPort::setConfig", "can't set baud rate");
         return false;
     }
-    
+    // and the low latency settings on top of them
+    reapplyDriverLatency ();
 	return true;
 }
 bool SerialPort::getConfig(SerialPortConfig & config)
@@ -245,59 +305,279 @@ bool SerialPort::getConfig(SerialPortConfig & config)
 	
 	return true;
 }
+/////////////////////////////////
+// SerialPort transmit queue
+/////////////////////////////////
+size_t SerialPort::getNumBytesWaitingInDriver ()
+{
+    int bytesQueued = 0;
+    if (portDescriptor == -1 || ioctl (portDescriptor, TIOCOUTQ, &bytesQueued) == -1)
+        return 0;
+    return static_cast<size_t> (jmax (0, bytesQueued));
+}
+
+bool SerialPort::waitForDriverToSend (int timeoutMs)
+{
+    // tcdrain () can't be given a timeout, so it isn't called until TIOCOUTQ says the driver's queue is empty
+    const auto startTime = Time::getMillisecondCounter ();
+    int bytesQueued = 0;
+    while (portDescriptor != -1 && ioctl (portDescriptor, TIOCOUTQ, &bytesQueued) == 0 && bytesQueued > 0)
+    {
+        if (timeoutMs >= 0 && static_cast<int> (Time::getMillisecondCounter () - startTime) >= timeoutMs)
+            return false;
+        Thread::sleep (1);
+    }
+    // then it waits for the last character or two to leave the uart
+    return portDescriptor != -1 && tcdrain (portDescriptor) == 0;
+}
+
+/////////////////////////////////
+// SerialPort low latency profile
+/////////////////////////////////
+void SerialPort::applyDriverLatency (const SerialPortLatencyOptions& options, SerialPortLatencyReport& report)
+{
+    // VMIN and VTIME are always 0, and the reader waits in kevent (), so reads already return whatever has arrived
+    report.immediateReads = true;
+
+    // how long the driver holds on to received data before handing it up, in microseconds. the USB serial drivers
+    // (eg. AppleUSBFTDI) use it for their latency timer, which has no setting of its own on macOS
+    if (options.driverLowLatency)
+    {
+        unsigned long receiveLatencyMicroseconds = 1;
+        report.driverLowLatency = ioctl (portDescriptor, IOSSDATALAT, &receiveLatencyMicroseconds) != -1;
+        if (! report.driverLowLatency)
+            report.notes.add ("the driver refused IOSSDATALAT, errno: " + String (errno));
+    }
+    if (options.usbLatencyTimerMs > 0 && ! options.driverLowLatency)
+        report.notes.add ("USB latency timers follow driverLowLatency (IOSSDATALAT) on macOS");
+}
+
+bool SerialPort::pinCurrentThread (int)
+{
+    // macOS only has affinity hints (THREAD_AFFINITY_POLICY), and not on Apple silicon, so threads can't be pinned
+    return false;
+}
+
+bool SerialPort::makeCurrentThreadRealtime ()
+{
+    // a time constraint thread, which is run within a millisecond of becoming ready, as long as it uses little of it
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info (&timebase);
+    const auto millisecondsToAbsolute = [&timebase] (double milliseconds)
+    {
+        return static_cast<uint32_t> (milliseconds * 1.0e6 * timebase.denom / timebase.numer);
+    };
+    thread_time_constraint_policy_data_t policy;
+    policy.period = 0;
+    policy.computation = millisecondsToAbsolute (0.25);
+    policy.constraint = millisecondsToAbsolute (1.0);
+    policy.preemptible = true;
+    return thread_policy_set (pthread_mach_thread_np (pthread_self ()), THREAD_TIME_CONSTRAINT_POLICY,
+                              reinterpret_cast<thread_policy_t> (&policy), THREAD_TIME_CONSTRAINT_POLICY_COUNT) == KERN_SUCCESS;
+}
+
+/////////////////////////////////
+// SerialPortWakeup
+/////////////////////////////////
+SerialPortWakeup::SerialPortWakeup ()
+{
+    int pipeDescriptors[2];
+    if (pipe (pipeDescriptors) == -1)
+        return;
+    for (const auto descriptor : pipeDescriptors)
+    {
+        fcntl (descriptor, F_SETFL, O_NONBLOCK);
+        fcntl (descriptor, F_SETFD, FD_CLOEXEC);
+    }
+    readDescriptor = pipeDescriptors[0];
+    writeDescriptor = pipeDescriptors[1];
+}
+
+SerialPortWakeup::~SerialPortWakeup ()
+{
+    if (readDescriptor != -1)
+        ::close (readDescriptor);
+    if (writeDescriptor != -1)
+        ::close (writeDescriptor);
+}
+
+void SerialPortWakeup::signal ()
+{
+    // if the pipe is full it is signalled already
+    const char wake = 0;
+    ::write (writeDescriptor, &wake, 1);
+}
+
+void SerialPortWakeup::reset ()
+{
+    char wakes[64];
+    while (::read (readDescriptor, wakes, sizeof (wakes)) > 0)
+    {
+    }
+}
+
+namespace
+{
+    // what a stream thread waits on: the port, for data (EVFILT_READ) or space to write (EVFILT_WRITE), and the wakeups
+    // from cancel () and close (). a kqueue, as poll () doesn't support devices on macOS
+    class StreamEvents
+    {
+    public:
+        enum Result { ready, timedOut, woken, hungUp, failed };
+
+        StreamEvents (int16_t portFilterToUse, const SerialPortWakeup& streamWakeup, const SerialPortWakeup& closedWakeup)
+            : portFilter (portFilterToUse)
+        {
+            kqueueDescriptor = kqueue ();
+            if (kqueueDescriptor == -1)
+                return;
+            // the wakeups are told apart from the port by having udata set
+            for (const auto* wakeup : { &streamWakeup, &closedWakeup })
+            {
+                struct kevent change;
+                EV_SET (&change, wakeup->getDescriptor (), EVFILT_READ, EV_ADD, 0, 0, const_cast<SerialPortWakeup*> (wakeup));
+                if (wakeup->getDescriptor () != -1)
+                    kevent (kqueueDescriptor, &change, 1, nullptr, 0, nullptr);
+            }
+        }
+
+        ~StreamEvents ()
+        {
+            if (kqueueDescriptor != -1)
+                ::close (kqueueDescriptor);
+        }
+
+        Result wait (int portDescriptor, int timeoutMs)
+        {
+            if (kqueueDescriptor == -1)
+                return failed;
+            // closing a descriptor takes it out of the kqueue, so the port is added with each wait, in case it has been
+            // reopened. adding it again is only a change to its filter, made in the same call
+            struct kevent change;
+            EV_SET (&change, portDescriptor, portFilter, EV_ADD, 0, 0, nullptr);
+            const struct timespec timeout { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+            struct kevent events[3];
+            const auto numEvents = kevent (kqueueDescriptor, &change, 1, events, 3, &timeout);
+            if (numEvents == -1)
+                return errno == EINTR ? timedOut : failed;
+
+            auto result = timedOut;
+            for (auto eventIndex = 0; eventIndex < numEvents; ++eventIndex)
+            {
+                if (events[eventIndex].udata != nullptr)
+                    return woken;
+                if ((events[eventIndex].flags & EV_ERROR) != 0)
+                {
+                    errno = static_cast<int> (events[eventIndex].data);
+                    result = failed;
+                }
+                else if (result != failed)
+                {
+                    // at the end of the file there may be nothing to read, or no room to write, ever again
+                    result = (events[eventIndex].flags & EV_EOF) != 0 && events[eventIndex].data == 0 ? hungUp : ready;
+                }
+            }
+            return result;
+        }
+
+    private:
+        const int16_t portFilter;
+        int kqueueDescriptor { -1 };
+    };
+}
+
 /////////////////////////////////
 // SerialPortInputStream
 /////////////////////////////////
 void SerialPortInputStream::cancel ()
 {
+    wakeup.signal ();
 }
 
 void SerialPortInputStream::run()
 {
     //port->DebugLog ("SerialPortInputStream::run", "starting thread");
 
+    unsigned char readBuffer[readBufferSize];
+    StreamEvents events (EVFILT_READ, wakeup, port->closedWakeup);
+    auto tunedGeneration = 0;
     while (port != nullptr && port->portDescriptor != -1 && ! threadShouldExit ())
     {
-        unsigned char c;
-        //this call will block until we read 1 byte, or ::read() returns an error, caught below
-        const auto bytesread = ::read (port->portDescriptor, &c, 1);
-        if (bytesread == 1)
+        // picks up a low latency profile (see SerialPort::setLowLatency ())
+        port->tuneStreamThread (tunedGeneration, true);
+        // with OverflowPolicy::stopReading and a full receive buffer, the data is left with the driver until there is room
+        const auto bytesWithRoom = getNumBytesToRead (readBufferSize);
+        if (bytesWithRoom == 0)
         {
-            const ScopedLock l (bufferCriticalSection);
-
-            buffer.ensureSize (bufferedbytes + 1);
-            buffer[bufferedbytes] = c;
-            ++bufferedbytes;
+            waitForReceiveSpace ();
+            continue;
+        }
 
-            if (notify == NOTIFY_ALWAYS || (notify == NOTIFY_ON_CHAR && c == notifyChar))
-                sendChangeMessage();
+        // cancel () and close () wake the wait straight away. otherwise it wakes up periodically, so that threadShouldExit ()
+        // is checked even when the line is idle, and in time to send any notification that is being held back by the notify policy
+        const auto waitResult = events.wait (port->portDescriptor, getNotificationTimeout (100));
+        if (waitResult == StreamEvents::timedOut)
+        {
+            updateNotifications ();
+            continue;
         }
-        else if (bytesread == -1 && errno != EAGAIN)
+        if (waitResult == StreamEvents::woken)
         {
-            port->DebugLog ("SerialPortInputStream::run", "::read() returned " + String(bytesread) + ", errno: " + String (errno));
+            wakeup.reset ();
+            continue;
+        }
+        if (waitResult == StreamEvents::failed || waitResult == StreamEvents::hungUp)
+        {
+            const auto errorMessage = waitResult == StreamEvents::hungUp ? String ("the device hung up") : "kevent() failed, errno: " + String (errno);
+            port->DebugLog ("SerialPortInputStream::run", errorMessage);
+            notifyError (errorMessage);
             port->close ();
             break;
         }
+
+        // size the read to what the driver has queued, so a burst is drained in as few calls as possible
+        int bytesQueued = 0;
+        if (ioctl (port->portDescriptor, FIONREAD, &bytesQueued) == -1 || bytesQueued < 1)
+            bytesQueued = readBufferSize;
+        const auto bytesToRead = jmin (static_cast<size_t> (bytesQueued), bytesWithRoom);
+
+        if (! readFromDriver (readBuffer, bytesToRead))
+            break;
     }
 
+    if (! threadShouldExit ())
+        notifyPortClosed ();
+
     //port->DebugLog ("SerialPortInputStream::run", "stopping thread");
 }
 
-int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
+bool SerialPortInputStream::readFromDriver (uint8_t* readBuffer, size_t bytesToRead)
 {
-    if (port != nullptr && port->portDescriptor != -1)
+    //the descriptor is non-blocking, with VMIN=0/VTIME=0, so this call returns straight away with whatever is available
+    const auto bytesread = ::read (port->portDescriptor, readBuffer, bytesToRead);
+    if (bytesread > 0)
     {
-        const ScopedLock l (bufferCriticalSection);
-
-        if (maxBytesToRead > bufferedbytes)
-            maxBytesToRead = bufferedbytes;
-
-        memcpy (destBuffer, buffer.getData(), maxBytesToRead);
-        buffer.removeSection (0,maxBytesToRead);
-        bufferedbytes -= maxBytesToRead;
-
-        return maxBytesToRead;
+        addReceivedData (readBuffer, static_cast<size_t> (bytesread));
+    }
+    else if (bytesread == -1 && errno != EAGAIN)
+    {
+        port->DebugLog ("SerialPortInputStream::readFromDriver", "::read() returned " + String(bytesread) + ", errno: " + String (errno));
+        notifyError ("::read() returned " + String (bytesread) + ", errno: " + String (errno));
+        port->close ();
+        return false;
+    }
+    else
+    {
+        //nothing after all, so send anything the notify policy has been holding back
+        updateNotifications ();
     }
+    return true;
+}
+
+int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
+{
+    if (port != nullptr && port->portDescriptor != -1)
+        return static_cast<int> (buffer.read (destBuffer, static_cast<size_t> (jmax (0, maxBytesToRead))));
     else
         return -1;
 }
@@ -306,34 +586,44 @@ int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
 /////////////////////////////////
 void SerialPortOutputStream::cancel ()
 {
+    wakeup.signal ();
+    triggerWrite.signal ();
 }
 
 void SerialPortOutputStream::run()
 {
     //port->DebugLog ("SerialPortOutputStream::run", "starting thread");
 
-    unsigned char tempbuffer[writeBufferSize];
+    StreamEvents events (EVFILT_WRITE, wakeup, port->closedWakeup);
+    auto tunedGeneration = 0;
     while(port && (port->portDescriptor!=-1) && !threadShouldExit())
     {
-		// todo - there are two reads of 'bufferedbytes' which are outside of a mutex, should it be atomic at the minimum
-        if (! bufferedbytes)
+        // picks up a low latency profile (see SerialPort::setLowLatency ())
+        port->tuneStreamThread (tunedGeneration, false);
+        if (buffer.getNumPending () == 0)
+        {
             triggerWrite.wait(100);
-        if (bufferedbytes)
+            // gathers more small writes before sending, if write coalescing is on (see setWriteCoalescing ())
+            waitToCoalesce ();
+        }
+
+        bool driverIsFull = false;
+        if (! writeToDriver (std::numeric_limits<size_t>::max (), driverIsFull))
+            break;
+        if (driverIsFull)
         {
-            bufferCriticalSection.enter();
-            int bytestowrite = bufferedbytes > writeBufferSize ? writeBufferSize : bufferedbytes;
-            memcpy (tempbuffer, buffer.getData(), bytestowrite);
-            bufferCriticalSection.exit();
-            const auto byteswritten = ::write(port->portDescriptor, tempbuffer, bytestowrite);
-            if (byteswritten>0)
+            // the driver's output queue is full, wait until it can accept more, or until cancel () or close ()
+            const auto blockedSince = Time::getHighResolutionTicks ();
+            const auto waitResult = events.wait (port->portDescriptor, 100);
+            port->counters.blocked (blockedSince);
+            if (waitResult == StreamEvents::woken)
             {
-                const ScopedLock l(bufferCriticalSection);
-                buffer.removeSection(0, byteswritten);
-                bufferedbytes-=byteswritten;
+                wakeup.reset ();
             }
-            else
+            else if (waitResult == StreamEvents::failed || waitResult == StreamEvents::hungUp)
             {
-                port->DebugLog ("SerialPortOutputStream::run", "::write() couldn't write anything, errno: " + String (errno));
+                port->DebugLog ("SerialPortOutputStream::run", waitResult == StreamEvents::hungUp ? String ("the device hung up") : "kevent() failed, errno: " + String (errno));
+                port->counters.error ();
                 port->close ();
                 break;
             }
@@ -342,14 +632,459 @@ void SerialPortOutputStream::run()
     //port->DebugLog ("SerialPortOutputStream::run", "stopping thread");
 }
 
+bool SerialPortOutputStream::writeToDriver (size_t maxBytes, bool& driverIsFull)
+{
+    // hand the driver as much of the queue as it will take in one gather write
+    SerialPortTransmitQueue::Region regions[maxWriteRegions];
+    struct iovec writeVectors[maxWriteRegions];
+    const auto numRegions = buffer.getPendingRegions (regions, maxWriteRegions);
+    auto numVectors = 0;
+    for (size_t numBytes = 0; numVectors < numRegions && numBytes < maxBytes; ++numVectors)
+    {
+        const auto regionSize = jmin (regions[numVectors].size, maxBytes - numBytes);
+        writeVectors[numVectors] = { const_cast<uint8_t*> (regions[numVectors].data), regionSize };
+        numBytes += regionSize;
+    }
+    driverIsFull = false;
+    if (numVectors == 0)
+        return true;
+
+    const auto byteswritten = ::writev(port->portDescriptor, writeVectors, numVectors);
+    port->counters.sent (byteswritten > 0 ? static_cast<size_t> (byteswritten) : 0);
+    if (byteswritten>0)
+    {
+        buffer.consume (static_cast<size_t> (byteswritten));
+        port->completeReadyOperations ();
+        signalFlushWaiters ();
+    }
+    else if (byteswritten == -1 && (errno == EAGAIN || errno == EINTR))
+    {
+        driverIsFull = true;
+    }
+    else
+    {
+        port->DebugLog ("SerialPortOutputStream::writeToDriver", "::writev() couldn't write anything, errno: " + String (errno));
+        port->counters.error ();
+        port->close ();
+        return false;
+    }
+    return true;
+}
+
 bool SerialPortOutputStream::write(const void *dataToWrite, size_t howManyBytes)
 {
-	bufferCriticalSection.enter();
-    buffer.append(dataToWrite, howManyBytes);
-	bufferedbytes+=howManyBytes;
-	bufferCriticalSection.exit();
-	triggerWrite.signal();
+    buffer.append (dataToWrite, howManyBytes);
+	queuedData ();
 	return true;
 }
 
+bool SerialPortOutputStream::write (MemoryBlock&& dataToWrite, size_t howManyBytes, std::function<void (MemoryBlock&&)> onSent)
+{
+    if (port == nullptr || port->portDescriptor == -1)
+        return false;
+
+    buffer.append (std::move (dataToWrite), howManyBytes, std::move (onSent));
+    queuedData ();
+    return true;
+}
+
+uint8_t* SerialPortOutputStream::prepareToWrite (size_t maxBytes)
+{
+    return buffer.prepareToAppend (maxBytes);
+}
+
+void SerialPortOutputStream::finishedWrite (size_t numBytesWritten)
+{
+    buffer.finishedAppend (numBytesWritten);
+    queuedData ();
+}
+
+/////////////////////////////////
+// SerialPortReactor
+/////////////////////////////////
+// a kqueue, and the thread that waits on it, servicing both streams of each port assigned to it. the descriptors are
+// O_NONBLOCK with VMIN and VTIME at 0, so reads and writes return at once, and are sized to what kqueue reports
+class SerialPortReactor::PlatformWorker : public SerialPortReactor::Worker, private Thread
+{
+public:
+    PlatformWorker () : Thread ("SerialReactorThread")
+    {
+        kqueueDescriptor = kqueue ();
+        // the wake event is the only one without a Registration
+        struct kevent wakeEvent;
+        EV_SET (&wakeEvent, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, nullptr);
+        if (isValid () && kevent (kqueueDescriptor, &wakeEvent, 1, nullptr, 0, nullptr) == 0)
+            startThread ();
+    }
+
+    ~PlatformWorker () override
+    {
+        signalThreadShouldExit ();
+        wake ();
+        waitForThreadToExit (5000);
+        if (kqueueDescriptor != -1)
+            ::close (kqueueDescriptor);
+    }
+
+    bool isValid () const override { return kqueueDescriptor != -1; }
+
+    void wake () override
+    {
+        struct kevent wakeEvent;
+        EV_SET (&wakeEvent, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, nullptr);
+        kevent (kqueueDescriptor, &wakeEvent, 1, nullptr, 0, nullptr);
+    }
+
+    bool attach (SerialPort* port, SerialPortInputStream* input, SerialPortOutputStream* output) override
+    {
+        const ScopedLock l (lock);
+        auto* registration = findRegistration (port);
+        if (registration == nullptr)
+        {
+            registration = new Registration ();
+            registration->port = port;
+            registration->descriptor = port->portDescriptor;
+            struct kevent changes[2];
+            EV_SET (&changes[0], registration->descriptor, EVFILT_READ, EV_ADD | EV_DISABLE, 0, 0, registration);
+            EV_SET (&changes[1], registration->descriptor, EVFILT_WRITE, EV_ADD | EV_DISABLE, 0, 0, registration);
+            if (registration->descriptor != -1 && kevent (kqueueDescriptor, changes, 2, nullptr, 0, nullptr) == -1)
+            {
+                port->DebugLog ("SerialPortReactor::attach", "kevent() failed, errno: " + String (errno));
+                delete registration;
+                return false;
+            }
+            registrations.add (registration);
+        }
+
+        if (input != nullptr)
+            registration->input = input;
+        if (output != nullptr)
+            registration->output = output;
+        updateEvents (*registration);
+        // the new stream gets its first look on the thread's next pass
+        wake ();
+        return true;
+    }
+
+    void detach (SerialPortInputStream* input, SerialPortOutputStream* output) override
+    {
+        // once the lock is held the thread is between passes, or this is the thread itself, so it is done with the stream.
+        // the registration stays until the end of the pass, as the events being handled may still refer to it
+        const ScopedLock l (lock);
+        for (auto registrationIndex = 0; registrationIndex < registrations.size (); ++registrationIndex)
+        {
+            auto& registration = *registrations[registrationIndex];
+            if (input != nullptr && registration.input == input)
+                registration.input = nullptr;
+            else if (output != nullptr && registration.output == output)
+                registration.output = nullptr;
+            else
+                continue;
+
+            if (registration.input == nullptr && registration.output == nullptr)
+                stop (registration);
+            else
+                updateEvents (registration);
+        }
+    }
+
+private:
+    struct Registration
+    {
+        SerialPort* port { nullptr };
+        int descriptor { -1 };
+        SerialPortInputStream* input { nullptr };
+        SerialPortOutputStream* output { nullptr };
+        bool isReading { false };               // whether the read and write filters are enabled
+        bool isWriting { false };
+        bool stopped { false };                 // the port has closed, or both streams have gone
+        bool waitingForReceiveSpace { false };  // OverflowPolicy::stopReading, with the receive buffer full
+        bool writeBlocked { false };            // the driver has run out of room for data that is waiting to be sent
+        int64 blockedSince { 0 };
+    };
+
+    void run () override
+    {
+        uint8_t readBuffer[SerialPortInputStream::readBufferSize];
+        struct kevent events[maxEventsAtOnce];
+        auto timeoutMs = 0;
+        while (! threadShouldExit ())
+        {
+            const struct timespec timeout { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+            const auto numEvents = kevent (kqueueDescriptor, nullptr, 0, events, maxEventsAtOnce, &timeout);
+
+            const ScopedLock l (lock);
+            for (auto eventIndex = 0; eventIndex < numEvents; ++eventIndex)
+                if (auto* registration = static_cast<Registration*> (events[eventIndex].udata))
+                    service (*registration, events[eventIndex], readBuffer);
+
+            // everything that isn't signalled by the descriptors: writes that have been asked for, ports closed by
+            // other threads, receive space for OverflowPolicy::stopReading, and notifications that are being held back
+            timeoutMs = idleTimeoutMs;
+            for (auto registrationIndex = registrations.size (); --registrationIndex >= 0;)
+            {
+                auto& registration = *registrations[registrationIndex];
+                if (registration.input == nullptr && registration.output == nullptr)
+                {
+                    registrations.remove (registrationIndex);
+                    continue;
+                }
+                if (registration.stopped)
+                    continue;
+                if (registration.descriptor == -1 || registration.port->portDescriptor != registration.descriptor)
+                {
+                    stop (registration);
+                    continue;
+                }
+
+                // the write itself waits for the write filter, which says how much the driver has room for
+                if (registration.output != nullptr && registration.output->writeRequested.exchange (false))
+                    updateEvents (registration);
+
+                if (auto* input = registration.input)
+                {
+                    if (registration.waitingForReceiveSpace)
+                    {
+                        if (input->getNumBytesToRead (SerialPortInputStream::readBufferSize) > 0)
+                        {
+                            registration.waitingForReceiveSpace = false;
+                            updateEvents (registration);
+                        }
+                        else
+                        {
+                            timeoutMs = jmin (timeoutMs, SerialPortInputStream::receiveSpacePollMs);
+                        }
+                    }
+                    input->updateNotifications ();
+                    timeoutMs = input->getNotificationTimeout (timeoutMs);
+                }
+            }
+        }
+    }
+
+    void service (Registration& registration, const struct kevent& event, uint8_t* readBuffer)
+    {
+        if (registration.stopped)
+            return;
+
+        if ((event.flags & EV_ERROR) != 0)
+        {
+            fail (registration, "kevent() reported an error: " + String (static_cast<int> (event.data)));
+            return;
+        }
+        if (event.filter == EVFILT_READ && registration.input != nullptr && ! registration.waitingForReceiveSpace)
+        {
+            // data is the number of bytes waiting, so the read won't block. at the end of the file there may be none
+            if (event.data > 0)
+                receive (registration, readBuffer, static_cast<size_t> (event.data));
+            else if ((event.flags & EV_EOF) != 0)
+                fail (registration, "the device hung up");
+        }
+        if (event.filter == EVFILT_WRITE && registration.output != nullptr)
+        {
+            if ((event.flags & EV_EOF) != 0)
+            {
+                fail (registration, "the device hung up");
+                return;
+            }
+            if (registration.writeBlocked)
+                registration.port->counters.blocked (registration.blockedSince);
+            registration.writeBlocked = false;
+            // data is the room left in the driver's output queue
+            send (registration, static_cast<size_t> (jmax (static_cast<decltype (event.data)> (1), event.data)));
+        }
+    }
+
+    void receive (Registration& registration, uint8_t* readBuffer, size_t bytesWaiting)
+    {
+        // with OverflowPolicy::stopReading and a full receive buffer, the data is left with the driver until there is room
+        const auto bytesToRead = registration.input->getNumBytesToRead (jmin (bytesWaiting, static_cast<size_t> (SerialPortInputStream::readBufferSize)));
+        if (bytesToRead == 0)
+        {
+            registration.waitingForReceiveSpace = true;
+            updateEvents (registration);
+            return;
+        }
+
+        if (! registration.input->readFromDriver (readBuffer, bytesToRead))
+            stop (registration);
+    }
+
+    void send (Registration& registration, size_t maxBytes)
+    {
+        auto driverIsFull = false;
+        if (! registration.output->writeToDriver (maxBytes, driverIsFull))
+        {
+            stop (registration);
+            return;
+        }
+        // whatever didn't fit waits for the write filter to report room again
+        if (registration.output->buffer.getNumPending () > 0)
+        {
+            registration.writeBlocked = true;
+            registration.blockedSince = Time::getHighResolutionTicks ();
+        }
+        updateEvents (registration);
+    }
+
+    void fail (Registration& registration, const String& errorMessage)
+    {
+        registration.port->DebugLog ("SerialPortReactor", errorMessage);
+        if (registration.input != nullptr)
+            registration.input->notifyError (errorMessage);
+        else
+            registration.port->counters.error ();
+        registration.port->close ();
+        stop (registration);
+    }
+
+    void stop (Registration& registration)
+    {
+        if (registration.stopped)
+            return;
+        registration.stopped = true;
+
+        // closing the port has taken it out of the kqueue already, and its descriptor may belong to another port by now
+        if (registration.descriptor != -1 && registration.port->portDescriptor == registration.descriptor)
+        {
+            struct kevent changes[2];
+            EV_SET (&changes[0], registration.descriptor, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+            EV_SET (&changes[1], registration.descriptor, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+            kevent (kqueueDescriptor, changes, 2, nullptr, 0, nullptr);
+        }
+        if (registration.input != nullptr)
+            registration.input->notifyPortClosed ();
+    }
+
+    void updateEvents (Registration& registration)
+    {
+        if (registration.stopped || registration.descriptor == -1)
+            return;
+
+        const auto shouldRead = registration.input != nullptr && ! registration.waitingForReceiveSpace;
+        const auto shouldWrite = registration.output != nullptr && registration.output->buffer.getNumPending () > 0;
+        struct kevent changes[2];
+        auto numChanges = 0;
+        if (shouldRead != registration.isReading)
+            EV_SET (&changes[numChanges++], registration.descriptor, EVFILT_READ, shouldRead ? EV_ENABLE : EV_DISABLE, 0, 0, &registration);
+        if (shouldWrite != registration.isWriting)
+            EV_SET (&changes[numChanges++], registration.descriptor, EVFILT_WRITE, shouldWrite ? EV_ENABLE : EV_DISABLE, 0, 0, &registration);
+        if (numChanges == 0)
+            return;
+
+        kevent (kqueueDescriptor, changes, numChanges, nullptr, 0, nullptr);
+        registration.isReading = shouldRead;
+        registration.isWriting = shouldWrite;
+    }
+
+    Registration* findRegistration (SerialPort* port)
+    {
+        for (auto* registration : registrations)
+            if (registration->port == port && ! registration->stopped)
+                return registration;
+        return nullptr;
+    }
+
+    static const int maxEventsAtOnce = 64;
+    // the longest the thread sleeps, so ports closed by other threads are noticed, as with the streams' own threads
+    static const int idleTimeoutMs = 100;
+
+    int kqueueDescriptor { -1 };
+    CriticalSection lock; // guards the registrations, and is held by the thread for each pass over its events
+    OwnedArray<Registration> registrations;
+};
+
+std::unique_ptr<SerialPortReactor::Worker> SerialPortReactor::createWorker ()
+{
+    return std::make_unique<PlatformWorker> ();
+}
+
+/////////////////////////////////
+// SerialPortWatcher
+/////////////////////////////////
+// IOKit notifications for serial (BSD client) services being matched and terminated, delivered on a dispatch queue
+// of their own, which only marks the ports as changed and wakes the watcher's thread
+class SerialPortWatcher::PlatformDeviceEvents : public SerialPortWatcher::DeviceEvents
+{
+public:
+    PlatformDeviceEvents ()
+    {
+        notificationPort = IONotificationPortCreate (MACH_PORT_NULL);
+        if (notificationPort == nullptr)
+            return;
+        queue = dispatch_queue_create ("SerialPortWatcher", DISPATCH_QUEUE_SERIAL);
+        IONotificationPortSetDispatchQueue (notificationPort, queue);
+        valid = addNotification (kIOFirstMatchNotification, arrivedIterator)
+             && addNotification (kIOTerminatedNotification, departedIterator);
+    }
+
+    ~PlatformDeviceEvents () override
+    {
+        if (notificationPort != nullptr)
+            IONotificationPortDestroy (notificationPort);
+        if (queue != nullptr)
+        {
+            // lets a notification that is already being delivered finish before we go
+            dispatch_sync_f (queue, nullptr, [] (void*) {});
+            dispatch_release (queue);
+        }
+        if (arrivedIterator != 0)
+            IOObjectRelease (arrivedIterator);
+        if (departedIterator != 0)
+            IOObjectRelease (departedIterator);
+    }
+
+    bool isValid () const override { return valid; }
+
+    bool wait (int timeoutMs) override
+    {
+        woken.wait (timeoutMs);
+        return devicesChanged.exchange (false);
+    }
+
+    void wake () override { woken.signal (); }
+
+private:
+    bool addNotification (const io_name_t notificationType, io_iterator_t& iterator)
+    {
+        // the matching dictionary is released by IOServiceAddMatchingNotification ()
+        auto matchingDictionary = IOServiceMatching (kIOSerialBSDServiceValue);
+        if (matchingDictionary == nullptr)
+            return false;
+        CFDictionarySetValue (matchingDictionary, CFSTR (kIOSerialBSDTypeKey), CFSTR (kIOSerialBSDAllTypes));
+        if (IOServiceAddMatchingNotification (notificationPort, notificationType, matchingDictionary, servicesChanged, this, &iterator) != KERN_SUCCESS)
+            return false;
+        // the notification is only armed once the iterator has been run through, which also skips the ports there already
+        releaseServices (iterator);
+        return true;
+    }
+
+    static void servicesChanged (void* refCon, io_iterator_t iterator)
+    {
+        releaseServices (iterator);
+        auto* deviceEvents = static_cast<PlatformDeviceEvents*> (refCon);
+        deviceEvents->devicesChanged = true;
+        deviceEvents->woken.signal ();
+    }
+
+    static void releaseServices (io_iterator_t iterator)
+    {
+        while (const auto service = IOIteratorNext (iterator))
+            IOObjectRelease (service);
+    }
+
+    IONotificationPortRef notificationPort { nullptr };
+    dispatch_queue_t queue { nullptr };
+    io_iterator_t arrivedIterator { 0 };
+    io_iterator_t departedIterator { 0 };
+    bool valid { false };
+    std::atomic<bool> devicesChanged { false };
+    WaitableEvent woken;
+};
+
+std::unique_ptr<SerialPortWatcher::DeviceEvents> SerialPortWatcher::createDeviceEvents ()
+{
+    return std::make_unique<PlatformDeviceEvents> ();
+}
+
 #endif // JUCE_MAC
@@ -0,0 +1,266 @@
+/*Fixed layout packets, described once as a list of parts and then written and read without any allocation
+
+	using TempoPacket = SerialPortPacket<SerialPortPacketBytes<'*', '~', 2, 4>,     // constant header bytes
+	                                     SerialPortLittleEndian<uint32_t>>;         // the tempo
+
+	outputStream.writePacket<TempoPacket> (tempoAsInt);        // built straight into the transmit queue
+	auto bytes = TempoPacket::make (tempoAsInt);               // or into a std::array on the stack
+
+	uint32_t tempoAsInt;
+	if (TempoPacket::read (data, dataSize, tempoAsInt))        // checks the size, constant bytes and any checksum
+		...
+
+The parts are:
+	SerialPortPacketBytes<bytes...>                 constant bytes, written as they are and checked when reading
+	SerialPortLittleEndian<T>, SerialPortBigEndian<T>
+	                                                a value of integer, enum or floating point type T. each one takes
+	                                                the next of the values passed to write () or read ()
+	SerialPortPacketChecksum<Checksum, FromOffset>  a checksum (see juce_serialport_Checksum.h) of the bytes from
+	                                                FromOffset up to where it is
+
+Sizes and offsets are all worked out at compile time, so writing a packet is a fixed sequence of stores.
+readFields () reads a packet whose leading SerialPortPacketBytes (its header) have already been matched and
+removed, as a framer does.
+*/
+
+#ifndef _SERIALPORT_PACKET_H_
+#define _SERIALPORT_PACKET_H_
+
+#include <array>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+//////////////////////////////////////////////////////////////////
+template <uint8_t... Bytes>
+struct SerialPortPacketBytes
+{
+    static_assert (sizeof... (Bytes) > 0, "there must be at least one byte");
+    static constexpr size_t size = sizeof... (Bytes);
+    static constexpr bool isConstant = true, isField = false, isChecksum = false;
+    using Values = std::tuple<>;
+
+    static void write (uint8_t* dest)
+    {
+        static constexpr uint8_t bytes[] = { Bytes... };
+        memcpy (dest, bytes, size);
+    }
+
+    static bool matches (const uint8_t* source)
+    {
+        static constexpr uint8_t bytes[] = { Bytes... };
+        return memcmp (source, bytes, size) == 0;
+    }
+};
+
+//////////////////////////////////////////////////////////////////
+template <typename ValueType, bool BigEndian>
+struct SerialPortPacketField
+{
+    static_assert (std::is_arithmetic<ValueType>::value || std::is_enum<ValueType>::value, "fields must be integers, enums or floating point");
+    static constexpr size_t size = sizeof (ValueType);
+    static constexpr bool isConstant = false, isField = true, isChecksum = false;
+    using Values = std::tuple<ValueType>;
+
+    static void write (ValueType value, uint8_t* dest)
+    {
+        // floats and enums are sent as the integer with the same bits
+        Bits bits;
+        memcpy (&bits, &value, size);
+        for (size_t byteIndex = 0; byteIndex < size; ++byteIndex)
+            dest[byteIndex] = static_cast<uint8_t> (bits >> (8 * (BigEndian ? size - 1 - byteIndex : byteIndex)));
+    }
+
+    static ValueType read (const uint8_t* source)
+    {
+        Bits bits = 0;
+        for (size_t byteIndex = 0; byteIndex < size; ++byteIndex)
+            bits = static_cast<Bits> (bits | static_cast<Bits> (static_cast<Bits> (source[byteIndex]) << (8 * (BigEndian ? size - 1 - byteIndex : byteIndex))));
+        ValueType value;
+        memcpy (&value, &bits, size);
+        return value;
+    }
+
+private:
+    static_assert (size == 1 || size == 2 || size == 4 || size == 8, "fields must be 1, 2, 4 or 8 bytes");
+    using Bits = std::conditional_t<size == 1, uint8_t, std::conditional_t<size == 2, uint16_t, std::conditional_t<size == 4, uint32_t, uint64_t>>>;
+};
+
+template <typename ValueType> using SerialPortLittleEndian = SerialPortPacketField<ValueType, false>;
+template <typename ValueType> using SerialPortBigEndian = SerialPortPacketField<ValueType, true>;
+
+//////////////////////////////////////////////////////////////////
+template <typename Checksum, size_t FromOffset = 0>
+struct SerialPortPacketChecksum
+{
+    static constexpr size_t size = Checksum::numBytes;
+    static constexpr size_t fromOffset = FromOffset;
+    static constexpr bool isConstant = false, isField = false, isChecksum = true;
+    using Values = std::tuple<>;
+
+    // covered points to the byte at FromOffset, dest to where the checksum goes
+    static void write (const uint8_t* covered, uint8_t* dest)
+    {
+        Checksum::writeValue (Checksum::calculate (covered, static_cast<size_t> (dest - covered)), dest);
+    }
+
+    static bool matches (const uint8_t* covered, const uint8_t* source)
+    {
+        return Checksum::calculate (covered, static_cast<size_t> (source - covered)) == Checksum::readValue (source);
+    }
+};
+
+//////////////////////////////////////////////////////////////////
+//offsets and sizes of the parts of a SerialPortPacket
+template <typename... Parts>
+struct SerialPortPacketLayout
+{
+    static constexpr size_t numParts = sizeof... (Parts);
+
+    static constexpr std::array<size_t, numParts + 1> getOffsets ()
+    {
+        std::array<size_t, numParts + 1> offsets {};
+        const size_t sizes[] = { Parts::size..., 0 };
+        for (size_t partIndex = 0; partIndex < numParts; ++partIndex)
+            offsets[partIndex + 1] = offsets[partIndex] + sizes[partIndex];
+        return offsets;
+    }
+
+    static constexpr std::array<size_t, numParts + 1> getValueIndices ()
+    {
+        std::array<size_t, numParts + 1> valueIndices {};
+        const bool isField[] = { Parts::isField..., false };
+        for (size_t partIndex = 0; partIndex < numParts; ++partIndex)
+            valueIndices[partIndex + 1] = valueIndices[partIndex] + (isField[partIndex] ? 1 : 0);
+        return valueIndices;
+    }
+
+    static constexpr size_t getHeaderSize ()
+    {
+        const bool isConstant[] = { Parts::isConstant..., false };
+        const size_t sizes[] = { Parts::size..., 0 };
+        return isConstant[0] ? sizes[0] : 0;
+    }
+};
+
+//////////////////////////////////////////////////////////////////
+template <typename... Parts>
+class SerialPortPacket
+{
+    using Layout = SerialPortPacketLayout<Parts...>;
+
+public:
+    static constexpr size_t numParts = sizeof... (Parts);
+    static constexpr size_t size = (size_t (0) + ... + Parts::size);
+    using Values = decltype (std::tuple_cat (std::declval<typename Parts::Values> ()...));
+    static constexpr size_t numValues = std::tuple_size<Values>::value;
+
+    //the size of the leading constant bytes, which readFields () expects to have been removed
+    static constexpr size_t headerSize = Layout::getHeaderSize ();
+
+    //writes the whole packet to dest, which must have room for size bytes, and returns size
+    template <typename... ValueTypes>
+    static size_t write (uint8_t* dest, const ValueTypes&... values)
+    {
+        static_assert (sizeof... (ValueTypes) == numValues, "there must be one value for each field");
+        const Values fieldValues (values...);
+        writeParts (dest, fieldValues, std::make_index_sequence<numParts> ());
+        return size;
+    }
+
+    template <typename... ValueTypes>
+    static std::array<uint8_t, size> make (const ValueTypes&... values)
+    {
+        std::array<uint8_t, size> packet;
+        write (packet.data (), values...);
+        return packet;
+    }
+
+    //reads a whole packet into values, returning false without changing them if the size, constant bytes or checksums don't match
+    template <typename... ValueTypes>
+    static bool read (const uint8_t* source, size_t sourceSize, ValueTypes&... values)
+    {
+        return readFrom<0> (source, sourceSize, values...);
+    }
+
+    //as read (), for a packet that starts after the header
+    template <typename... ValueTypes>
+    static bool readFields (const uint8_t* source, size_t sourceSize, ValueTypes&... values)
+    {
+        return readFrom<headerSize> (source, sourceSize, values...);
+    }
+
+private:
+    using PartTypes = std::tuple<Parts...>;
+    template <size_t PartIndex> using Part = std::tuple_element_t<PartIndex, PartTypes>;
+
+    static constexpr auto offsets = Layout::getOffsets ();
+    static constexpr auto valueIndices = Layout::getValueIndices ();
+
+    template <size_t... PartIndices>
+    static void writeParts (uint8_t* dest, const Values& fieldValues, std::index_sequence<PartIndices...>)
+    {
+        // in order, so checksums are written after what they cover
+        (writePart<PartIndices> (dest, fieldValues), ...);
+    }
+
+    template <size_t PartIndex>
+    static void writePart (uint8_t* dest, const Values& fieldValues)
+    {
+        using ThisPart = Part<PartIndex>;
+        if constexpr (ThisPart::isConstant)
+            ThisPart::write (dest + offsets[PartIndex]);
+        else if constexpr (ThisPart::isField)
+            ThisPart::write (std::get<valueIndices[PartIndex]> (fieldValues), dest + offsets[PartIndex]);
+        else
+            ThisPart::write (dest + ThisPart::fromOffset, dest + offsets[PartIndex]);
+    }
+
+    // source holds the packet from startOffset on
+    template <size_t StartOffset, typename... ValueTypes>
+    static bool readFrom (const uint8_t* source, size_t sourceSize, ValueTypes&... values)
+    {
+        static_assert (sizeof... (ValueTypes) == numValues, "there must be one value for each field");
+        if (sourceSize != size - StartOffset)
+            return false;
+
+        Values fieldValues;
+        if (! readParts<StartOffset> (source, fieldValues, std::make_index_sequence<numParts> ()))
+            return false;
+        std::tie (values...) = fieldValues;
+        return true;
+    }
+
+    template <size_t StartOffset, size_t... PartIndices>
+    static bool readParts (const uint8_t* source, Values& fieldValues, std::index_sequence<PartIndices...>)
+    {
+        return (readPart<StartOffset, PartIndices> (source, fieldValues) && ...);
+    }
+
+    template <size_t StartOffset, size_t PartIndex>
+    static bool readPart (const uint8_t* source, Values& fieldValues)
+    {
+        using ThisPart = Part<PartIndex>;
+        if constexpr (offsets[PartIndex] < StartOffset)
+        {
+            // the header, which has been checked already
+            return true;
+        }
+        else if constexpr (ThisPart::isConstant)
+        {
+            return ThisPart::matches (source + offsets[PartIndex] - StartOffset);
+        }
+        else if constexpr (ThisPart::isField)
+        {
+            std::get<valueIndices[PartIndex]> (fieldValues) = ThisPart::read (source + offsets[PartIndex] - StartOffset);
+            return true;
+        }
+        else
+        {
+            static_assert (ThisPart::fromOffset >= StartOffset, "the checksum covers the header, so it can only be checked with read ()");
+            return ThisPart::matches (source + ThisPart::fromOffset - StartOffset, source + offsets[PartIndex] - StartOffset);
+        }
+    }
+};
+
+#endif //_SERIALPORT_PACKET_H_
@@ -0,0 +1,114 @@
+/*What is known about each serial port, from SerialPort::getSerialPortInfo (), and an index for finding a device by it
+
+	SerialPortInfoIndex ports (SerialPort::getSerialPortInfo ());     // or watcher.getPortIndex (), kept up to date
+	for (auto* port : ports.findByVidPid (0x2341, 0x0043))           // every Arduino Uno plugged in
+		...
+	if (auto* port = ports.findBySerialNumber ("75735323530351F0A1C1"))
+		serialPort.open (port->path);
+
+Everything is gathered in one pass over sysfs (Linux), the IORegistry (macOS), SetupAPI (Windows) or the USB manager
+(Android), so finding a device no longer means opening and probing every port. What isn't known for a port is left
+empty, or -1, eg. the USB fields of a built in UART. The index is built once, and each lookup is a hash table find.
+*/
+
+#ifndef _SERIALPORT_PORTINFO_H_
+#define _SERIALPORT_PORTINFO_H_
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////
+struct SerialPortInfo
+{
+    juce::String path;              //what to pass to SerialPort::open ()
+    juce::String name;              //the friendly name, which is the key in SerialPort::getSerialPortPaths ()
+    juce::String driver;            //eg. "ftdi_sio" or "cdc_acm" on Linux, the driver's class on macOS, its service on Windows
+    int vendorId { -1 };            //USB ids, -1 where the port isn't on a USB device
+    int productId { -1 };
+    juce::String serialNumber;      //from the USB device's descriptors, empty where it has none
+    juce::String manufacturer;
+    juce::String product;
+    int interfaceNumber { -1 };     //which of a multi-port USB device's interfaces it is, -1 where not known
+    juce::String location;          //where the device is plugged in, which stays the same when it is replugged into the same socket
+
+    bool isUsb () const { return vendorId >= 0; }
+};
+
+//////////////////////////////////////////////////////////////////
+class SerialPortInfoIndex
+{
+public:
+    SerialPortInfoIndex () = default;
+
+    explicit SerialPortInfoIndex (const juce::Array<SerialPortInfo>& portsToIndex)
+    {
+        ports.reserve (static_cast<size_t> (portsToIndex.size ()));
+        for (const auto& port : portsToIndex)
+            ports.push_back (port);
+
+        // the ports don't move once they are in place, so the tables can point at them
+        for (const auto& port : ports)
+        {
+            byPath[port.path.toStdString ()] = &port;
+            if (port.isUsb ())
+                byVidPid[vidPidKey (port.vendorId, port.productId)].push_back (&port);
+            if (port.serialNumber.isNotEmpty ())
+                bySerialNumber[port.serialNumber.toStdString ()].push_back (&port);
+        }
+    }
+
+    SerialPortInfoIndex (SerialPortInfoIndex&&) = default;
+    SerialPortInfoIndex& operator= (SerialPortInfoIndex&&) = default;
+
+    const std::vector<SerialPortInfo>& getPorts () const { return ports; }
+
+    //nullptr if there is no such port
+    const SerialPortInfo* findByPath (const juce::String& path) const
+    {
+        const auto found = byPath.find (path.toStdString ());
+        return found != byPath.end () ? found->second : nullptr;
+    }
+
+    //every port on devices with these USB ids, in the order they were enumerated
+    const std::vector<const SerialPortInfo*>& findByVidPid (int vendorId, int productId) const
+    {
+        const auto found = byVidPid.find (vidPidKey (vendorId, productId));
+        return found != byVidPid.end () ? found->second : noPorts ();
+    }
+
+    //the first port on the device with this serial number, nullptr if there is none. findAllBySerialNumber () has the
+    //others, for a device with several ports
+    const SerialPortInfo* findBySerialNumber (const juce::String& serialNumber) const
+    {
+        const auto& found = findAllBySerialNumber (serialNumber);
+        return found.empty () ? nullptr : found.front ();
+    }
+
+    const std::vector<const SerialPortInfo*>& findAllBySerialNumber (const juce::String& serialNumber) const
+    {
+        const auto found = bySerialNumber.find (serialNumber.toStdString ());
+        return found != bySerialNumber.end () ? found->second : noPorts ();
+    }
+
+private:
+    static uint32_t vidPidKey (int vendorId, int productId)
+    {
+        return (static_cast<uint32_t> (vendorId & 0xffff) << 16) | static_cast<uint32_t> (productId & 0xffff);
+    }
+
+    static const std::vector<const SerialPortInfo*>& noPorts ()
+    {
+        static const std::vector<const SerialPortInfo*> none;
+        return none;
+    }
+
+    std::vector<SerialPortInfo> ports;
+    std::unordered_map<std::string, const SerialPortInfo*> byPath;
+    std::unordered_map<uint32_t, std::vector<const SerialPortInfo*>> byVidPid;
+    std::unordered_map<std::string, std::vector<const SerialPortInfo*>> bySerialNumber;
+
+    JUCE_DECLARE_NON_COPYABLE (SerialPortInfoIndex)
+};
+
+#endif //_SERIALPORT_PORTINFO_H_
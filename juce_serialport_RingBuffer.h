@@ -0,0 +1,409 @@
+/*Single producer / single consumer byte ring used for the receive side of SerialPortInputStream
+
+The reader thread is the only producer and the owner of the stream is the only consumer. Read and
+write positions are free running 64 bit counters held in atomics, so in the normal case neither side
+takes a lock or waits for the other, and consuming data never moves the bytes that are left behind.
+
+When the producer runs out of space it copies the unread data into storage twice the size. The old
+storage is kept until the ring is deleted rather than freed, as the consumer may still be reading it,
+so growing never waits for the consumer (and everything kept adds up to less than the storage in use).
+
+The one time the producer has to wait is when the owner has put a limit on how much is kept, and the
+oldest data is dropped with makeRoom (). Then the consumer mustn't be in the middle of reading. The
+consumer marks the times it is touching the data as a ScopedConsumerSection (prepareToRead () to
+finishedRead () is one as well), which only takes a lock while a drop is under way. Anything that
+measures the data before taking it must do both in one section, as the oldest data can go in between
+otherwise.
+
+The ring also counts delimiters as they go in and come out, so asking whether a delimiter is waiting
+doesn't need a search. '\n', '\r' and 0 are always counted, and a few more can be added with
+trackDelimiter (). Finding where the next delimiter is only searches data that hasn't been searched
+before, so repeated polling costs nothing once it has been found.
+*/
+
+#ifndef _SERIALPORT_RINGBUFFER_H_
+#define _SERIALPORT_RINGBUFFER_H_
+
+#include <atomic>
+
+class JUCE_API SerialPortRingBuffer
+{
+public:
+    static constexpr int maxTrackedDelimiters = 8;
+
+    explicit SerialPortRingBuffer (size_t initialCapacity = 4096)
+    {
+        size_t capacity = 1;
+        while (capacity < initialCapacity)
+            capacity <<= 1;
+        storage = storages.add (new Storage (capacity));
+
+        for (const auto delimiter : { uint8_t ('\n'), uint8_t ('\r'), uint8_t (0) })
+        {
+            trackers[numTrackers].delimiter = delimiter;
+            trackers[numTrackers++].countFrom = 0;
+        }
+    }
+
+    //producer side. stores all of the data, growing the storage if needed
+    void write (const void* data, size_t numBytes)
+    {
+        const auto writePosition = tail.load (std::memory_order_relaxed);
+        auto* currentStorage = storage.load (std::memory_order_relaxed);
+        if (currentStorage->capacity - static_cast<size_t> (writePosition - head.load (std::memory_order_acquire)) < numBytes)
+            currentStorage = grow (writePosition, numBytes);
+
+        copyIn (*currentStorage, writePosition, static_cast<const uint8_t*> (data), numBytes);
+        tail.store (writePosition + numBytes);
+
+        //counted after the data is visible, so a non zero count always means the delimiter can be read.
+        //the tail store above and the numTrackers load below pair up with the ones in trackDelimiter ()
+        for (auto trackerIndex = 0; trackerIndex < numTrackers.load (); ++trackerIndex)
+        {
+            auto& tracker = trackers[trackerIndex];
+            auto countFrom = tracker.countFrom.load (std::memory_order_acquire);
+            if (countFrom == noPosition && tracker.countFrom.compare_exchange_strong (countFrom, writePosition))
+                countFrom = writePosition;
+
+            //anything before countFrom was counted by trackDelimiter ()
+            const auto numBytesAlreadyCounted = countFrom > writePosition ? juce::jmin (numBytes, static_cast<size_t> (countFrom - writePosition)) : 0;
+            tracker.numReceived.store (tracker.numReceived.load (std::memory_order_relaxed)
+                                         + countOccurrences (static_cast<const uint8_t*> (data) + numBytesAlreadyCounted,
+                                                             numBytes - numBytesAlreadyCounted, tracker.delimiter),
+                                       std::memory_order_release);
+        }
+    }
+
+    //consumer side. returns the number of bytes copied into destBuffer
+    size_t read (void* destBuffer, size_t maxBytesToRead)
+    {
+        const ScopedConsumerSection section (*this);
+        const auto readPosition = head.load (std::memory_order_relaxed);
+        const auto numBytes = juce::jmin (maxBytesToRead, static_cast<size_t> (tail.load (std::memory_order_acquire) - readPosition));
+
+        const auto& currentStorage = getStorageForReading ();
+        const auto offset = static_cast<size_t> (readPosition & (currentStorage.capacity - 1));
+        const auto firstPart = juce::jmin (numBytes, currentStorage.capacity - offset);
+        memcpy (destBuffer, currentStorage.data + offset, firstPart);
+        memcpy (static_cast<uint8_t*> (destBuffer) + firstPart, currentStorage.data.getData (), numBytes - firstPart);
+
+        for (auto trackerIndex = 0; trackerIndex < numTrackers.load (std::memory_order_acquire); ++trackerIndex)
+            trackers[trackerIndex].numConsumed += countOccurrences (destBuffer, numBytes, trackers[trackerIndex].delimiter);
+
+        head.store (readPosition + numBytes, std::memory_order_release);
+        return numBytes;
+    }
+
+    //consumer side. gives direct access to all of the unread data, as up to two blocks (the second is only used
+    //when the data wraps around the end of the storage). the blocks stay as they are until finishedRead () is called, which
+    //must follow on the same thread, as this opens a ScopedConsumerSection that lasts until then
+    void prepareToRead (const uint8_t*& block1, size_t& blockSize1, const uint8_t*& block2, size_t& blockSize2)
+    {
+        beginConsumerSection ();
+        const auto readPosition = head.load (std::memory_order_relaxed);
+        const auto numBytes = static_cast<size_t> (tail.load (std::memory_order_acquire) - readPosition);
+
+        const auto& currentStorage = getStorageForReading ();
+        const auto offset = static_cast<size_t> (readPosition & (currentStorage.capacity - 1));
+        block1 = currentStorage.data + offset;
+        blockSize1 = juce::jmin (numBytes, currentStorage.capacity - offset);
+        block2 = currentStorage.data.getData ();
+        blockSize2 = numBytes - blockSize1;
+    }
+
+    //consumer side. must follow every prepareToRead (), with the number of bytes that have been used up
+    void finishedRead (size_t numBytesRead)
+    {
+        jassert (numBytesRead <= static_cast<size_t> (tail.load (std::memory_order_acquire) - head.load (std::memory_order_relaxed)));
+        consume (numBytesRead);
+        endConsumerSection ();
+    }
+
+    //consumer side. while one of these exists the producer can add data, but can't drop any (see makeRoom ()), so something
+    //measured with getNumBytesUntilDelimiter () is still all there when prepareToRead () is called. they can be nested
+    class ScopedConsumerSection
+    {
+    public:
+        explicit ScopedConsumerSection (SerialPortRingBuffer& ringToUse) : ring (ringToUse) { ring.beginConsumerSection (); }
+        ~ScopedConsumerSection () { ring.endConsumerSection (); }
+
+    private:
+        SerialPortRingBuffer& ring;
+
+        JUCE_DECLARE_NON_COPYABLE (ScopedConsumerSection)
+    };
+
+    //producer side. drops the oldest unread data, as if it had been read, until numBytesToAdd more will fit without
+    //holding more than maxBytes. waits for the consumer to leave any ScopedConsumerSection first (including the blocks
+    //from prepareToRead ()), so nothing is changed underneath it. returns the number of bytes dropped
+    size_t makeRoom (size_t numBytesToAdd, size_t maxBytes)
+    {
+        if (static_cast<size_t> (tail.load (std::memory_order_relaxed) - head.load (std::memory_order_acquire)) + numBytesToAdd <= maxBytes)
+            return 0;
+
+        // a consumer starting a section from now on sees dropPending and waits on dropLock
+        dropPending.store (true);
+        const juce::ScopedLock l (dropLock);
+        for (auto numWaits = 0; consumerBusy.load (); ++numWaits)
+        {
+            if (numWaits < maxYieldsBeforeSleeping)
+                juce::Thread::yield ();
+            else
+                juce::Thread::sleep (1);
+        }
+
+        const auto numReady = static_cast<size_t> (tail.load (std::memory_order_relaxed) - head.load (std::memory_order_relaxed));
+        const auto numBytesToDrop = numReady + numBytesToAdd > maxBytes ? juce::jmin (numReady, numReady + numBytesToAdd - maxBytes) : 0;
+        consume (numBytesToDrop);
+        dropPending.store (false);
+        return numBytesToDrop;
+    }
+
+    //starts counting another delimiter, including any already waiting to be read. returns false if too many are being tracked.
+    //must not be called from between prepareToRead () and finishedRead ()
+    bool trackDelimiter (uint8_t delimiter)
+    {
+        const ScopedConsumerSection section (*this);
+        if (findTracker (delimiter) != nullptr)
+            return true;
+
+        const auto trackerIndex = numTrackers.load (std::memory_order_relaxed);
+        if (trackerIndex == maxTrackedDelimiters)
+            return false;
+
+        auto& tracker = trackers[trackerIndex];
+        const auto readPosition = head.load (std::memory_order_relaxed);
+        tracker.delimiter = delimiter;
+        tracker.numReceived = 0;
+        tracker.numReceivedBeforeTracking = 0;
+        tracker.numConsumed = 0;
+        tracker.countFrom = noPosition;
+        tracker.nextPosition = noPosition;
+        tracker.searchedUpTo = readPosition;
+
+        //from here on the producer counts for this tracker too. whichever of us sets countFrom first decides where the
+        //producer's counting starts, and everything before that is counted here, so no delimiter is missed or counted twice
+        numTrackers.store (trackerIndex + 1);
+        auto countFrom = noPosition;
+        const auto writePosition = tail.load ();
+        if (tracker.countFrom.compare_exchange_strong (countFrom, writePosition))
+            countFrom = writePosition;
+
+        tracker.numReceivedBeforeTracking.store (countOccurrences (readPosition, countFrom, delimiter), std::memory_order_release);
+        return true;
+    }
+
+    //number of tracked delimiters waiting to be read, or -1 if the delimiter is not being tracked. safe to call from any thread
+    int getNumDelimiters (uint8_t delimiter) const
+    {
+        if (const auto* tracker = findTracker (delimiter))
+            return static_cast<int> (tracker->getNumWaiting ());
+        return -1;
+    }
+
+    //consumer side. the number of bytes before the next occurrence of a tracked delimiter, or -1 if there is none waiting
+    int getNumBytesUntilDelimiter (uint8_t delimiter)
+    {
+        const ScopedConsumerSection section (*this);
+        auto* tracker = findTracker (delimiter);
+        if (tracker == nullptr || tracker->getNumWaiting () == 0)
+            return -1;
+
+        const auto readPosition = head.load (std::memory_order_relaxed);
+        if (tracker->nextPosition == noPosition || tracker->nextPosition < readPosition)
+        {
+            //carry on from wherever the last search got to, so no byte is searched twice
+            const auto writePosition = tail.load (std::memory_order_acquire);
+            tracker->nextPosition = findFirst (juce::jmax (readPosition, tracker->searchedUpTo), writePosition, delimiter);
+            tracker->searchedUpTo = tracker->nextPosition == noPosition ? writePosition : tracker->nextPosition + 1;
+            if (tracker->nextPosition == noPosition)
+                return -1;
+        }
+        return static_cast<int> (tracker->nextPosition - readPosition);
+    }
+
+    //safe to call from any thread
+    size_t getNumReady () const
+    {
+        const auto readPosition = head.load (std::memory_order_acquire);
+        return static_cast<size_t> (tail.load (std::memory_order_acquire) - readPosition);
+    }
+
+    //producer side
+    size_t getCapacity () const { return storage.load (std::memory_order_relaxed)->capacity; }
+
+private:
+    struct DelimiterTracker
+    {
+        uint64_t getNumWaiting () const
+        {
+            //the consumer can count a delimiter a moment before the producer does
+            const auto numConsumedSoFar = numConsumed.load (std::memory_order_acquire);
+            const auto numReceivedSoFar = numReceivedBeforeTracking.load (std::memory_order_acquire) + numReceived.load (std::memory_order_acquire);
+            return numReceivedSoFar > numConsumedSoFar ? numReceivedSoFar - numConsumedSoFar : 0;
+        }
+
+        uint8_t delimiter { 0 };
+        std::atomic<uint64_t> numReceived { 0 };   // only changed by the producer
+        std::atomic<uint64_t> numReceivedBeforeTracking { 0 };   // set once by trackDelimiter ()
+        std::atomic<uint64_t> countFrom { 0 };     // where the producer's counting starts, see trackDelimiter ()
+        std::atomic<uint64_t> numConsumed { 0 };   // only changed by the consumer, or by makeRoom () while it is waiting
+        uint64_t nextPosition { noPosition };      // consumer side cache of where the next one is
+        uint64_t searchedUpTo { 0 };
+    };
+
+    static constexpr uint64_t noPosition = ~static_cast<uint64_t> (0);
+    // how long makeRoom () spins before it sleeps, while the consumer finishes what it is doing
+    static constexpr int maxYieldsBeforeSleeping = 64;
+
+    struct Storage
+    {
+        explicit Storage (size_t capacityToUse) : capacity (capacityToUse) { data.malloc (capacity); }
+
+        juce::HeapBlock<uint8_t> data;
+        const size_t capacity; // always a power of 2
+    };
+
+    // consumer side. tail is always loaded first, so this is a storage that holds everything up to it
+    const Storage& getStorageForReading () const
+    {
+        return *storage.load (std::memory_order_acquire);
+    }
+
+    // consumer side. the consumer is only ever one thread at a time, so the depth needn't be atomic
+    void beginConsumerSection ()
+    {
+        if (consumerDepth++ > 0)
+            return;
+
+        // pairs with makeRoom (), so either this sees a drop starting, or the drop waits for this section to end
+        consumerBusy.store (true);
+        if (dropPending.load ())
+        {
+            consumerBusy.store (false);
+            const juce::ScopedLock l (dropLock);
+            // set while the lock is still held, so a drop that starts next waits for this section
+            consumerBusy.store (true);
+        }
+    }
+
+    void endConsumerSection ()
+    {
+        jassert (consumerDepth > 0);
+        if (--consumerDepth == 0)
+            consumerBusy.store (false, std::memory_order_release);
+    }
+
+    const DelimiterTracker* findTracker (uint8_t delimiter) const
+    {
+        const auto numTrackersInUse = numTrackers.load (std::memory_order_acquire);
+        for (auto trackerIndex = 0; trackerIndex < numTrackersInUse; ++trackerIndex)
+            if (trackers[trackerIndex].delimiter == delimiter)
+                return &trackers[trackerIndex];
+        return nullptr;
+    }
+
+    DelimiterTracker* findTracker (uint8_t delimiter)
+    {
+        return const_cast<DelimiterTracker*> (static_cast<const SerialPortRingBuffer*> (this)->findTracker (delimiter));
+    }
+
+    static uint64_t countOccurrences (const void* data, size_t numBytes, uint8_t byteToFind)
+    {
+        uint64_t count = 0;
+        auto searchFrom = static_cast<const uint8_t*> (data);
+        const auto searchEnd = searchFrom + numBytes;
+        while (searchFrom < searchEnd)
+        {
+            const auto found = static_cast<const uint8_t*> (memchr (searchFrom, byteToFind, static_cast<size_t> (searchEnd - searchFrom)));
+            if (found == nullptr)
+                break;
+            ++count;
+            searchFrom = found + 1;
+        }
+        return count;
+    }
+
+    //these work on positions in the ring, so must be called by the consumer in a section, or by makeRoom ()
+    void consume (size_t numBytes)
+    {
+        const auto readPosition = head.load (std::memory_order_relaxed);
+        //never past the data, or getNumReady () would wrap around
+        numBytes = juce::jmin (numBytes, static_cast<size_t> (tail.load (std::memory_order_acquire) - readPosition));
+        for (auto trackerIndex = 0; trackerIndex < numTrackers.load (std::memory_order_acquire); ++trackerIndex)
+            trackers[trackerIndex].numConsumed += countOccurrences (readPosition, readPosition + numBytes, trackers[trackerIndex].delimiter);
+
+        head.store (readPosition + numBytes, std::memory_order_release);
+    }
+
+    uint64_t countOccurrences (uint64_t fromPosition, uint64_t toPosition, uint8_t byteToFind) const
+    {
+        const auto& currentStorage = getStorageForReading ();
+        const auto numBytes = static_cast<size_t> (toPosition - fromPosition);
+        const auto offset = static_cast<size_t> (fromPosition & (currentStorage.capacity - 1));
+        const auto firstPart = juce::jmin (numBytes, currentStorage.capacity - offset);
+        return countOccurrences (currentStorage.data + offset, firstPart, byteToFind)
+             + countOccurrences (currentStorage.data.getData (), numBytes - firstPart, byteToFind);
+    }
+
+    uint64_t findFirst (uint64_t fromPosition, uint64_t toPosition, uint8_t byteToFind) const
+    {
+        const auto& currentStorage = getStorageForReading ();
+        const auto numBytes = static_cast<size_t> (toPosition - fromPosition);
+        const auto offset = static_cast<size_t> (fromPosition & (currentStorage.capacity - 1));
+        const auto firstPart = juce::jmin (numBytes, currentStorage.capacity - offset);
+        const auto* data = currentStorage.data.getData ();
+        if (const auto found = static_cast<const uint8_t*> (memchr (data + offset, byteToFind, firstPart)))
+            return fromPosition + static_cast<uint64_t> (found - (data + offset));
+        if (const auto found = static_cast<const uint8_t*> (memchr (data, byteToFind, numBytes - firstPart)))
+            return fromPosition + firstPart + static_cast<uint64_t> (found - data);
+        return noPosition;
+    }
+
+    static void copyIn (Storage& dest, uint64_t position, const uint8_t* source, size_t numBytes)
+    {
+        const auto offset = static_cast<size_t> (position & (dest.capacity - 1));
+        const auto firstPart = juce::jmin (numBytes, dest.capacity - offset);
+        memcpy (dest.data + offset, source, firstPart);
+        memcpy (dest.data, source + firstPart, numBytes - firstPart);
+    }
+
+    Storage* grow (uint64_t writePosition, size_t numBytesToAdd)
+    {
+        const auto& oldStorage = *storage.load (std::memory_order_relaxed);
+        // the consumer can carry on reading meanwhile, which only means some of this is copied for nothing
+        const auto readPosition = head.load (std::memory_order_acquire);
+        const auto numReady = static_cast<size_t> (writePosition - readPosition);
+
+        auto newCapacity = oldStorage.capacity;
+        while (newCapacity - numReady < numBytesToAdd)
+            newCapacity <<= 1;
+
+        //positions are kept as they are, so the unread data is copied to where those positions land in the new storage
+        auto* newStorage = storages.add (new Storage (newCapacity));
+        const auto offset = static_cast<size_t> (readPosition & (oldStorage.capacity - 1));
+        const auto firstPart = juce::jmin (numReady, oldStorage.capacity - offset);
+        copyIn (*newStorage, readPosition, oldStorage.data + offset, firstPart);
+        copyIn (*newStorage, readPosition + firstPart, oldStorage.data.getData (), numReady - firstPart);
+
+        //published before tail moves on, so a consumer that sees the new data also sees where it is
+        storage.store (newStorage, std::memory_order_release);
+        return newStorage;
+    }
+
+    juce::OwnedArray<Storage> storages; // every storage there has been, as the consumer may be reading any of them
+    std::atomic<Storage*> storage { nullptr }; // the one being written to
+    std::atomic<uint64_t> head { 0 };   // next position to read, only advanced by the consumer, or by makeRoom () while it waits
+    std::atomic<uint64_t> tail { 0 };   // next position to write, only advanced by the producer
+    // makeRoom () waits on these for the consumer to be out of the data
+    std::atomic<bool> consumerBusy { false };
+    std::atomic<bool> dropPending { false };
+    juce::CriticalSection dropLock;
+    int consumerDepth { 0 };
+    DelimiterTracker trackers[maxTrackedDelimiters];
+    std::atomic<int> numTrackers { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE (SerialPortRingBuffer)
+};
+
+#endif //_SERIALPORT_RINGBUFFER_H_
@@ -0,0 +1,264 @@
+/*Queue of pending transmit data used by SerialPortOutputStream
+
+Data is held in a list of fixed size segments. Writes copy into the free space at the end of the last
+segment, or start a new one, so appending never moves data that is already queued. The writer thread
+asks for the pending data as a set of contiguous regions (ready for a gather write) and then consumes
+however many bytes the driver accepted, which only advances an offset or drops emptied segments.
+Emptied segments are kept for reuse, so a steady stream of writes does not allocate.
+
+Writes larger than a segment get a segment of their own, so they are copied exactly once. A MemoryBlock
+handed over with append (MemoryBlock&&...) becomes a segment itself and is not copied at all, and
+prepareToAppend ()/finishedAppend () let the caller build data directly in the queue's own storage.
+*/
+
+#ifndef _SERIALPORT_TRANSMITQUEUE_H_
+#define _SERIALPORT_TRANSMITQUEUE_H_
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+class JUCE_API SerialPortTransmitQueue
+{
+public:
+    struct Region
+    {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    explicit SerialPortTransmitQueue (size_t segmentSizeToUse = 4096) : segmentSize (segmentSizeToUse) {}
+
+    void append (const void* data, size_t numBytes)
+    {
+        auto source = static_cast<const uint8_t*> (data);
+        const juce::ScopedLock l (lock);
+
+        if (! segments.empty ())
+        {
+            auto& lastSegment = *segments.back ();
+            const auto numToCopy = juce::jmin (numBytes, lastSegment.capacity - lastSegment.end);
+            memcpy (lastSegment.getData () + lastSegment.end, source, numToCopy);
+            lastSegment.end += numToCopy;
+            source += numToCopy;
+            numBytes -= numToCopy;
+            numPending += numToCopy;
+        }
+
+        if (numBytes > 0)
+        {
+            auto segment = getFreeSegment (numBytes);
+            memcpy (segment->getData (), source, numBytes);
+            segment->end = numBytes;
+            segments.push_back (std::move (segment));
+            numPending += numBytes;
+        }
+    }
+
+    // takes ownership of the first numBytes of block, without copying them. once they have all been consumed, the block
+    // is passed to onSent (on the thread that consumed them), so it can be reused, or it is simply released if there is no onSent
+    void append (juce::MemoryBlock&& block, size_t numBytes, std::function<void (juce::MemoryBlock&&)> onSent)
+    {
+        jassert (numBytes <= block.getSize ());
+        auto segment = std::make_unique<Segment> (std::move (block));
+        segment->end = segment->capacity = numBytes;
+        segment->onSent = std::move (onSent);
+
+        const juce::ScopedLock l (lock);
+        segments.push_back (std::move (segment));
+        numPending += numBytes;
+    }
+
+    // returns space for up to numBytes at the end of the queue, to be filled in place. the queue is locked until
+    // finishedAppend () is called with the number of bytes actually filled in, which are then queued
+    uint8_t* prepareToAppend (size_t numBytes)
+    {
+        lock.enter ();
+        if (segments.empty () || segments.back ()->capacity - segments.back ()->end < numBytes)
+            segments.push_back (getFreeSegment (numBytes));
+
+        auto& lastSegment = *segments.back ();
+        return lastSegment.getData () + lastSegment.end;
+    }
+
+    void finishedAppend (size_t numBytesAppended)
+    {
+        auto& lastSegment = *segments.back ();
+        jassert (numBytesAppended <= lastSegment.capacity - lastSegment.end);
+        lastSegment.end += numBytesAppended;
+        numPending += numBytesAppended;
+        lock.exit ();
+    }
+
+    // fills in up to maxRegions regions of pending data, in transmit order, and returns how many were filled in.
+    // the regions stay valid until they are consumed, even if more data is appended in the meantime
+    int getPendingRegions (Region* regions, int maxRegions)
+    {
+        const juce::ScopedLock l (lock);
+        auto numRegions = 0;
+        for (auto segmentIterator = segments.begin (); segmentIterator != segments.end () && numRegions < maxRegions; ++segmentIterator)
+        {
+            auto& segment = **segmentIterator;
+            if (segment.end > segment.begin)
+                regions[numRegions++] = { segment.getData () + segment.begin, segment.end - segment.begin };
+        }
+        return numRegions;
+    }
+
+    // removes numBytes from the front of the queue, after they have been handed to the driver
+    void consume (size_t numBytes)
+    {
+        std::vector<std::unique_ptr<Segment>> sentSegments;
+        {
+            const juce::ScopedLock l (lock);
+            jassert (numBytes <= numPending);
+            numPending -= numBytes;
+            numConsumed += numBytes;
+            while (numBytes > 0 && ! segments.empty ())
+            {
+                auto& firstSegment = *segments.front ();
+                const auto numFromSegment = juce::jmin (numBytes, firstSegment.end - firstSegment.begin);
+                firstSegment.begin += numFromSegment;
+                numBytes -= numFromSegment;
+
+                // a segment that is still the last one may be appended to, so it is kept, and just rewound
+                if (firstSegment.begin == firstSegment.end && segments.size () == 1 && firstSegment.onSent == nullptr)
+                {
+                    firstSegment.begin = firstSegment.end = 0;
+                }
+                else if (firstSegment.begin == firstSegment.end)
+                {
+                    if (firstSegment.onSent != nullptr)
+                        sentSegments.push_back (std::move (segments.front ()));
+                    else
+                        recycleSegment (std::move (segments.front ()));
+                    segments.pop_front ();
+                }
+            }
+        }
+
+        // the owners of handed over blocks are told outside of the lock, so they are free to queue more data
+        for (auto& sentSegment : sentSegments)
+            sentSegment->onSent (std::move (sentSegment->block));
+    }
+
+    // safe to call from any thread, without taking the lock
+    size_t getNumPending () const { return numPending; }
+
+    // running totals since the queue was created, so a caller can note where its data ends and wait for
+    // getNumConsumed () to reach it
+    uint64_t getNumAppended () const
+    {
+        const juce::ScopedLock l (lock);
+        return numConsumed + numPending;
+    }
+    uint64_t getNumConsumed () const { return numConsumed; }
+
+private:
+    struct Segment
+    {
+        explicit Segment (size_t capacityToUse) : block (capacityToUse), capacity (capacityToUse) {}
+        explicit Segment (juce::MemoryBlock&& blockToUse) : block (std::move (blockToUse)), capacity (block.getSize ()) {}
+
+        uint8_t* getData () { return static_cast<uint8_t*> (block.getData ()); }
+
+        juce::MemoryBlock block;
+        size_t capacity;
+        size_t begin { 0 };
+        size_t end { 0 };
+        std::function<void (juce::MemoryBlock&&)> onSent;
+    };
+
+    std::unique_ptr<Segment> getFreeSegment (size_t numBytesNeeded)
+    {
+        if (numBytesNeeded > segmentSize)
+            return std::make_unique<Segment> (numBytesNeeded);
+
+        if (spareSegments.empty ())
+            return std::make_unique<Segment> (segmentSize);
+
+        auto segment = std::move (spareSegments.back ());
+        spareSegments.pop_back ();
+        return segment;
+    }
+
+    void recycleSegment (std::unique_ptr<Segment> segment)
+    {
+        // oversized segments, and spares beyond what a busy port needs, are simply released
+        if (segment->capacity != segmentSize || spareSegments.size () >= maxSpareSegments)
+            return;
+
+        segment->begin = 0;
+        segment->end = 0;
+        spareSegments.push_back (std::move (segment));
+    }
+
+    static const size_t maxSpareSegments = 16;
+    const size_t segmentSize;
+    std::deque<std::unique_ptr<Segment>> segments;
+    std::vector<std::unique_ptr<Segment>> spareSegments;
+    std::atomic<size_t> numPending { 0 };
+    std::atomic<uint64_t> numConsumed { 0 };
+    juce::CriticalSection lock;
+
+    JUCE_DECLARE_NON_COPYABLE (SerialPortTransmitQueue)
+};
+
+//////////////////////////////////////////////////////////////////
+/*Pool of equally sized MemoryBlocks, for building outgoing data in buffers that are handed to
+SerialPortOutputStream::write (MemoryBlock&&...) without being copied, and come back once they are sent
+
+	SerialPortBufferPool pool (256);
+	auto block = pool.lease ();
+	const auto numBytes = buildPacket (static_cast<uint8_t*> (block.getData ()));
+	outputStream.write (std::move (block), numBytes, pool.getReleaser ());
+*/
+class JUCE_API SerialPortBufferPool
+{
+public:
+    explicit SerialPortBufferPool (size_t bufferSizeToUse, int maxFreeBuffersToKeep = 32)
+        : bufferSize (bufferSizeToUse), maxFreeBuffers (static_cast<size_t> (maxFreeBuffersToKeep)) {}
+
+    // returns a block of at least getBufferSize () bytes, reusing a released one when there is one
+    juce::MemoryBlock lease ()
+    {
+        {
+            const juce::SpinLock::ScopedLockType l (lock);
+            if (! freeBuffers.empty ())
+            {
+                auto block = std::move (freeBuffers.back ());
+                freeBuffers.pop_back ();
+                return block;
+            }
+        }
+        return juce::MemoryBlock (bufferSize);
+    }
+
+    void release (juce::MemoryBlock&& block)
+    {
+        const juce::SpinLock::ScopedLockType l (lock);
+        if (freeBuffers.size () < maxFreeBuffers && block.getSize () >= bufferSize)
+            freeBuffers.push_back (std::move (block));
+    }
+
+    // a callback that returns a block to this pool, for passing as the onSent argument of the write calls.
+    // the pool must outlive any writes that are still pending with it
+    std::function<void (juce::MemoryBlock&&)> getReleaser ()
+    {
+        return [this] (juce::MemoryBlock&& block) { release (std::move (block)); };
+    }
+
+    size_t getBufferSize () const { return bufferSize; }
+
+private:
+    const size_t bufferSize;
+    const size_t maxFreeBuffers;
+    std::vector<juce::MemoryBlock> freeBuffers;
+    juce::SpinLock lock;
+
+    JUCE_DECLARE_NON_COPYABLE (SerialPortBufferPool)
+};
+
+#endif //_SERIALPORT_TRANSMITQUEUE_H_
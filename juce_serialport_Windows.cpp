@@ -12,7 +12,11 @@
 using namespace juce;
 
 #include <windows.h>
+#include <setupapi.h>
+#include <cfgmgr32.h>
+#include <devpropdef.h>
 #include <stdio.h>
+#include <unordered_map>
 
 #include "juce_serialport.h"
 
@@ -117,12 +121,253 @@ StringPairArray SerialPort::getSerialPortPaths()
     return SerialPortPaths;
 }
 
+namespace
+{
+    // GUID_DEVCLASS_PORTS and DEVPKEY_Device_BusReportedDeviceDesc, spelled out so that nothing needs INITGUID
+    const GUID portsClassGuid = { 0x4d36e978, 0xe325, 0x11ce, { 0xbf, 0xc1, 0x08, 0x00, 0x2b, 0xe1, 0x03, 0x18 } };
+    const DEVPROPKEY busReportedDeviceDescKey = { { 0x540b947e, 0x8b40, 0x45bc, { 0xa8, 0xa2, 0x6a, 0x0b, 0x89, 0x4c, 0xbd, 0xa2 } }, 4 };
+
+    String getDeviceNodeProperty (DEVINST deviceNode, ULONG property)
+    {
+        WCHAR value[512] = {};
+        ULONG valueSize = sizeof (value) - sizeof (WCHAR);
+        if (CM_Get_DevNode_Registry_PropertyW (deviceNode, property, NULL, value, &valueSize, 0) != CR_SUCCESS)
+            return {};
+        return String (value);
+    }
+
+    String getInstanceId (DEVINST deviceNode)
+    {
+        WCHAR instanceId[MAX_DEVICE_ID_LEN + 1] = {};
+        if (CM_Get_Device_IDW (deviceNode, instanceId, MAX_DEVICE_ID_LEN, 0) != CR_SUCCESS)
+            return {};
+        return String (instanceId);
+    }
+
+    // the hex digits after eg. "VID_" in an instance id such as USB\VID_2341&PID_0043\75735323530351F0A1C1, -1 if it has none
+    int getIdField (const String& instanceId, const String& fieldName)
+    {
+        const auto fieldIndex = instanceId.indexOfIgnoreCase (fieldName);
+        if (fieldIndex < 0)
+            return -1;
+        const auto digits = instanceId.substring (fieldIndex + fieldName.length ()).initialSectionContainingOnly ("0123456789abcdefABCDEF");
+        return digits.isNotEmpty () ? digits.getHexValue32 () : -1;
+    }
+
+    // the last part of a USB device's instance id is its serial number, unless Windows had to make one up (which has
+    // '&'s in it). FTDI's own driver puts it after the product id instead, with a letter added for the port
+    String getSerialNumber (const String& instanceId)
+    {
+        const auto idParts = StringArray::fromTokens (instanceId, "\\", "");
+        if (idParts.size () < 3)
+            return {};
+        if (idParts[0].equalsIgnoreCase ("FTDIBUS"))
+        {
+            const auto ftdiParts = StringArray::fromTokens (idParts[1], "+", "");
+            return ftdiParts.size () >= 3 ? ftdiParts[2].dropLastCharacters (1) : String ();
+        }
+        return idParts[2].containsChar ('&') ? String () : idParts[2];
+    }
+
+    // the device's own registry key (its Device Parameters) for the port with this name, or NULL
+    HKEY openPortDeviceKey (const String& portName, REGSAM access)
+    {
+        HKEY portKey = NULL;
+        const auto deviceInfoSet = SetupDiGetClassDevsW (&portsClassGuid, NULL, NULL, DIGCF_PRESENT);
+        if (deviceInfoSet == INVALID_HANDLE_VALUE)
+            return portKey;
+
+        SP_DEVINFO_DATA deviceInfo;
+        deviceInfo.cbSize = sizeof (deviceInfo);
+        for (DWORD deviceIndex = 0; portKey == NULL && SetupDiEnumDeviceInfo (deviceInfoSet, deviceIndex, &deviceInfo); ++deviceIndex)
+        {
+            const auto deviceKey = SetupDiOpenDevRegKey (deviceInfoSet, &deviceInfo, DICS_FLAG_GLOBAL, 0, DIREG_DEV, access);
+            if (deviceKey == INVALID_HANDLE_VALUE)
+                continue;
+            WCHAR devicePortName[64] = {};
+            DWORD portNameSize = sizeof (devicePortName) - sizeof (WCHAR);
+            if (RegQueryValueExW (deviceKey, L"PortName", NULL, NULL, reinterpret_cast<LPBYTE> (devicePortName), &portNameSize) == ERROR_SUCCESS
+                && portName.equalsIgnoreCase (String (devicePortName)))
+                portKey = deviceKey;
+            else
+                RegCloseKey (deviceKey);
+        }
+        SetupDiDestroyDeviceInfoList (deviceInfoSet);
+        return portKey;
+    }
+
+    // the details of every present port in the Ports class, keyed by its port name (COMn)
+    std::unordered_map<std::string, SerialPortInfo> getPortDetails ()
+    {
+        std::unordered_map<std::string, SerialPortInfo> portDetails;
+        const auto deviceInfoSet = SetupDiGetClassDevsW (&portsClassGuid, NULL, NULL, DIGCF_PRESENT);
+        if (deviceInfoSet == INVALID_HANDLE_VALUE)
+            return portDetails;
+
+        SP_DEVINFO_DATA deviceInfo;
+        deviceInfo.cbSize = sizeof (deviceInfo);
+        for (DWORD deviceIndex = 0; SetupDiEnumDeviceInfo (deviceInfoSet, deviceIndex, &deviceInfo); ++deviceIndex)
+        {
+            // printer ports are in the same class, and have an LPTn port name, or none
+            WCHAR portName[64] = {};
+            const auto deviceKey = SetupDiOpenDevRegKey (deviceInfoSet, &deviceInfo, DICS_FLAG_GLOBAL, 0, DIREG_DEV, KEY_QUERY_VALUE);
+            if (deviceKey == INVALID_HANDLE_VALUE)
+                continue;
+            DWORD portNameSize = sizeof (portName) - sizeof (WCHAR);
+            const auto hasPortName = RegQueryValueExW (deviceKey, L"PortName", NULL, NULL, reinterpret_cast<LPBYTE> (portName), &portNameSize) == ERROR_SUCCESS;
+            RegCloseKey (deviceKey);
+            if (! hasPortName)
+                continue;
+
+            SerialPortInfo port;
+            port.driver = getDeviceNodeProperty (deviceInfo.DevInst, CM_DRP_SERVICE);
+            port.manufacturer = getDeviceNodeProperty (deviceInfo.DevInst, CM_DRP_MFG);
+
+            // each port of a composite device (eg. a CDC ACM one) is an interface (MI_nn) of the USB device it belongs to
+            auto instanceId = getInstanceId (deviceInfo.DevInst);
+            auto usbDeviceNode = deviceInfo.DevInst;
+            port.interfaceNumber = getIdField (instanceId, "MI_");
+            DEVINST parentNode;
+            if (port.interfaceNumber >= 0 && CM_Get_Parent (&parentNode, deviceInfo.DevInst, 0) == CR_SUCCESS)
+            {
+                usbDeviceNode = parentNode;
+                instanceId = getInstanceId (parentNode);
+            }
+            port.vendorId = getIdField (instanceId, "VID_");
+            if (port.isUsb ())
+            {
+                port.productId = getIdField (instanceId, "PID_");
+                port.serialNumber = getSerialNumber (instanceId);
+            }
+            port.location = getDeviceNodeProperty (usbDeviceNode, CM_DRP_LOCATION_INFORMATION);
+
+            // the product string the device itself reports, rather than the driver's name for it, where Windows has it
+            WCHAR product[256] = {};
+            DEVPROPTYPE propertyType;
+            if (SetupDiGetDevicePropertyW (deviceInfoSet, &deviceInfo, &busReportedDeviceDescKey, &propertyType, reinterpret_cast<PBYTE> (product), sizeof (product) - sizeof (WCHAR), NULL, 0)
+                && propertyType == DEVPROP_TYPE_STRING)
+                port.product = String (product);
+            else
+                port.product = getDeviceNodeProperty (deviceInfo.DevInst, CM_DRP_DEVICEDESC);
+
+            portDetails[String (portName).toUpperCase ().toStdString ()] = port;
+        }
+        SetupDiDestroyDeviceInfoList (deviceInfoSet);
+        return portDetails;
+    }
+}
+
+// the ports are the ones in SERIALCOMM, as for getSerialPortPaths (), with whatever SetupAPI knows about each of them
+// (virtual ports from some drivers are only in SERIALCOMM)
+Array<SerialPortInfo> SerialPort::getSerialPortInfo ()
+{
+    Array<SerialPortInfo> ports;
+    const auto portDetails = getPortDetails ();
+    const auto portPaths = getSerialPortPaths ();
+    for (auto portIndex = 0; portIndex < portPaths.size (); ++portIndex)
+    {
+        const auto portName = portPaths.getAllKeys ()[portIndex];
+        const auto details = portDetails.find (portName.toUpperCase ().toStdString ());
+        auto port = details != portDetails.end () ? details->second : SerialPortInfo ();
+        port.name = portName;
+        port.path = portPaths.getAllValues ()[portIndex];
+        ports.add (port);
+    }
+    return ports;
+}
+
+/////////////////////////////////
+// SerialPort transmit queue
+/////////////////////////////////
+size_t SerialPort::getNumBytesWaitingInDriver ()
+{
+    DWORD commErrors = 0;
+    COMSTAT commStatus;
+    if (! portHandle || ! ClearCommError (portHandle, &commErrors, &commStatus))
+        return 0;
+    return commStatus.cbOutQue;
+}
+
+bool SerialPort::waitForDriverToSend (int timeoutMs)
+{
+    // FlushFileBuffers () can't be given a timeout, so it isn't called until the driver's queue is empty
+    const auto startTime = Time::getMillisecondCounter ();
+    while (portHandle && getNumBytesWaitingInDriver () > 0)
+    {
+        if (timeoutMs >= 0 && static_cast<int> (Time::getMillisecondCounter () - startTime) >= timeoutMs)
+            return false;
+        Thread::sleep (1);
+    }
+    // then it waits for the last of it to leave the uart
+    return portHandle && FlushFileBuffers (portHandle);
+}
+
+/////////////////////////////////
+// SerialPort low latency profile
+/////////////////////////////////
+void SerialPort::applyDriverLatency (const SerialPortLatencyOptions& options, SerialPortLatencyReport& report)
+{
+    // the read timeouts set by open () (ReadIntervalTimeout of MAXDWORD) already have reads return whatever has arrived
+    report.immediateReads = true;
+    if (options.driverLowLatency)
+        report.notes.add ("Windows serial drivers have no general low latency setting");
+
+    // FTDI's driver keeps its latency timer in the port's Device Parameters, and reads it when the port is opened.
+    // changing it takes administrator rights, and only counts from the next open
+    const auto portName = portPath.fromLastOccurrenceOf ("\\", false, false);
+    auto portKey = openPortDeviceKey (portName, KEY_QUERY_VALUE | KEY_SET_VALUE);
+    const auto canWrite = portKey != NULL;
+    if (portKey == NULL)
+        portKey = openPortDeviceKey (portName, KEY_QUERY_VALUE);
+    if (portKey == NULL)
+    {
+        if (options.usbLatencyTimerMs > 0)
+            report.notes.add ("couldn't find the port's device to look for a latency timer");
+        return;
+    }
+
+    DWORD latencyTimer = 0;
+    DWORD valueSize = sizeof (latencyTimer);
+    if (RegQueryValueExW (portKey, L"LatencyTimer", NULL, NULL, reinterpret_cast<LPBYTE> (&latencyTimer), &valueSize) == ERROR_SUCCESS)
+    {
+        if (options.usbLatencyTimerMs > 0 && latencyTimer != static_cast<DWORD> (options.usbLatencyTimerMs))
+        {
+            const auto newLatencyTimer = static_cast<DWORD> (options.usbLatencyTimerMs);
+            if (canWrite && RegSetValueExW (portKey, L"LatencyTimer", 0, REG_DWORD, reinterpret_cast<const BYTE*> (&newLatencyTimer), sizeof (newLatencyTimer)) == ERROR_SUCCESS)
+                report.notes.add ("the latency timer has been set, and takes effect when the port is next opened");
+            else
+                report.notes.add ("couldn't set the latency timer, which needs administrator rights");
+        }
+        report.usbLatencyTimerMs = static_cast<int> (latencyTimer);
+    }
+    else if (options.usbLatencyTimerMs > 0)
+    {
+        report.notes.add ("the port's driver has no latency timer");
+    }
+    RegCloseKey (portKey);
+}
+
+bool SerialPort::pinCurrentThread (int cpu)
+{
+    if (cpu < 0 || cpu >= static_cast<int> (sizeof (DWORD_PTR) * 8))
+        return false;
+    return SetThreadAffinityMask (GetCurrentThread (), static_cast<DWORD_PTR> (1) << cpu) != 0;
+}
+
+bool SerialPort::makeCurrentThreadRealtime ()
+{
+    return SetThreadPriority (GetCurrentThread (), THREAD_PRIORITY_TIME_CRITICAL) != 0;
+}
+
 void SerialPort::close()
 {
     if (portHandle)
     {
-        CloseHandle(portHandle);
+        // closing the handle aborts the stream threads' pending I/O, and the wakeup covers the rest of their waits
+        const auto handle = portHandle;
         portHandle = 0;
+        closedWakeup.signal ();
+        CloseHandle (handle);
     }
 }
 bool SerialPort::exists()
@@ -132,7 +377,7 @@ bool SerialPort::exists()
 
 bool SerialPort::open (const String & newPortPath)
 {
-    canceled = false;
+    closedWakeup.reset ();
     portPath = newPortPath;
     portHandle = CreateFile((const char*)portPath.toUTF8(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
     if (portHandle == INVALID_HANDLE_VALUE)
@@ -158,17 +403,14 @@ bool SerialPort::open (const String & newPortPath)
     if (!SetCommMask (portHandle, EV_RXCHAR))
         DebugLog ("SerialPort::open", "SetCommMask error");
 
+    counters.opened ();
+    reapplyDriverLatency ();
     return true;
 }
 
 void SerialPort::cancel ()
 {
-    if (! canceled)
-    {
-        canceled = true;
-//        if (portHandle != nullptr)
-//            const auto result = CancelIoEx (portHandle, nullptr);
-    }
+    cancelOperations ();
 }
 bool SerialPort::setConfig(const SerialPortConfig & config)
 {
@@ -295,6 +537,30 @@ bool SerialPort::getConfig(SerialPortConfig & config)
     return true;
 }
 
+/////////////////////////////////
+// SerialPortWakeup
+/////////////////////////////////
+SerialPortWakeup::SerialPortWakeup ()
+{
+    handle = CreateEvent (NULL, TRUE, FALSE, NULL);
+}
+
+SerialPortWakeup::~SerialPortWakeup ()
+{
+    if (handle != nullptr)
+        CloseHandle (handle);
+}
+
+void SerialPortWakeup::signal ()
+{
+    SetEvent (handle);
+}
+
+void SerialPortWakeup::reset ()
+{
+    ResetEvent (handle);
+}
+
 /////////////////////////////////
 // SerialPortInputStream
 /////////////////////////////////
@@ -302,14 +568,20 @@ void SerialPortInputStream::run()
 {
     //port->DebugLog ("SerialPortInputStream::run", "starting");
     DWORD dwEventMask = 0;
+    unsigned char readBuffer[readBufferSize];
     //overlapped structure for the wait
     OVERLAPPED ov;
     memset(&ov, 0, sizeof(ov));
     ov.hEvent = CreateEvent(0, true, 0, 0);
     bool ioPending = false;
+    //set when the receive buffer filled up with OverflowPolicy::stopReading while the driver still had data queued
+    bool dataLeftWithDriver = false;
     //overlapped structure for the read
+    auto tunedGeneration = 0;
     while (port && port->portHandle && !threadShouldExit())
     {
+        // picks up a low latency profile (see SerialPort::setLowLatency ())
+        port->tuneStreamThread (tunedGeneration, true);
         if (!ioPending)
         {
             const auto wceReturn = WaitCommEvent (port->portHandle, &dwEventMask, &ov);
@@ -317,7 +589,9 @@ void SerialPortInputStream::run()
                  juce::Logger::outputDebugString (" dwEventMask: " + String::toHexString (dwEventMask));
             if (wceReturn == 0 && GetLastError () != ERROR_IO_PENDING)
             {
+                const auto lastError = GetLastError ();
                 port->DebugLog ("SerialPortInputStream::run", "error" );
+                notifyError ("WaitCommEvent failed, GetLastError () = " + String (lastError));
                 port->close ();
                 break;
             }
@@ -332,7 +606,17 @@ void SerialPortInputStream::run()
             port->close ();
             break;
         }
-        if (/*(dwEventMask & EV_RXCHAR) && */WAIT_OBJECT_0 == WaitForSingleObject(ov.hEvent, 100))
+        //the wait is cut short by cancel () and close (), and when a notification held back by the notify policy becomes due,
+        //and skipped when data that didn't fit in the receive buffer is still waiting with the driver, as no new comm event will come for it
+        HANDLE waitHandles[] { ov.hEvent, wakeup.getHandle (), port->closedWakeup.getHandle () };
+        const auto waitResult = WaitForMultipleObjects (3, waitHandles, FALSE, dataLeftWithDriver ? 0 : static_cast<DWORD> (getNotificationTimeout (100)));
+        if (waitResult == WAIT_OBJECT_0 + 1 || waitResult == WAIT_OBJECT_0 + 2)
+        {
+            wakeup.reset ();
+            continue;
+        }
+        const auto eventSignalled = waitResult == WAIT_OBJECT_0;
+        if (/*(dwEventMask & EV_RXCHAR) && */eventSignalled || dataLeftWithDriver)
         {
             DWORD dwMask;
             if (GetCommMask(port->portHandle, &dwMask))
@@ -342,41 +626,59 @@ void SerialPortInputStream::run()
                 ovRead.hEvent = CreateEvent (0, true, 0, 0);
                 //if (dwMask & EV_RXCHAR)
                 {
-                    DWORD bytesread = 0;
-                    do
+                    // drain everything the driver has queued, sized by ClearCommError, in as few reads as possible
+                    DWORD commErrors = 0;
+                    COMSTAT commStatus;
+                    dataLeftWithDriver = false;
+                    while (ClearCommError (port->portHandle, &commErrors, &commStatus) && commStatus.cbInQue > 0)
                     {
-                        unsigned char c;
+                        const auto bytesWithRoom = getNumBytesToRead (readBufferSize);
+                        dataLeftWithDriver = bytesWithRoom == 0;
+                        if (dataLeftWithDriver)
+                            break;
+                        DWORD bytesread = 0;
+                        const DWORD bytestoread = jmin (commStatus.cbInQue, static_cast<DWORD> (bytesWithRoom));
                         ResetEvent(ovRead.hEvent);
-                        ReadFile(port->portHandle, &c, 1, &bytesread, &ovRead);
-                        if (GetLastError () != ERROR_SUCCESS)
-                            port->DebugLog("SerialPortInputStream::run", "[getLastError:" + String (GetLastError ()) + "]");
-                        if (bytesread == 1)
+                        if (! ReadFile (port->portHandle, readBuffer, bytestoread, &bytesread, &ovRead)
+                            && (GetLastError () != ERROR_IO_PENDING || ! GetOverlappedResult (port->portHandle, &ovRead, &bytesread, TRUE)))
                         {
-                            const ScopedLock l(bufferCriticalSection);
-                            buffer.ensureSize(bufferedbytes + 1);
-                            buffer[bufferedbytes] = c;
-                            bufferedbytes++;
-                            if (notify == NOTIFY_ALWAYS || ((notify == NOTIFY_ON_CHAR) && (c == notifyChar)))
-                                sendChangeMessage();
+                            const auto lastError = GetLastError ();
+                            port->DebugLog("SerialPortInputStream::run", "[getLastError:" + String (lastError) + "]");
+                            notifyError ("ReadFile failed, GetLastError () = " + String (lastError));
+                            break;
                         }
-                    } while (bytesread);
+                        if (bytesread == 0)
+                            break;
+                        addReceivedData (readBuffer, bytesread);
+                    }
                 }
                 CloseHandle (ovRead.hEvent);
-                ioPending = false;
+                if (eventSignalled)
+                    ioPending = false;
             }
-            ResetEvent(ov.hEvent);
+            if (eventSignalled)
+                ResetEvent(ov.hEvent);
         }
+        if (dataLeftWithDriver)
+            waitForReceiveSpace ();
+        updateNotifications ();
+    }
+    //the comm event wait refers to ov, so it has to be over before ov goes. closing the port has ended it already
+    if (ioPending && ! HasOverlappedIoCompleted (&ov))
+    {
+        DWORD unused = 0;
+        CancelIoEx (port->portHandle, &ov);
+        GetOverlappedResult (port->portHandle, &ov, &unused, TRUE);
     }
     CloseHandle(ov.hEvent);
+    if (! threadShouldExit ())
+        notifyPortClosed ();
     //port->DebugLog ("SerialPortInputStream::run", "exiting");
 }
 
 void SerialPortInputStream::cancel ()
 {
-    if (!port || port->portHandle == 0)
-        return;
-
-    port->cancel ();
+    wakeup.signal ();
 }
 
 int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
@@ -384,12 +686,7 @@ int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
     if (!port || port->portHandle == 0)
         return -1;
 
-    const ScopedLock l (bufferCriticalSection);
-    if (maxBytesToRead > bufferedbytes)maxBytesToRead = bufferedbytes;
-    memcpy (destBuffer, buffer.getData (), maxBytesToRead);
-    buffer.removeSection (0, maxBytesToRead);
-    bufferedbytes -= maxBytesToRead;
-    return maxBytesToRead;
+    return static_cast<int> (buffer.read (destBuffer, static_cast<size_t> (jmax (0, maxBytesToRead))));
 }
 
 /////////////////////////////////
@@ -398,47 +695,65 @@ int SerialPortInputStream::read(void *destBuffer, int maxBytesToRead)
 void SerialPortOutputStream::run()
 {
     //port->DebugLog ("SerialPortOutputStream::run", "starting");
-    unsigned char tempbuffer[writeBufferSize];
+    SerialPortTransmitQueue::Region regions[1];
     OVERLAPPED ov;
     memset(&ov, 0, sizeof(ov));
     ov.hEvent = CreateEvent(0, true, 0, 0);
+    auto tunedGeneration = 0;
     while (port && port->portHandle && !threadShouldExit())
     {
-        if (!bufferedbytes)
+        // picks up a low latency profile (see SerialPort::setLowLatency ())
+        port->tuneStreamThread (tunedGeneration, false);
+        if (buffer.getNumPending () == 0)
+        {
             triggerWrite.wait(100);
-        if (bufferedbytes)
+            // gathers more small writes before sending, if write coalescing is on (see setWriteCoalescing ())
+            waitToCoalesce ();
+        }
+        // WriteFile has no gather form, so each call hands over the whole of the first queued segment
+        if (buffer.getPendingRegions (regions, 1) == 1)
         {
             DWORD byteswritten = 0;
-            bufferCriticalSection.enter ();
-            DWORD bytestowrite = bufferedbytes > writeBufferSize ? writeBufferSize : bufferedbytes;
-            memcpy (tempbuffer, buffer.getData (), bytestowrite);
-            bufferCriticalSection.exit ();
+            const auto bytestowrite = static_cast<DWORD> (jmin (regions[0].size, static_cast<size_t> (MAXDWORD)));
+            const auto portHandle = port->portHandle;
             ResetEvent (ov.hEvent);
-            int iRet = WriteFile (port->portHandle, tempbuffer, bytestowrite, &byteswritten, &ov);
-            auto const lastError = GetLastError ();
+            int iRet = WriteFile (portHandle, regions[0].data, bytestowrite, &byteswritten, &ov);
+            auto const lastError = iRet != 0 ? static_cast<DWORD> (ERROR_SUCCESS) : GetLastError ();
             if (lastError == ERROR_BAD_COMMAND)
             {
                 port->DebugLog ("SerialPortOutputStream::run", "error");
+                port->counters.error ();
                 port->close ();
                 break;
             }
-            if (threadShouldExit () || (lastError != ERROR_SUCCESS && lastError != ERROR_IO_PENDING))
+            if (lastError != ERROR_SUCCESS && lastError != ERROR_IO_PENDING)
             {
                 port->DebugLog ("SerialPortOutputStream::run", "[getLastError:" + String (lastError) + "]");
+                if (! threadShouldExit ())
+                    port->counters.error ();
                 continue;
             }
             if (iRet == 0 && lastError == ERROR_IO_PENDING)
             {
-                DWORD waitResult = WaitForSingleObject (ov.hEvent, 1000);
-                if (threadShouldExit () || waitResult != WAIT_OBJECT_0)
-                    continue;
+                // cancel () and close () cut the wait short, and the write is cancelled, having sent what it has. it refers
+                // to ov, so it is always over before the write is tried again, or the thread stops
+                HANDLE waitHandles[] { ov.hEvent, wakeup.getHandle (), port->closedWakeup.getHandle () };
+                const auto blockedSince = Time::getHighResolutionTicks ();
+                const auto waitResult = WaitForMultipleObjects (3, waitHandles, FALSE, INFINITE);
+                port->counters.blocked (blockedSince);
+                if (waitResult != WAIT_OBJECT_0)
+                {
+                    wakeup.reset ();
+                    CancelIoEx (portHandle, &ov);
+                }
             }
-            GetOverlappedResult (port->portHandle, &ov, &byteswritten, TRUE);
+            GetOverlappedResult (portHandle, &ov, &byteswritten, TRUE);
+            port->counters.sent (byteswritten);
             if (byteswritten)
             {
-                const ScopedLock l (bufferCriticalSection);
-                buffer.removeSection (0, byteswritten);
-                bufferedbytes -= byteswritten;
+                buffer.consume (byteswritten);
+                port->completeReadyOperations ();
+                signalFlushWaiters ();
             }
         }
     }
@@ -448,10 +763,8 @@ void SerialPortOutputStream::run()
 
 void SerialPortOutputStream::cancel ()
 {
-    if (!port || port->portHandle == 0)
-        return;
-
-    port->cancel ();
+    wakeup.signal ();
+    triggerWrite.signal ();
 }
 
 bool SerialPortOutputStream::write(const void *dataToWrite, size_t howManyBytes)
@@ -459,12 +772,90 @@ bool SerialPortOutputStream::write(const void *dataToWrite, size_t howManyBytes)
     if (! port || port->portHandle == 0)
         return false;
 
-    bufferCriticalSection.enter();
-    buffer.append(dataToWrite, howManyBytes);
-    bufferedbytes += (int)howManyBytes;
-    bufferCriticalSection.exit();
-    triggerWrite.signal();
+    buffer.append (dataToWrite, howManyBytes);
+    queuedData ();
     return true;
 }
 
+bool SerialPortOutputStream::write (MemoryBlock&& dataToWrite, size_t howManyBytes, std::function<void (MemoryBlock&&)> onSent)
+{
+    if (! port || port->portHandle == 0)
+        return false;
+
+    buffer.append (std::move (dataToWrite), howManyBytes, std::move (onSent));
+    queuedData ();
+    return true;
+}
+
+uint8_t* SerialPortOutputStream::prepareToWrite (size_t maxBytes)
+{
+    return buffer.prepareToAppend (maxBytes);
+}
+
+void SerialPortOutputStream::finishedWrite (size_t numBytesWritten)
+{
+    buffer.finishedAppend (numBytesWritten);
+    queuedData ();
+}
+
+/////////////////////////////////
+// SerialPortWatcher
+/////////////////////////////////
+// registry change notifications on HARDWARE\DEVICEMAP, whose SERIALCOMM key (only there once a port has been) lists the
+// ports that getSerialPortPaths () returns
+class SerialPortWatcher::PlatformDeviceEvents : public SerialPortWatcher::DeviceEvents
+{
+public:
+    PlatformDeviceEvents ()
+    {
+        changedEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+        wakeEvent = CreateEvent (NULL, FALSE, FALSE, NULL);
+        if (RegOpenKeyEx (HKEY_LOCAL_MACHINE, "HARDWARE\\DEVICEMAP", 0, KEY_NOTIFY, &deviceMapKey) != ERROR_SUCCESS)
+            deviceMapKey = NULL;
+        valid = watchForChanges ();
+    }
+
+    ~PlatformDeviceEvents () override
+    {
+        if (deviceMapKey != NULL)
+            RegCloseKey (deviceMapKey);
+        if (changedEvent != NULL)
+            CloseHandle (changedEvent);
+        if (wakeEvent != NULL)
+            CloseHandle (wakeEvent);
+    }
+
+    bool isValid () const override { return valid; }
+
+    bool wait (int timeoutMs) override
+    {
+        HANDLE events[] = { wakeEvent, changedEvent };
+        const auto result = WaitForMultipleObjects (valid ? 2 : 1, events, FALSE, timeoutMs < 0 ? INFINITE : static_cast<DWORD> (timeoutMs));
+        if (result != WAIT_OBJECT_0 + 1)
+            return false;
+        // a notification only fires once, so it is asked for again before the ports are scanned
+        valid = watchForChanges ();
+        return true;
+    }
+
+    void wake () override { SetEvent (wakeEvent); }
+
+private:
+    bool watchForChanges ()
+    {
+        return deviceMapKey != NULL && changedEvent != NULL && wakeEvent != NULL
+            && RegNotifyChangeKeyValue (deviceMapKey, TRUE, REG_NOTIFY_CHANGE_NAME | REG_NOTIFY_CHANGE_LAST_SET, changedEvent, TRUE) == ERROR_SUCCESS;
+    }
+
+    HKEY deviceMapKey { NULL };
+    HANDLE changedEvent { NULL };
+    HANDLE wakeEvent { NULL };
+    std::atomic<bool> valid { false };
+};
+
+std::unique_ptr<SerialPortWatcher::DeviceEvents> SerialPortWatcher::createDeviceEvents ()
+{
+    return std::make_unique<PlatformDeviceEvents> ();
+}
+
 #endif // JUCE_WIN
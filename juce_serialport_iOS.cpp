@@ -8,13 +8,25 @@ using namespace juce;
 
 StringPairArray SerialPort::getSerialPortPaths () { return StringPairArray(); }
 
+Array<SerialPortInfo> SerialPort::getSerialPortInfo () { return {}; }
+
 bool SerialPort::exists () { return false; }
 
 bool SerialPort::open (const String & portPath) { return false; }
 
 void SerialPort::close () {}
 
-void SerialPort::cancel () {}
+void SerialPort::cancel () { cancelOperations (); }
+
+void SerialPort::applyDriverLatency (const SerialPortLatencyOptions&, SerialPortLatencyReport&) {}
+
+bool SerialPort::pinCurrentThread (int) { return false; }
+
+bool SerialPort::makeCurrentThreadRealtime () { return false; }
+
+size_t SerialPort::getNumBytesWaitingInDriver () { return 0; }
+
+bool SerialPort::waitForDriverToSend (int) { return false; }
 
 bool SerialPort::setConfig(const SerialPortConfig &) { return false; }
 
@@ -34,4 +46,10 @@ void SerialPortOutputStream::run() {}
 
 bool SerialPortOutputStream::write(const void*, size_t) { return false; }
 
+bool SerialPortOutputStream::write (MemoryBlock&&, size_t, std::function<void (MemoryBlock&&)>) { return false; }
+
+uint8_t* SerialPortOutputStream::prepareToWrite (size_t maxBytes) { return buffer.prepareToAppend (maxBytes); }
+
+void SerialPortOutputStream::finishedWrite (size_t) { buffer.finishedAppend (0); }
+
 #endif // JUCE_IOS